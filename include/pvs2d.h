@@ -13,6 +13,8 @@
 #ifndef PVS2D_H
 #define PVS2D_H
 
+#include <stddef.h>
+
 
 // --------------------------------------------------------
 //                       STRUCTURES
@@ -48,6 +50,42 @@ typedef struct PVS2D_Line {
 	struct PVS2D_SegStack* mems;
 } PVS2D_Line;
 
+/**
+ * @brief Точное значение параметра точки на прямой. 
+ * 
+ * Параметр равен `num / den`, где `den >= 0`. При `den == 0` параметр бесконечен, 
+ * и его знак совпадает со знаком `num`. Все точки, которые строит библиотека, лежат на 
+ * пересечениях прямых с целочисленными координатами, поэтому их параметры представимы 
+ * в таком виде точно, если координаты по модулю не превосходят `PVS2D_MAX_COORD`. 
+ * 
+ */
+typedef struct PVS2D_Param {
+	long long num, den;
+} PVS2D_Param;
+
+/**
+ * @brief Наибольшее допустимое по модулю значение координат отрезков. 
+ * 
+ * При таких координатах все геометрические проверки при построении дерева и порталов точны. 
+ * 
+ */
+#define PVS2D_MAX_COORD ((1 << 30) - 1)
+
+/**
+ * @brief Значение `PVS2D_Seg::door` для отрезков, не являющихся дверями. 
+ * 
+ */
+#define PVS2D_NO_DOOR (~0u)
+
+/**
+ * @brief Значение флага `opq` входного отрезка, делающее его дверью с номером `id`. 
+ * 
+ * Дверь - прозрачный отрезок, который во время выполнения можно открыть или закрыть, 
+ * см. `PVS2D_FilterPVSByDoors`. PVS строится так, как будто все двери открыты. 
+ * 
+ */
+#define PVS2D_DOOR(id) (-1 - (int)(id))
+
 /**
  * @brief Отрезок, лежащий на прямой. 
  * 
@@ -77,6 +115,15 @@ typedef struct PVS2D_Seg {
 	 */
 	double tStart, tEnd;
 
+	/**
+	 * @brief Точные значения параметров концов отрезка. 
+	 * 
+	 * Те же `tStart` и `tEnd` в виде дробей. Все геометрические проверки используют их, а 
+	 * `tStart` и `tEnd` равны их ближайшим значениям с плавающей точкой. 
+	 * 
+	 */
+	PVS2D_Param exactStart, exactEnd;
+
 	/**
 	 * @brief Флаг прозрачности. 
 	 * 
@@ -88,6 +135,24 @@ typedef struct PVS2D_Seg {
 	 * 
 	 */
 	int opq;
+
+	/**
+	 * @brief Номер исходного отрезка. 
+	 * 
+	 * Индекс отрезка во входном массиве, из которого получен этот отрезок. Все части, на которые 
+	 * отрезок разрезается при построении дерева, имеют тот же номер. 
+	 * 
+	 */
+	unsigned int id;
+
+	/**
+	 * @brief Номер двери. 
+	 * 
+	 * Номер двери, заданный через `PVS2D_DOOR`, или `PVS2D_NO_DOOR`. Двери всегда прозрачны, 
+	 * а прозрачные порталы, лежащие на двери, получают ее номер. 
+	 * 
+	 */
+	unsigned int door;
 } PVS2D_Seg;
 
 /**
@@ -174,6 +239,14 @@ typedef struct PVS2D_BSPTreeNode {
 	 */
 	double tSplitStart, tSplitEnd;
 
+	/**
+	 * @brief Точные значения параметров концов разделительной прямой. 
+	 * 
+	 * Те же `tSplitStart` и `tSplitEnd` в виде дробей. 
+	 * 
+	 */
+	PVS2D_Param exactSplitStart, exactSplitEnd;
+
 	/**
 	 * @brief Стэк порталов, лежащих на разделительной прямой. 
 	 * 
@@ -328,6 +401,245 @@ typedef struct PVS2D_LeafGraphNodeStack {
 	 */
 	struct PVS2D_LeafGraphNodeStack* next;
 } PVS2D_LeafGraphNodeStack, PVS2D_LGNodeStack;
+
+/**
+ * @brief Граф листов в компактном виде (compressed sparse row). 
+ * 
+ * Ребра всех листов пронумерованы подряд: ребра листа `i` имеют номера 
+ * `adjStart[i]` ... `adjStart[i + 1] - 1`, в том же порядке, что и в `PVS2D_LeafGraphNode::adjs`. 
+ * Порталы ребер хранятся прямо в графе, отдельным массивом для каждого поля, 
+ * так что порталы одного листа лежат подряд, и обход графа не обращается ни к каким другим структурам. 
+ * Строится с помощью `PVS2D_BuildCSRLeafGraph`. 
+ * 
+ */
+typedef struct PVS2D_CSRLeafGraph {
+	/**
+	 * @brief Количество листов. 
+	 * 
+	 */
+	unsigned int leafC;
+
+	/**
+	 * @brief Начала ребер листов, `leafC + 1` элементов. 
+	 * 
+	 */
+	unsigned int* adjStart;
+
+	/**
+	 * @brief Индексы листов, в которые ведут ребра. 
+	 * 
+	 */
+	unsigned int* leaf;
+
+	/**
+	 * @brief Концы порталов ребер `(x1, y1)` - `(x2, y2)`, в точках `tStart` и `tEnd`. 
+	 * 
+	 */
+	double *x1, *y1, *x2, *y2;
+
+	/**
+	 * @brief Точка A прямой портала. 
+	 * 
+	 */
+	double *ox, *oy;
+
+	/**
+	 * @brief Направление прямой портала `B - A`. 
+	 * 
+	 */
+	double *dx, *dy;
+
+	/**
+	 * @brief Нормаль прямой портала `(-dy, dx)`, направленная влево. 
+	 * 
+	 */
+	double *nx, *ny;
+
+	/**
+	 * @brief Параметры концов портала на прямой, как в `PVS2D_Seg`. 
+	 * 
+	 */
+	double *tStart, *tEnd;
+
+	/**
+	 * @brief Номера дверей порталов ребер, или `PVS2D_NO_DOOR`. 
+	 * 
+	 */
+	unsigned int* door;
+
+	/**
+	 * @brief Флаги "вне играбельной зоны" листов. 
+	 * 
+	 */
+	unsigned char* oob;
+} PVS2D_CSRLeafGraph;
+ 
+/**
+ * @brief Вершина "запеченного" BSP-дерева. 
+ * 
+ * Компактное представление вершины BSP-дерева (24 байта), хранящееся в непрерывном массиве. 
+ * Вместо указателя на прямую содержит нормаль разделительной прямой `(nx, ny)` и точку на ней 
+ * `(ox, oy)`, так что точка `(x, y)` находится слева от прямой, если 
+ * `nx * (x - ox) + ny * (y - oy) > 0`. 
+ * 
+ */
+typedef struct PVS2D_BakedNode {
+	/**
+	 * @brief Нормаль разделительной прямой, направленная влево. 
+	 * 
+	 */
+	int nx, ny;
+
+	/**
+	 * @brief Точка A разделительной прямой. 
+	 * 
+	 */
+	int ox, oy;
+
+	/**
+	 * @brief Левый и правый потомки. 
+	 * 
+	 * Неотрицательное значение - индекс вершины в массиве. Отрицательное значение `c` 
+	 * означает лист с индексом `~c`. 
+	 * 
+	 */
+	int left, right;
+} PVS2D_BakedNode;
+
+/**
+ * @brief "Запеченное" BSP-дерево. 
+ * 
+ * Массив вершин в прямом порядке обхода, корень имеет индекс 0. 
+ * Строится с помощью `PVS2D_BakeBSPTree`. 
+ * 
+ */
+typedef struct PVS2D_BakedBSPTree {
+	/**
+	 * @brief Массив вершин. 
+	 * 
+	 */
+	PVS2D_BakedNode* nodes;
+
+	/**
+	 * @brief Количество вершин. 
+	 * 
+	 */
+	unsigned int nodesC;
+} PVS2D_BakedBSPTree;
+
+/**
+ * @brief Слово битсета. 
+ * 
+ * Битсет - массив 64-битных слов, i-тый бит равен 1, если i-тый элемент принадлежит множеству. 
+ * Бит `i` хранится в слове `i / 64` под номером `i % 64`. Битсет из `n` элементов 
+ * занимает `PVS2D_BITSET_WORDS(n)` слов. 
+ * 
+ */
+typedef unsigned long long PVS2D_BitsetWord;
+
+/**
+ * @brief Количество слов в битсете из `bitsC` элементов. 
+ * 
+ */
+#define PVS2D_BITSET_WORDS(bitsC) (((bitsC) + 63) / 64)
+
+/**
+ * @brief Контекст построения сцены. 
+ * 
+ * Непрозрачная структура, владеющая памятью всех структур сцены (вершин BSP-дерева, отрезков, 
+ * порталов, графа листов), построенных с ее помощью. Память выделяется из арены большими блоками, 
+ * и освобождается целиком вызовом `PVS2D_ResetContext` или `PVS2D_FreeContext`. 
+ * 
+ */
+typedef struct PVS2D_Context PVS2D_Context;
+
+/**
+ * @brief Политика выбора разделительной прямой. 
+ * 
+ * Определяет, какие отрезки рассматриваются как кандидаты в разделители при построении 
+ * каждой вершины BSP-дерева. 
+ * 
+ */
+typedef enum PVS2D_SplitPolicy {
+	/**
+	 * @brief Перебор всех отрезков подпространства. 
+	 * 
+	 * Дает лучшее дерево, но требует O(n^2) проверок на каждую вершину. 
+	 * 
+	 */
+	PVS2D_SPLIT_EXHAUSTIVE = 0,
+
+	/**
+	 * @brief Перебор `sampleC` случайных отрезков подпространства. 
+	 * 
+	 * Требует O(sampleC * n) проверок на каждую вершину. 
+	 * 
+	 */
+	PVS2D_SPLIT_SAMPLED = 1
+} PVS2D_SplitPolicy;
+
+/**
+ * @brief Параметры построения BSP-дерева. 
+ * 
+ * Позволяют выбрать компромисс между временем построения дерева и его качеством. 
+ * Для каждого кандидата вычисляется стоимость 
+ * `splitWeight * (число разрезанных отрезков) + balanceWeight * |слева - справа|`, 
+ * и выбирается кандидат с минимальной стоимостью (при равенстве - первый найденный). 
+ * Значения по умолчанию заполняются с помощью `PVS2D_DefaultBSPParams`. 
+ * 
+ */
+typedef struct PVS2D_BSPParams {
+	/**
+	 * @brief Политика выбора кандидатов. 
+	 * 
+	 * По умолчанию `PVS2D_SPLIT_EXHAUSTIVE`. 
+	 * 
+	 */
+	PVS2D_SplitPolicy policy;
+
+	/**
+	 * @brief Число кандидатов для `PVS2D_SPLIT_SAMPLED`. 
+	 * 
+	 * Если в подпространстве не больше отрезков, проверяются все. Должно быть больше 0. 
+	 * По умолчанию 16. 
+	 * 
+	 */
+	unsigned int sampleC;
+
+	/**
+	 * @brief Вес одного разрезанного отрезка. 
+	 * 
+	 * По умолчанию 1. 
+	 * 
+	 */
+	double splitWeight;
+
+	/**
+	 * @brief Вес разницы числа отрезков слева и справа от разделителя. 
+	 * 
+	 * По умолчанию 0, т.е. учитывается только число разрезов. 
+	 * 
+	 */
+	double balanceWeight;
+
+	/**
+	 * @brief Зерно генератора случайных чисел. 
+	 * 
+	 * При одинаковом зерне и входных данных построение детерминировано. По умолчанию 0. 
+	 * 
+	 */
+	unsigned int seed;
+
+	/**
+	 * @brief Количество потоков построения, 0 - по одному на каждый процессор. 
+	 * 
+	 * Верхние уровни дерева строятся вызывающим потоком, а поддеревья меньшего размера 
+	 * достраиваются потоками параллельно. Результат (включая нумерацию листьев) от числа 
+	 * потоков не зависит. По умолчанию 1. 
+	 * 
+	 */
+	unsigned int threadsC;
+} PVS2D_BSPParams;
  
 // --------------------------------------------------------
 //                  INTERFACE FUNCTIONS
@@ -340,8 +652,11 @@ typedef struct PVS2D_LeafGraphNodeStack {
  * должен иметь следующую структуру: `segsC` блоков по 5 целых чисел: `ax, ay, bx, by, opq`, 
  * `ax, ay` - координаты начала отрезка, 
  * `bx, by` - координаты конца отрезка, 
- * `opq` - флаг, указывающий, является ли отрезок прозрачным (0 если так) или нет (1 если так). 
- * Возвращает 0 если построение выполнено успешно, другое число если нет. 
+ * `opq` - флаг, указывающий, является ли отрезок прозрачным (0 если так) или нет (1 если так), 
+ * или `PVS2D_DOOR(id)`, если отрезок - дверь. 
+ * Координаты по модулю не должны превосходить `PVS2D_MAX_COORD`. 
+ * Возвращает 0 если построение выполнено успешно, другое число если нет, в том числе если 
+ * какой-то отрезок имеет нулевую длину или его координаты выходят за пределы. 
  * 
  * @param segs Массив отрезков. 
  * @param segsC Количество блоков. 
@@ -353,6 +668,65 @@ int PVS2D_BuildBSPTree(
 	PVS2D_BSPTreeNode* rootDest
 );
 
+/**
+ * @brief Создает контекст построения сцены. 
+ * 
+ * @return Указатель на новый контекст, или NULL если не удалось выделить память. 
+ */
+PVS2D_Context* PVS2D_CreateContext(void);
+
+/**
+ * @brief Освобождает все структуры, построенные с помощью контекста. 
+ * 
+ * Все указатели на структуры сцены становятся недействительными, однако блоки памяти 
+ * остаются в контексте и переиспользуются при построении следующей сцены. 
+ * 
+ * @param ctx Указатель на контекст. 
+ */
+void PVS2D_ResetContext(
+	PVS2D_Context* ctx
+);
+
+/**
+ * @brief Освобождает контекст и все структуры, построенные с его помощью. 
+ * 
+ * @param ctx Указатель на контекст. Может быть NULL. 
+ */
+void PVS2D_FreeContext(
+	PVS2D_Context* ctx
+);
+
+/**
+ * @brief Заполняет параметры построения BSP-дерева значениями по умолчанию. 
+ * 
+ * Значения по умолчанию соответствуют поведению `PVS2D_BuildBSPTree`. 
+ * 
+ * @param paramsDest Указатель на параметры, которые будут заполнены. 
+ */
+void PVS2D_DefaultBSPParams(
+	PVS2D_BSPParams* paramsDest
+);
+
+/**
+ * @brief Строит дерево Двоичного Разделения пространства с заданными параметрами. 
+ * 
+ * То же, что и `PVS2D_BuildBSPTree`, но позволяет выбрать политику выбора разделительных прямых 
+ * и контекст, из которого будет выделена память дерева. 
+ * 
+ * @param ctx Контекст сцены, или NULL, чтобы выделять память через `malloc`. 
+ * @param segs Массив отрезков. 
+ * @param segsC Количество блоков. 
+ * @param params Параметры построения, или NULL для параметров по умолчанию. 
+ * @param rootDest Указатель на вершину BSP-дерева, куда будет записан результат построения. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_BuildBSPTreeEx(
+	PVS2D_Context* ctx,
+	int* segs, unsigned int segsC,
+	const PVS2D_BSPParams* params,
+	PVS2D_BSPTreeNode* rootDest
+);
+
 /**
  * @brief Находит индекс листа, в котором находится данная точка. 
  * 
@@ -366,11 +740,65 @@ unsigned int PVS2D_FindLeafOfPoint(
 	double x, double y
 );
 
+/**
+ * @brief "Запекает" BSP-дерево в непрерывный массив вершин. 
+ * 
+ * Результат не зависит от исходного дерева, и может использоваться после его освобождения. 
+ * 
+ * @param ctx Контекст, из которого будет выделен массив вершин, или NULL - тогда 
+ * массив `dest->nodes` выделяется через `malloc` и должен быть освобожден с помощью `free`. 
+ * @param root Указатель на корень BSP-дерева. 
+ * @param dest Указатель, куда будет записано "запеченное" дерево. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_BakeBSPTree(
+	PVS2D_Context* ctx,
+	PVS2D_BSPTreeNode* root,
+	PVS2D_BakedBSPTree* dest
+);
+
+/**
+ * @brief Находит индекс листа, в котором находится данная точка, в "запеченном" дереве. 
+ * 
+ * Возвращает тот же результат, что и `PVS2D_FindLeafOfPoint` для исходного дерева. 
+ * 
+ * @param tree Указатель на "запеченное" дерево. 
+ * @param x X координата точки. 
+ * @param y Y координата точки. 
+ * @return Индекс листа, в котором находится данная точка. 
+ */
+unsigned int PVS2D_FindLeafOfPointBaked(
+	const PVS2D_BakedBSPTree* tree,
+	double x, double y
+);
+
+/**
+ * @brief Находит индексы листов для массива точек. 
+ * 
+ * Точки обходят "запеченное" дерево пакетами, проверка сторон выполняется с помощью 
+ * SSE2/AVX (если доступны при компиляции), пакет разделяется, когда точки расходятся 
+ * по разным поддеревьям. Результат для каждой точки совпадает с `PVS2D_FindLeafOfPointBaked`. 
+ * 
+ * @param tree Указатель на "запеченное" дерево. 
+ * @param xs Массив X координат точек. 
+ * @param ys Массив Y координат точек. 
+ * @param n Количество точек. 
+ * @param out Массив из `n` элементов, куда будут записаны индексы листов. 
+ */
+void PVS2D_FindLeavesOfPoints(
+	const PVS2D_BakedBSPTree* tree,
+	const double* xs, const double* ys, unsigned int n,
+	unsigned int* out
+);
+
 /**
  * @brief Указывает индексы листов, через которые проходит данный отрезок. 
  * 
  * Указывает индексы листов, через которые проходит данный отрезок. Результат записывается 
  * в "битсет" (массив char'ов, i-тый char является 1 если отрезок проходит через i-тый лист). 
+ * Отрезок обрезается каждой разделительной прямой, так что каждое поддерево получает только 
+ * ту часть отрезка, которая в нем лежит. Отрезок, лежащий на разделительной прямой, попадает 
+ * в листы с обеих ее сторон. 
  * 
  * @param root Указатель на корень BSP-дерева. 
  * @param ax X координата начала отрезка
@@ -387,35 +815,110 @@ void PVS2D_FindLeafsOfSegment(
 );
 
 /**
- * @brief Строит порталы в BSP-дереве. 
+ * @brief Указывает индексы листов, через которые проходит данный отрезок, в битсете. 
  * 
- * Строит порталы внутри BSP-дерева, по сути заполняя поле `portals` в вершинах. 
- * Возвращает 0 если построение успешно, другое число иначе. 
+ * То же, что и `PVS2D_FindLeafsOfSegment`, но результат записывается в битсет. 
  * 
- * @param root Указатель на корень дерева. 
- * @return 0 если успешно, другое число если нет. 
+ * @param root Указатель на корень BSP-дерева. 
+ * @param ax X координата начала отрезка
+ * @param ay Y координата начала отрезка
+ * @param bx X координата конца отрезка
+ * @param by Y координата конца отрезка
+ * @param leafbits Битсет, в который функция выведет результат. Должен содержать не меньше 
+ * `PVS2D_BITSET_WORDS(leafC)` слов. 
  */
-int PVS2D_BuildPortals(
-	PVS2D_BSPTreeNode* root
+void PVS2D_FindLeafsOfSegmentBits(
+	PVS2D_BSPTreeNode* root,
+	double ax, double ay, double bx, double by,
+	PVS2D_BitsetWord* leafbits
 );
 
 /**
- * @brief Строит граф смежности листов. 
+ * @brief Находит листы, через которые проходит данный отрезок, в порядке от его начала к концу. 
  * 
- * Строит граф смежности листов используя построенные в BSP-дереве порталы. 
- * Соответственно, дерево должно иметь порталы построенными с помощью `PVS2D_BuildPortals`.
- * Возвращает массив из вершин графа, размер массива равен числу листов в графе, также возвращает 
- * само число. 
+ * Находит те же листы, что и `PVS2D_FindLeafsOfSegment`, но обходит дерево без рекурсии 
+ * и выводит их списком. 
+ * Каждый лист записывается один раз. Если листов больше, чем `outCap`, записываются `outCap` ближайших 
+ * к началу отрезка, а возвращается их общее количество, так что результат больше `outCap` означает, 
+ * что список неполон. 
  * 
- * @param root Указатель на корень дерева. 
- * @param nodesCDest Указатель на `unsigned int`, куда будет записано число листов в дереве. 
- * @return Указатель на первый элемент массива вершин графа. 
- */
+ * @param root Указатель на корень BSP-дерева. 
+ * @param ax X координата начала отрезка
+ * @param ay Y координата начала отрезка
+ * @param bx X координата конца отрезка
+ * @param by Y координата конца отрезка
+ * @param out Массив, куда будут записаны индексы листов. 
+ * @param outCap Количество элементов `out`. Количества листов в дереве всегда достаточно. 
+ * @return Количество листов, через которые проходит отрезок, в том числе не поместившихся в `out`, 
+ * или `~0u`, если не удалось выделить память. 
+ */
+unsigned int PVS2D_FindLeafsOfSegmentList(
+	PVS2D_BSPTreeNode* root,
+	double ax, double ay, double bx, double by,
+	unsigned int* out, unsigned int outCap
+);
+
+/**
+ * @brief Строит порталы в BSP-дереве. 
+ * 
+ * Строит порталы внутри BSP-дерева, по сути заполняя поле `portals` в вершинах. 
+ * Возвращает 0 если построение успешно, другое число иначе. 
+ * 
+ * @param root Указатель на корень дерева. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_BuildPortals(
+	PVS2D_BSPTreeNode* root
+);
+
+/**
+ * @brief Строит порталы в BSP-дереве, используя контекст. 
+ * 
+ * То же, что и `PVS2D_BuildPortals`, но память порталов выделяется из контекста. 
+ * 
+ * @param ctx Контекст сцены, или NULL, чтобы выделять память через `malloc`. 
+ * @param root Указатель на корень дерева. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_BuildPortalsEx(
+	PVS2D_Context* ctx,
+	PVS2D_BSPTreeNode* root
+);
+
+/**
+ * @brief Строит граф смежности листов. 
+ * 
+ * Строит граф смежности листов используя построенные в BSP-дереве порталы. 
+ * Соответственно, дерево должно иметь порталы построенными с помощью `PVS2D_BuildPortals`.
+ * Возвращает массив из вершин графа, размер массива равен числу листов в графе, также возвращает 
+ * само число. 
+ * 
+ * @param root Указатель на корень дерева. 
+ * @param nodesCDest Указатель на `unsigned int`, куда будет записано число листов в дереве. 
+ * @return Указатель на первый элемент массива вершин графа. 
+ */
 PVS2D_LeafGraphNode* PVS2D_BuildLeafGraph(
 	PVS2D_BSPTreeNode* root,
 	unsigned int* nodesCDest
 );
 
+/**
+ * @brief Строит граф смежности листов, используя контекст. 
+ * 
+ * То же, что и `PVS2D_BuildLeafGraph`, но память графа (включая возвращаемый массив) 
+ * выделяется из контекста, и не должна освобождаться с помощью `free`. 
+ * 
+ * @param ctx Контекст сцены, или NULL, чтобы выделять память через `malloc`. 
+ * @param root Указатель на корень дерева. 
+ * @param nodesCDest Указатель на `unsigned int`, куда будет записано число листов в дереве. 
+ * @return Указатель на первый элемент массива вершин графа. 
+ */
+PVS2D_LeafGraphNode* PVS2D_BuildLeafGraphEx(
+	PVS2D_Context* ctx,
+	PVS2D_BSPTreeNode* root,
+	unsigned int* nodesCDest
+);
+
 /**
  * @brief Вычисляет Потенциально Видимое множество (PVS) листа. 
  * 
@@ -427,4 +930,802 @@ char* PVS2D_GetLeafPVS(
 	PVS2D_LeafGraphNode* node, unsigned int leafC
 );
 
+/**
+ * @brief Вычисляет Потенциально Видимое множество (PVS) листа в виде битсета. 
+ * 
+ * То же, что и `PVS2D_GetLeafPVS`, но результат занимает в 8 раз меньше памяти. 
+ * 
+ * @param node Вершина графа, содержащая лист, PVS которого надо вычислить. 
+ * @param leafC Количество листов в дереве. 
+ * @return Битсет из `PVS2D_BITSET_WORDS(leafC)` слов, i-тый бит равен 1, если i-тый лист видим из данного. 
+ * Должен быть освобожден с помощью `free`. 
+ */
+PVS2D_BitsetWord* PVS2D_GetLeafPVSBits(
+	PVS2D_LeafGraphNode* node, unsigned int leafC
+);
+
+/**
+ * @brief Способ вычисления PVS всех листов. 
+ * 
+ */
+typedef enum PVS2D_PVSMode {
+	/**
+	 * @brief Обход графа из каждого листа независимо от остальных. 
+	 * 
+	 */
+	PVS2D_PVS_BRUTE = 0,
+
+	/**
+	 * @brief Обход с использованием уже вычисленных PVS. 
+	 * 
+	 * Листы обрабатываются в порядке обхода графа в ширину, группами по 64. Видимость каждой 
+	 * пары определяется листом, обработанным первым, и отмечается в обеих строках, так что 
+	 * результат симметричен. Обход из листа не заходит в уже обработанные листы, которые его 
+	 * не видят, и, соответственно, в листы за ними. Требует дополнительной памяти под 
+	 * транспонированную матрицу. 
+	 * Результат не зависит от числа потоков, но может незначительно отличаться от `PVS2D_PVS_BRUTE`. 
+	 * 
+	 */
+	PVS2D_PVS_MEMO = 1,
+
+	/**
+	 * @brief То же, что и `PVS2D_PVS_MEMO`, но результат сравнивается с `PVS2D_PVS_BRUTE`. 
+	 * 
+	 * Каждая пара сравнивается со строкой полного перебора листа, обработанного первым. 
+	 * Требует дополнительной памяти под вторую матрицу и времени на полный перебор. 
+	 * 
+	 */
+	PVS2D_PVS_VERIFY = 2
+} PVS2D_PVSMode;
+
+/**
+ * @brief Вычисляет Потенциально Видимые множества всех листов. 
+ * 
+ * Заполняет матрицу PVS: строка `i` - битсет из `PVS2D_BITSET_WORDS(leafC)` слов, равный 
+ * PVS листа `i`. Строки листов "вне играбельной зоны" остаются пустыми. Листы распределяются 
+ * между потоками с перехватом работы (work stealing), каждый поток использует свои 
+ * вспомогательные массивы. Результат не зависит от числа потоков и совпадает с `PVS2D_GetLeafPVSBits`. 
+ * 
+ * @param graph Массив вершин графа листов. 
+ * @param leafC Количество листов в дереве. 
+ * @param threadsC Количество потоков, 0 - по одному на каждый процессор. 
+ * @param out Матрица из `leafC * PVS2D_BITSET_WORDS(leafC)` слов, куда будет записан результат. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_BuildAllPVS(
+	PVS2D_LeafGraphNode* graph, unsigned int leafC,
+	unsigned int threadsC,
+	PVS2D_BitsetWord* out
+);
+
+/**
+ * @brief Вычисляет Потенциально Видимые множества всех листов выбранным способом. 
+ * 
+ * То же, что и `PVS2D_BuildAllPVS`, для `PVS2D_PVS_BRUTE`. 
+ * 
+ * @param graph Массив вершин графа листов. 
+ * @param leafC Количество листов в дереве. 
+ * @param threadsC Количество потоков, 0 - по одному на каждый процессор. 
+ * @param mode Способ вычисления. 
+ * @param out Матрица из `leafC * PVS2D_BITSET_WORDS(leafC)` слов, куда будет записан результат. 
+ * @return 0 если успешно, отрицательное число если нет. Для `PVS2D_PVS_VERIFY` - 
+ * количество пар листов, в которых результат отличается от полного перебора. 
+ */
+int PVS2D_BuildAllPVSEx(
+	PVS2D_LeafGraphNode* graph, unsigned int leafC,
+	unsigned int threadsC,
+	PVS2D_PVSMode mode,
+	PVS2D_BitsetWord* out
+);
+
+/**
+ * @brief Останавливает потоки библиотеки. 
+ * 
+ * Функции, принимающие число потоков, выполняются на постоянных потоках, которые запускаются 
+ * при первом вызове и затем ждут следующих. Эта функция будит их, завершает и дожидается их 
+ * завершения, например перед выгрузкой библиотеки или выходом из программы. Следующий вызов, 
+ * использующий несколько потоков, запустит их заново. Нельзя вызывать, пока выполняется 
+ * какая-либо функция библиотеки, использующая потоки. 
+ * 
+ */
+void PVS2D_ShutdownThreads(void);
+
+/**
+ * @brief Строит компактное представление графа листов. 
+ * 
+ * Функции вычисления PVS обходят граф в этом представлении, а функции, принимающие 
+ * `PVS2D_LeafGraphNode`, строят его каждый раз заново. 
+ * 
+ * @param ctx Контекст, из которого будет выделена память, или NULL - тогда все массивы 
+ * выделяются одним блоком через `malloc`, начинающимся с `dest->x1`, который должен быть 
+ * освобожден с помощью `free`. 
+ * @param graph Массив вершин графа листов. 
+ * @param leafC Количество листов в дереве. 
+ * @param dest Указатель, куда будет записан граф. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_BuildCSRLeafGraph(
+	PVS2D_Context* ctx,
+	PVS2D_LeafGraphNode* graph, unsigned int leafC,
+	PVS2D_CSRLeafGraph* dest
+);
+
+/**
+ * @brief Вычисляет PVS листа в виде битсета по компактному графу листов. 
+ * 
+ * @param graph Граф листов. 
+ * @param leaf Индекс листа. 
+ * @return Битсет из `PVS2D_BITSET_WORDS(graph->leafC)` слов, должен быть освобожден с помощью `free`. 
+ */
+PVS2D_BitsetWord* PVS2D_GetLeafPVSBitsCSR(
+	const PVS2D_CSRLeafGraph* graph, unsigned int leaf
+);
+
+/**
+ * @brief Рабочая память для повторных вычислений PVS отдельных листов. 
+ * 
+ * Позволяет вычислять PVS листов с помощью `PVS2D_GetLeafPVSInto` и множества листов, видимых 
+ * из точки, с помощью `PVS2D_FloodFromPoint` без выделения памяти. 
+ * Вся внутренняя память очищается после каждого запроса только там, где она была изменена, 
+ * так что запрос занимает время, пропорциональное только числу посещенных листов. 
+ * Создается с помощью `PVS2D_InitPVSWorkspace`, освобождается с помощью `PVS2D_FreePVSWorkspace`. 
+ * Одну рабочую память нельзя использовать из нескольких потоков одновременно. 
+ * 
+ */
+typedef struct PVS2D_PVSWorkspace {
+	/**
+	 * @brief Наибольшее количество листов графа. 
+	 * 
+	 */
+	unsigned int leafC;
+
+	/**
+	 * @brief Листы, видимые в последнем запросе, `leavesC` элементов, в порядке обхода. 
+	 * 
+	 */
+	unsigned int* leaves;
+
+	/**
+	 * @brief Количество листов в `leaves`. 
+	 * 
+	 */
+	unsigned int leavesC;
+
+	/**
+	 * @brief Внутреннее состояние. 
+	 * 
+	 */
+	struct PVS2D_PVSWorkspaceState* state;
+} PVS2D_PVSWorkspace;
+
+/**
+ * @brief Создает рабочую память для вычисления PVS. 
+ * 
+ * @param leafC Наибольшее количество листов графов, для которых она будет использоваться. 
+ * @param dest Указатель, куда будет записана рабочая память. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_InitPVSWorkspace(unsigned int leafC, PVS2D_PVSWorkspace* dest);
+
+/**
+ * @brief Освобождает рабочую память, созданную `PVS2D_InitPVSWorkspace`. 
+ * 
+ * @param ws Рабочая память. 
+ */
+void PVS2D_FreePVSWorkspace(PVS2D_PVSWorkspace* ws);
+
+/**
+ * @brief Вычисляет PVS листа по компактному графу листов без выделения памяти. 
+ * 
+ * То же, что и `PVS2D_GetLeafPVS`, но результат записывается в `ws->leaves` и, если указан, 
+ * в массив `out`. В `out` записываются только листы этого запроса, и перед этим очищаются 
+ * только листы предыдущего, поэтому перед первым запросом `out` должен быть заполнен нулями, 
+ * и со всеми запросами к одной рабочей памяти должен использоваться один и тот же `out`. 
+ * 
+ * @param graph Граф листов. 
+ * @param leaf Индекс листа. 
+ * @param ws Рабочая память. 
+ * @param out Массив из `graph->leafC` элементов, i-тый элемент равен 1, если i-тый лист видим 
+ * из данного, и 0 если нет, или NULL. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_GetLeafPVSInto(
+	const PVS2D_CSRLeafGraph* graph, unsigned int leaf,
+	PVS2D_PVSWorkspace* ws, char* out
+);
+
+/**
+ * @brief Вычисляет PVS всех листов по компактному графу листов. 
+ * 
+ * То же, что и `PVS2D_BuildAllPVSEx`. 
+ * 
+ * @param graph Граф листов. 
+ * @param threadsC Количество потоков, 0 - по одному на каждый процессор. 
+ * @param mode Способ вычисления. 
+ * @param out Матрица из `leafC * PVS2D_BITSET_WORDS(leafC)` слов, куда будет записан результат. 
+ * @return То же, что и `PVS2D_BuildAllPVSEx`. 
+ */
+int PVS2D_BuildAllPVSCSR(
+	const PVS2D_CSRLeafGraph* graph,
+	unsigned int threadsC,
+	PVS2D_PVSMode mode,
+	PVS2D_BitsetWord* out
+);
+
+/**
+ * @brief Оставляет в PVS листа только листы, достижимые через открытые двери. 
+ * 
+ * Обходит граф листов из данного листа по прозрачным порталам, не являющимся закрытыми дверями, 
+ * заходя только в листы из `pvs`. Результат - подмножество `pvs`, содержащее все листы, видимые 
+ * при данном состоянии дверей, так что переключение дверей не требует пересчета PVS. 
+ * 
+ * @param graph Граф листов. 
+ * @param pvs PVS листа, построенная при всех открытых дверях. 
+ * @param leaf Индекс листа. 
+ * @param openDoors Битсет открытых дверей, индексированный номерами дверей. 
+ * @param out Битсет из `PVS2D_BITSET_WORDS(graph->leafC)` слов, куда будет записан результат. 
+ * @return 0 если успешно, другое число если нет. 
+ * @see PVS2D_FilterSceneByDoors для загруженных сцен. 
+ */
+int PVS2D_FilterPVSByDoors(
+	const PVS2D_CSRLeafGraph* graph,
+	const PVS2D_BitsetWord* pvs, unsigned int leaf,
+	const PVS2D_BitsetWord* openDoors,
+	PVS2D_BitsetWord* out
+);
+
+/**
+ * @brief Вычисляет множество листов, видимых из данной точки. 
+ * 
+ * Находит лист точки с помощью `PVS2D_FindLeafOfPoint` и обходит граф листов через прозрачные 
+ * порталы, сужая конус лучей из точки на каждом портале. Результат обычно заметно меньше 
+ * PVS листа, и вычисляется достаточно быстро, чтобы делать это каждый кадр. 
+ * Конус обзора задается направлением и углом раствора. Угол от `pi` и больше обзор не ограничивает. 
+ * Как и `PVS2D_GetLeafPVSInto`, не выделяет память: результат записывается в `ws->leaves` и, 
+ * если указан, в массив `out`, для которого действуют те же правила. 
+ * 
+ * @param graph Граф листов. 
+ * @param tree Указатель на корень BSP-дерева, по которому построен граф. 
+ * @param x X координата точки. 
+ * @param y Y координата точки. 
+ * @param fovDir Направление обзора, угол в радианах. 
+ * @param fovAngle Угол раствора конуса обзора в радианах. 
+ * @param ws Рабочая память. 
+ * @param out Массив из `graph->leafC` элементов, i-тый элемент равен 1, если i-тый лист виден 
+ * из точки, и 0 если нет, или NULL. 
+ * @return 0 если успешно, другое число если нет, в том числе если точка вне играбельной зоны. 
+ */
+int PVS2D_FloodFromPoint(
+	const PVS2D_CSRLeafGraph* graph, PVS2D_BSPTreeNode* tree,
+	double x, double y, double fovDir, double fovAngle,
+	PVS2D_PVSWorkspace* ws, char* out
+);
+
+// --------------------------------------------------------
+//                        BITSETS
+// --------------------------------------------------------
+
+/**
+ * @brief Проверяет, принадлежит ли элемент битсету. 
+ * 
+ * @param set Битсет. 
+ * @param i Индекс элемента. 
+ * @return 1 если принадлежит, 0 если нет. 
+ */
+static inline int PVS2D_BitsetTest(const PVS2D_BitsetWord* set, unsigned int i) {
+	return (int)((set[i >> 6] >> (i & 63)) & 1);
+}
+
+/**
+ * @brief Добавляет элемент в битсет. 
+ * 
+ * @param set Битсет. 
+ * @param i Индекс элемента. 
+ */
+static inline void PVS2D_BitsetSet(PVS2D_BitsetWord* set, unsigned int i) {
+	set[i >> 6] |= 1ULL << (i & 63);
+}
+
+/**
+ * @brief Удаляет элемент из битсета. 
+ * 
+ * @param set Битсет. 
+ * @param i Индекс элемента. 
+ */
+static inline void PVS2D_BitsetClear(PVS2D_BitsetWord* set, unsigned int i) {
+	set[i >> 6] &= ~(1ULL << (i & 63));
+}
+
+/**
+ * @brief Объединяет два битсета. 
+ * 
+ * @param dest Битсет, в который будет записано объединение. 
+ * @param src Второй битсет. 
+ * @param wordsC Количество слов в битсетах. 
+ */
+void PVS2D_BitsetUnion(
+	PVS2D_BitsetWord* dest, const PVS2D_BitsetWord* src, unsigned int wordsC
+);
+
+/**
+ * @brief Пересекает два битсета. 
+ * 
+ * @param dest Битсет, в который будет записано пересечение. 
+ * @param src Второй битсет. 
+ * @param wordsC Количество слов в битсетах. 
+ */
+void PVS2D_BitsetIntersect(
+	PVS2D_BitsetWord* dest, const PVS2D_BitsetWord* src, unsigned int wordsC
+);
+
+/**
+ * @brief Считает количество элементов в битсете. 
+ * 
+ * @param set Битсет. 
+ * @param wordsC Количество слов в битсете. 
+ * @return Количество единичных битов. 
+ */
+unsigned int PVS2D_BitsetCount(
+	const PVS2D_BitsetWord* set, unsigned int wordsC
+);
+
+// --------------------------------------------------------
+//                     COMPRESSED PVS
+// --------------------------------------------------------
+
+/**
+ * @brief Сжатая матрица Потенциально Видимых множеств. 
+ * 
+ * Каждая строка - байты битсета листа, в которых каждая серия нулевых байтов заменена на нулевой 
+ * байт и длину серии (до 255). Для каждых 16 байт сжатых строк хранится контрольная точка - 
+ * номер байта строки, который там начинается, поэтому проверка видимости требует бинарного 
+ * поиска и распаковки не более 16 байт. Поддерживается не более 262136 листов. 
+ * 
+ */
+typedef struct PVS2D_CompressedPVS {
+	/**
+	 * @brief Количество листов. 
+	 * 
+	 */
+	unsigned int leafC;
+
+	/**
+	 * @brief Начала строк в `rows`, `leafC + 1` элементов. 
+	 * 
+	 */
+	unsigned int* rowStart;
+
+	/**
+	 * @brief Контрольные точки, по одной на каждые 16 байт `rows`. 
+	 * 
+	 * Номер байта строки, сдвинутый на 1 бит влево, младший бит которого равен 1, если 
+	 * по этому адресу лежит длина серии нулей, и распаковку нужно начинать со следующего байта. 
+	 * 
+	 */
+	unsigned short* index;
+
+	/**
+	 * @brief Сжатые строки. 
+	 * 
+	 */
+	unsigned char* rows;
+} PVS2D_CompressedPVS;
+
+/**
+ * @brief Сжимает матрицу Потенциально Видимых множеств. 
+ * 
+ * @param ctx Контекст, из которого будет выделена память, или NULL - тогда все массивы 
+ * выделяются одним блоком через `malloc`, начинающимся с `dest->rowStart`, который должен быть 
+ * освобожден с помощью `free`. 
+ * @param matrix Матрица из `PVS2D_BuildAllPVS`. 
+ * @param leafC Количество листов. 
+ * @param dest Указатель, куда будет записана сжатая матрица. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_CompressPVS(
+	PVS2D_Context* ctx, const PVS2D_BitsetWord* matrix, unsigned int leafC,
+	PVS2D_CompressedPVS* dest
+);
+
+/**
+ * @brief Проверяет, виден ли лист `to` из листа `from`, не распаковывая строку. 
+ * 
+ * @param cpvs Сжатая матрица. 
+ * @param from Индекс листа, из которого смотрят. 
+ * @param to Индекс проверяемого листа. 
+ * @return 1 если виден, 0 если нет. 
+ */
+int PVS2D_CompressedPVSTest(const PVS2D_CompressedPVS* cpvs, unsigned int from, unsigned int to);
+
+/**
+ * @brief Распаковывает строку сжатой матрицы сразу в список видимых листов. 
+ * 
+ * @param cpvs Сжатая матрица. 
+ * @param leaf Индекс листа. 
+ * @param out Массив, куда будут записаны индексы видимых листов по возрастанию, 
+ * не меньше чем `cpvs->leafC` элементов. 
+ * @return Количество видимых листов. 
+ */
+unsigned int PVS2D_CompressedPVSList(const PVS2D_CompressedPVS* cpvs, unsigned int leaf, unsigned int* out);
+
+/**
+ * @brief Распаковывает строку сжатой матрицы в битсет. 
+ * 
+ * @param cpvs Сжатая матрица. 
+ * @param leaf Индекс листа. 
+ * @param out Битсет из `PVS2D_BITSET_WORDS(cpvs->leafC)` слов, куда будет записан результат. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_CompressedPVSRow(const PVS2D_CompressedPVS* cpvs, unsigned int leaf, PVS2D_BitsetWord* out);
+
+// --------------------------------------------------------
+//                      SCENE FILES
+// --------------------------------------------------------
+
+/**
+ * @brief Прямая сцены. 
+ * 
+ * Координаты двух точек, на которых лежит прямая, как в `PVS2D_Line`. 
+ * 
+ */
+typedef struct PVS2D_SceneLine {
+	int ax, ay, bx, by;
+} PVS2D_SceneLine;
+
+/**
+ * @brief Портал сцены. 
+ * 
+ * То же, что и `PVS2D_Portal`, но прямая задана индексом в массиве прямых сцены. 
+ * 
+ */
+typedef struct PVS2D_ScenePortal {
+	/**
+	 * @brief Параметры точек концов портала на прямой. 
+	 * 
+	 */
+	double tStart, tEnd;
+
+	/**
+	 * @brief Индекс прямой, на которой лежит портал. 
+	 * 
+	 */
+	unsigned int line;
+
+	/**
+	 * @brief Индексы левого и правого листов портала. 
+	 * 
+	 */
+	unsigned int leftLeaf, rightLeaf;
+
+	/**
+	 * @brief Флаг непрозрачности, как в `PVS2D_Seg`. 
+	 * 
+	 */
+	unsigned int opq;
+
+	/**
+	 * @brief Номер двери, на которой лежит портал, как в `PVS2D_Seg`, или `PVS2D_NO_DOOR`. 
+	 * 
+	 */
+	unsigned int door;
+
+	/**
+	 * @brief Выравнивание, всегда 0. 
+	 * 
+	 */
+	unsigned int reserved;
+} PVS2D_ScenePortal;
+
+/**
+ * @brief Ребро графа листов сцены. 
+ * 
+ */
+typedef struct PVS2D_SceneEdge {
+	/**
+	 * @brief Индекс листа, в который ведет ребро. 
+	 * 
+	 */
+	unsigned int leaf;
+
+	/**
+	 * @brief Индекс портала, которым представлено ребро. 
+	 * 
+	 */
+	unsigned int portal;
+} PVS2D_SceneEdge;
+
+/**
+ * @brief Сцена, загруженная из бинарного файла. 
+ * 
+ * Все массивы лежат в одном блоке памяти `data`, и освобождаются вместе с помощью 
+ * `PVS2D_FreeScene`. Ребра листа `i` - это `adjs[adjStart[i]]` ... `adjs[adjStart[i + 1] - 1]`. 
+ * 
+ * Формат файла: заголовок (магическое число, версия, количества элементов и контрольные суммы 
+ * CRC32 каждой секции и самого заголовка), за которым идут секции в порядке полей этой структуры, 
+ * каждая выровнена на 8 байт. Все числа записаны в порядке little endian, числа с плавающей 
+ * точкой - в формате IEEE 754, поэтому на little endian машинах загрузка сводится к копированию. 
+ * 
+ */
+typedef struct PVS2D_Scene {
+	/**
+	 * @brief Количества прямых, порталов, листов и ребер графа листов. 
+	 * 
+	 */
+	unsigned int linesC, portalsC, leafC, edgesC;
+
+	/**
+	 * @brief Массив прямых. 
+	 * 
+	 */
+	PVS2D_SceneLine* lines;
+
+	/**
+	 * @brief "Запеченное" BSP-дерево, может использоваться с `PVS2D_FindLeafOfPointBaked`. 
+	 * 
+	 */
+	PVS2D_BakedBSPTree tree;
+
+	/**
+	 * @brief Индексы разделительных прямых вершин дерева. 
+	 * 
+	 */
+	unsigned int* nodeLines;
+
+	/**
+	 * @brief Массив порталов. 
+	 * 
+	 */
+	PVS2D_ScenePortal* portals;
+
+	/**
+	 * @brief Начала ребер листов в `adjs`, `leafC + 1` элементов. 
+	 * 
+	 */
+	unsigned int* adjStart;
+
+	/**
+	 * @brief Ребра графа листов. 
+	 * 
+	 */
+	PVS2D_SceneEdge* adjs;
+
+	/**
+	 * @brief Флаги "вне играбельной зоны" листов. 
+	 * 
+	 */
+	unsigned char* oob;
+
+	/**
+	 * @brief Сжатая матрица PVS. Если PVS не сохранен, `pvs.rowStart` равен NULL. 
+	 * 
+	 */
+	PVS2D_CompressedPVS pvs;
+
+	/**
+	 * @brief Блок памяти, в котором лежат все массивы. 
+	 * 
+	 */
+	void* data;
+
+	/**
+	 * @brief Размер отображенного файла, если сцена загружена `PVS2D_MapSceneFile`, иначе 0. 
+	 * 
+	 */
+	size_t mapSize;
+} PVS2D_Scene;
+
+/**
+ * @brief Записывает сцену в бинарный формат. 
+ * 
+ * @param root Указатель на корень BSP-дерева. 
+ * @param graph Массив вершин графа листов. 
+ * @param leafC Количество листов в дереве. 
+ * @param pvs Матрица PVS из `PVS2D_BuildAllPVS`, или NULL, если PVS не нужно сохранять. 
+ * @param dataDest Указатель, куда будет записан указатель на данные, которые должны быть 
+ * освобождены с помощью `free`. 
+ * @param sizeDest Указатель, куда будет записан размер данных в байтах. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_SaveScene(
+	PVS2D_BSPTreeNode* root, PVS2D_LeafGraphNode* graph, unsigned int leafC,
+	const PVS2D_BitsetWord* pvs, void** dataDest, size_t* sizeDest
+);
+
+/**
+ * @brief Записывает сцену в файл. 
+ * 
+ * То же, что и `PVS2D_SaveScene`, но результат записывается в файл `path`. 
+ * 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_SaveSceneFile(
+	const char* path, PVS2D_BSPTreeNode* root, PVS2D_LeafGraphNode* graph, unsigned int leafC,
+	const PVS2D_BitsetWord* pvs
+);
+
+/**
+ * @brief Загружает сцену из бинарного формата. 
+ * 
+ * Проверяет магическое число, версию, контрольные суммы и структуру сцены, как `PVS2D_MapSceneFile`. 
+ * Данные копируются, и могут быть освобождены после загрузки. 
+ * 
+ * @param data Данные, записанные `PVS2D_SaveScene`. 
+ * @param size Размер данных в байтах. 
+ * @param dest Указатель, куда будет записана сцена. 
+ * @return 0 если успешно, другое число если нет (в т.ч. если данные повреждены). 
+ */
+int PVS2D_LoadScene(const void* data, size_t size, PVS2D_Scene* dest);
+
+/**
+ * @brief Загружает сцену из файла. 
+ * 
+ * @param path Путь к файлу, записанному `PVS2D_SaveSceneFile`. 
+ * @param dest Указатель, куда будет записана сцена. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_LoadSceneFile(const char* path, PVS2D_Scene* dest);
+
+/**
+ * @brief Отображает файл сцены в память без копирования. 
+ * 
+ * Массивы сцены указывают прямо в отображенный только для чтения файл, поэтому файл не копируется, 
+ * а несколько процессов, открывших один файл, разделяют одну копию в физической памяти. Изменять 
+ * массивы такой сцены нельзя. Работает только на little endian машинах. 
+ * 
+ * Структура сцены проверяется всегда: все индексы в массивах (дети вершин, прямые, листы и порталы 
+ * ребер, начала строк и индекс сжатого PVS) должны быть в пределах, поэтому даже поврежденный или 
+ * подделанный файл не может привести к выходу за массивы. 
+ * 
+ * @param path Путь к файлу, записанному `PVS2D_SaveSceneFile`. 
+ * @param verify 1 - еще и проверить контрольные суммы всех секций, 
+ * 0 - проверить только заголовок и структуру. 
+ * @param dest Указатель, куда будет записана сцена. Освобождается с помощью `PVS2D_FreeScene`. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_MapSceneFile(const char* path, char verify, PVS2D_Scene* dest);
+
+/**
+ * @brief Освобождает сцену. 
+ * 
+ * @param scene Указатель на сцену. 
+ */
+void PVS2D_FreeScene(PVS2D_Scene* scene);
+
+/**
+ * @brief То же, что и `PVS2D_FilterPVSByDoors`, но для графа листов сцены. 
+ * 
+ * Номера дверей берутся из порталов сцены, поэтому работает и со сценами, загруженными из файла 
+ * или отображенными в память. 
+ * 
+ * @param scene Сцена. 
+ * @param pvs PVS листа, построенная при всех открытых дверях, например из `PVS2D_CompressedPVSRow`. 
+ * @param leaf Индекс листа. 
+ * @param openDoors Битсет открытых дверей, индексированный номерами дверей. 
+ * @param out Битсет из `PVS2D_BITSET_WORDS(scene->leafC)` слов, куда будет записан результат. 
+ * @return 0 если успешно, другое число если нет. 
+ */
+int PVS2D_FilterSceneByDoors(
+	const PVS2D_Scene* scene,
+	const PVS2D_BitsetWord* pvs, unsigned int leaf,
+	const PVS2D_BitsetWord* openDoors,
+	PVS2D_BitsetWord* out
+);
+
+// --------------------------------------------------------
+//                    EDITABLE SCENES
+// --------------------------------------------------------
+
+/**
+ * @brief Сцена, которую можно изменять, добавляя и удаляя отрезки. 
+ * 
+ * Содержит BSP-дерево с порталами, граф листов и матрицу PVS, и обновляет их после изменений 
+ * только там, где это необходимо: заново строятся только поддеревья, в которых изменились 
+ * отрезки, порталы вычисляются только для вершин этих поддеревьев, их предков и вершин, на прямых 
+ * которых добавлены или удалены отрезки, а PVS - только для листов, которые видят листы, 
+ * соседние с измененными порталами. Граф листов строится заново целиком, так как это занимает 
+ * линейное время. Листы после обновления нумеруются заново, в том же порядке, что и в `PVS2D_BuildBSPTreeEx`. 
+ * 
+ * Каждый отрезок имеет номер (`PVS2D_Seg::id`), по которому его можно удалить: номера отрезков, 
+ * переданных в `PVS2D_BuildEditScene`, равны их индексам, номера добавленных отрезков 
+ * продолжают их по порядку и не используются повторно. 
+ * Поля сцены можно только читать. 
+ * 
+ */
+typedef struct PVS2D_EditScene {
+	/**
+	 * @brief Корень BSP-дерева, с порталами. 
+	 * 
+	 */
+	PVS2D_BSPTreeNode root;
+
+	/**
+	 * @brief Количество листов. 
+	 * 
+	 */
+	unsigned int leafC;
+
+	/**
+	 * @brief Массив вершин графа листов. 
+	 * 
+	 */
+	PVS2D_LeafGraphNode* graph;
+
+	/**
+	 * @brief Граф листов в компактном виде. 
+	 * 
+	 */
+	PVS2D_CSRLeafGraph csr;
+
+	/**
+	 * @brief Матрица PVS из `leafC * PVS2D_BITSET_WORDS(leafC)` слов, как в `PVS2D_BuildAllPVS`. 
+	 * 
+	 */
+	PVS2D_BitsetWord* pvs;
+
+	/**
+	 * @brief Количество листов, PVS которых было вычислено при последнем построении или обновлении. 
+	 * 
+	 */
+	unsigned int dirtyC;
+
+	/**
+	 * @brief Внутреннее состояние сцены. 
+	 * 
+	 */
+	struct PVS2D_EditSceneState* state;
+} PVS2D_EditScene;
+
+/**
+ * @brief Строит изменяемую сцену. 
+ * 
+ * Дерево получается тем же, что и у `PVS2D_BuildBSPTreeEx`, а PVS вычисляется как `PVS2D_PVS_BRUTE`. 
+ * 
+ * @param segs Массив отрезков, как в `PVS2D_BuildBSPTree`. 
+ * @param segsC Количество отрезков, не меньше 1. 
+ * @param params Параметры построения дерева, или NULL - тогда используются параметры по умолчанию. 
+ * Количество потоков используется также при вычислении PVS. 
+ * @param dest Указатель, куда будет записана сцена. Освобождается с помощью `PVS2D_FreeEditScene`. 
+ * @return 0 если успешно, другое число если нет (в т.ч. если какой-то из отрезков вырожден или 
+ * выходит за `PVS2D_MAX_COORD`). 
+ */
+int PVS2D_BuildEditScene(
+	int* segs, unsigned int segsC,
+	const PVS2D_BSPParams* params,
+	PVS2D_EditScene* dest
+);
+
+/**
+ * @brief Добавляет и удаляет отрезки сцены. 
+ * 
+ * Сначала удаляются отрезки `removeIds`, затем добавляются `addSegs`. Отрезок, который лежит на 
+ * прямой уже существующей вершины, просто добавляется к ней, а остальные части новых отрезков, 
+ * попавшие в один лист, образуют в нем новое поддерево. Если у вершины не остается отрезков, 
+ * ее поддерево строится заново из оставшихся в нем. Перестроения всего дерева (и его балансировки) не происходит. 
+ * 
+ * @param scene Сцена. 
+ * @param addSegs Массив добавляемых отрезков, как в `PVS2D_BuildBSPTree`. 
+ * @param addC Количество добавляемых отрезков. 
+ * @param removeIds Номера удаляемых отрезков. 
+ * @param removeC Количество удаляемых отрезков. 
+ * @param addIdsDest Массив из `addC` элементов, куда будут записаны номера добавленных отрезков, или NULL. 
+ * @return 0 если успешно, другое число если нет. Если какой-то из `addSegs` вырожден или выходит 
+ * за `PVS2D_MAX_COORD`, какого-то из `removeIds` нет в сцене, в сцене не осталось бы отрезков 
+ * или не хватило памяти на подготовку, сцена остается прежней. Если же памяти не хватило уже во время 
+ * перестроения, сцена остается частично измененной: ее можно только освободить с помощью 
+ * `PVS2D_FreeEditScene`, и все последующие вызовы `PVS2D_UpdateEditScene` тоже возвращают ошибку. 
+ */
+int PVS2D_UpdateEditScene(
+	PVS2D_EditScene* scene,
+	int* addSegs, unsigned int addC,
+	const unsigned int* removeIds, unsigned int removeC,
+	unsigned int* addIdsDest
+);
+
+/**
+ * @brief Освобождает изменяемую сцену. 
+ * 
+ * @param scene Указатель на сцену. 
+ */
+void PVS2D_FreeEditScene(PVS2D_EditScene* scene);
+
 #endif
\ No newline at end of file
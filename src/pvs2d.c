@@ -2,6 +2,38 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// the same as the ones of windows.h, so they evaluate the arguments twice
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+// PVS2D_NO_SIMD leaves only the scalar code, e.g. to test it on machines that have SSE2 anyway
+#if defined(PVS2D_NO_SIMD)
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define PVS2D_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PVS2D_SSE2
+#endif
 
 /*
 segments have pointer to line they are based on
@@ -11,11 +43,11 @@ portals are segs and have index of leaves to the left and right
 building BSP:
 	firstly group all given segments onto lines:
 		have a stack of lines
-		for each new seg iter through all lines and if match then assign this seg to its line and viseversa
-		if not then just add new line
+		for each new seg look up its line by canonical form (reduced direction + offset) in a hash table
+		if match then assign this seg to its line and viseversa, if not then just add new line
 	have a list of all segments in the area
-	choose any line it has, see the amount of segments it cuts
-	choose the line that has minimum cuts
+	choose any line it has (or some random ones), see the amount of segments it cuts and how balanced it is
+	choose the line that has minimum cost
 	separate all segment to three lists: to the left of the line, to the right and adjacent
 	put all adjacent into the current node
 	create nodes for left and right if needed and recursively repeat the process
@@ -60,23 +92,549 @@ building PVS:
 #endif
 #endif
 
-const double MATCH_TOLERANCE = 0.0625f;
-// the so called EPS. used to fix some errors that inevitably happen with float arithmetics
+// every structure of a scene built with a context is allocated from its arena:
+// a linked list of big blocks, each filled from the start to the end.
+// nothing is ever freed separately, the whole scene is released at once
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
 
-static inline char _collinear(int ax, int ay, int bx, int by, int cx, int cy) {
-	return (ax * (by - cy) + bx * (cy - ay) + cx * (ay - by) == 0);
-};
+typedef struct _arenaBlock {
+	struct _arenaBlock* next;
+	size_t size, used;
+} _arenaBlock;
 
-static inline void _intersect(int ax, int ay, int bx, int by, int cx, int cy, int dx, int dy, int* numerDest, int* denomDest) {
-	int nx = bx - ax, ny = by - ay;
-	*numerDest = nx * (cy - ay) - ny * (cx - ax);
-	*denomDest = nx * (cy - dy) - ny * (cx - dx);
+struct PVS2D_Context {
+	_arenaBlock* first;
+	_arenaBlock* cur;
 };
 
-static inline void _intersectF(double ax, double ay, double bx, double by, double cx, double cy, double dx, double dy, double* numerDest, double* denomDest) {
-	double nx = bx - ax, ny = by - ay;
-	*numerDest = nx * (cy - ay) - ny * (cx - ax);
-	*denomDest = nx * (cy - dy) - ny * (cx - dx);
+// block header is padded so the data after it stays aligned
+#define ARENA_HEADER ((sizeof(_arenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+// allocates memory for a scene structure. without a context it falls back to malloc
+static void* _alloc(PVS2D_Context* ctx, size_t size) {
+	if (!ctx) return malloc(size);
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	_arenaBlock* block = ctx->cur;
+	while (block && block->used + size > block->size) {
+		// the following blocks are empty after reset, and can be reused
+		block = block->next;
+	}
+	if (!block) {
+		size_t blockSize = max(size, (size_t)ARENA_BLOCK_SIZE);
+		block = (_arenaBlock*)malloc(ARENA_HEADER + blockSize);
+		DBG_ASSERT(block, 0, "Failed to allocate new arena block");
+		if (!block) return 0;
+		block->size = blockSize;
+		block->used = 0;
+		// put it right after the current one, so blocks left from previous scenes stay reachable
+		if (ctx->cur) {
+			block->next = ctx->cur->next;
+			ctx->cur->next = block;
+		}
+		else {
+			block->next = 0;
+			ctx->first = block;
+		}
+	}
+	ctx->cur = block;
+	void* ptr = (char*)block + ARENA_HEADER + block->used;
+	block->used += size;
+	return ptr;
+}
+
+PVS2D_Context* PVS2D_CreateContext(void) {
+	PVS2D_Context* ctx = (PVS2D_Context*)malloc(sizeof(PVS2D_Context));
+	DBG_ASSERT(ctx, 0, "Failed to allocate context");
+	if (!ctx) return 0;
+	ctx->first = 0;
+	ctx->cur = 0;
+	return ctx;
+}
+
+void PVS2D_ResetContext(PVS2D_Context* ctx) {
+	for (_arenaBlock* block = ctx->first; block; block = block->next) {
+		block->used = 0;
+	}
+	ctx->cur = ctx->first;
+}
+
+void PVS2D_FreeContext(PVS2D_Context* ctx) {
+	if (!ctx) return;
+	for (_arenaBlock* block = ctx->first; block;) {
+		_arenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	free(ctx);
+}
+
+// moves all blocks of another context into this one and frees the other context.
+// used to collect the per-thread arenas of a parallel build
+static void _adoptContext(PVS2D_Context* ctx, PVS2D_Context* other) {
+	_arenaBlock* last = other->first;
+	if (last) {
+		while (last->next) last = last->next;
+		// they go right after the current block, the same as new blocks do
+		if (ctx->cur) {
+			last->next = ctx->cur->next;
+			ctx->cur->next = other->first;
+		}
+		else {
+			last->next = 0;
+			ctx->first = other->first;
+			ctx->cur = other->first;
+		}
+	}
+	free(other);
+}
+
+// minimal threads layer, so the library stays plain C on every platform
+#ifdef _WIN32
+typedef HANDLE _thread;
+#define THREAD_FUNC(name, arg) DWORD WINAPI name(LPVOID arg)
+#define THREAD_RETURN return 0
+
+static int _threadStart(_thread* thread, LPTHREAD_START_ROUTINE fn, void* arg) {
+	*thread = CreateThread(0, 0, fn, arg, 0, 0);
+	return *thread == 0;
+}
+
+static void _threadJoin(_thread thread) {
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+typedef SRWLOCK _mutex;
+typedef CONDITION_VARIABLE _cond;
+#define MUTEX_INIT SRWLOCK_INIT
+#define COND_INIT CONDITION_VARIABLE_INIT
+
+static void _mutexLock(_mutex* mutex) {
+	AcquireSRWLockExclusive(mutex);
+}
+
+static void _mutexUnlock(_mutex* mutex) {
+	ReleaseSRWLockExclusive(mutex);
+}
+
+static void _condWait(_cond* cond, _mutex* mutex) {
+	SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+
+static void _condBroadcast(_cond* cond) {
+	WakeAllConditionVariable(cond);
+}
+
+static unsigned int _cpuCount(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+}
+
+static inline int _cas64(volatile unsigned long long* ptr, unsigned long long expected, unsigned long long desired) {
+	return (unsigned long long)InterlockedCompareExchange64((volatile LONG64*)ptr, desired, expected) == expected;
+}
+
+static inline unsigned long long _load64(volatile unsigned long long* ptr) {
+	// aligned volatile reads are atomic and have acquire semantics with msvc
+	return *ptr;
+}
+#else
+typedef pthread_t _thread;
+#define THREAD_FUNC(name, arg) void* name(void* arg)
+#define THREAD_RETURN return 0
+
+static int _threadStart(_thread* thread, void* (*fn)(void*), void* arg) {
+	return pthread_create(thread, 0, fn, arg);
+}
+
+static void _threadJoin(_thread thread) {
+	pthread_join(thread, 0);
+}
+
+typedef pthread_mutex_t _mutex;
+typedef pthread_cond_t _cond;
+#define MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define COND_INIT PTHREAD_COND_INITIALIZER
+
+static void _mutexLock(_mutex* mutex) {
+	pthread_mutex_lock(mutex);
+}
+
+static void _mutexUnlock(_mutex* mutex) {
+	pthread_mutex_unlock(mutex);
+}
+
+static void _condWait(_cond* cond, _mutex* mutex) {
+	pthread_cond_wait(cond, mutex);
+}
+
+static void _condBroadcast(_cond* cond) {
+	pthread_cond_broadcast(cond);
+}
+
+static unsigned int _cpuCount(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned int)n : 1;
+}
+
+static inline int _cas64(volatile unsigned long long* ptr, unsigned long long expected, unsigned long long desired) {
+	return __sync_bool_compare_and_swap(ptr, expected, desired);
+}
+
+static inline unsigned long long _load64(volatile unsigned long long* ptr) {
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+#endif
+
+// parallel loop over indices [0, count) with work stealing.
+// every thread owns a continuous range of indices, packed as (begin << 32 | end) so it can
+// be updated with a single CAS. the owner takes indices from the front of its range, and
+// when it runs out it steals the back half of the range of another thread.
+// thread 0 is the calling thread
+typedef void (*_parallelBody)(void* data, unsigned int thread, unsigned int index);
+
+typedef struct _parallelFor {
+	_parallelBody body;
+	void* data;
+	unsigned int threadsC;
+	volatile unsigned long long* ranges;
+} _parallelFor;
+
+typedef struct _parallelWorker {
+	_parallelFor* pf;
+	unsigned int thread;
+} _parallelWorker;
+
+#define RANGE_PACK(begin, end) (((unsigned long long)(begin) << 32) | (end))
+#define RANGE_BEGIN(range) ((unsigned int)((range) >> 32))
+#define RANGE_END(range) ((unsigned int)(range))
+
+static void _parallelRun(_parallelFor* pf, unsigned int me) {
+	volatile unsigned long long* own = pf->ranges + me;
+	while (1) {
+		unsigned long long r = _load64(own);
+		unsigned int b = RANGE_BEGIN(r), e = RANGE_END(r);
+		if (b < e) {
+			if (_cas64(own, r, RANGE_PACK(b + 1, e))) {
+				pf->body(pf->data, me, b);
+			}
+			continue;
+		}
+		// out of work, try to steal
+		int stolen = 0;
+		for (unsigned int k = 1; k < pf->threadsC && !stolen; k++) {
+			volatile unsigned long long* victim = pf->ranges + (me + k) % pf->threadsC;
+			while (1) {
+				unsigned long long v = _load64(victim);
+				unsigned int vb = RANGE_BEGIN(v), ve = RANGE_END(v);
+				if (vb >= ve) break;
+				unsigned int mid = vb + (ve - vb) / 2;
+				if (_cas64(victim, v, RANGE_PACK(vb, mid))) {
+					// nobody steals from an empty range, but they might have read it already,
+					// so the own range is replaced with CAS as well
+					unsigned long long o;
+					do {
+						o = _load64(own);
+					} while (!_cas64(own, o, RANGE_PACK(mid, ve)));
+					stolen = 1;
+					break;
+				}
+			}
+		}
+		if (!stolen) {
+			// all ranges are empty. indices can only move between ranges, so we are done
+			return;
+		}
+	}
+}
+
+static THREAD_FUNC(_parallelThread, arg) {
+	_parallelWorker* worker = (_parallelWorker*)arg;
+	_parallelRun(worker->pf, worker->thread);
+	THREAD_RETURN;
+}
+
+// threads started for a single loop, used when the pool is busy
+static int _parallelSpawn(_parallelFor* pf) {
+	_thread* threads = (_thread*)malloc(pf->threadsC * sizeof(_thread));
+	_parallelWorker* workers = (_parallelWorker*)malloc(pf->threadsC * sizeof(_parallelWorker));
+	if (!threads || !workers) {
+		free(threads);
+		free(workers);
+		DBG_ASSERT(0, -1, "Failed to allocate threads");
+		return -1;
+	}
+	unsigned int startedC = 1;
+	for (; startedC < pf->threadsC; startedC++) {
+		workers[startedC].pf = pf;
+		workers[startedC].thread = startedC;
+		// if a thread fails to start, the rest will steal its work
+		if (_threadStart(threads + startedC, _parallelThread, workers + startedC)) break;
+	}
+	_parallelRun(pf, 0);
+	for (unsigned int i = 1; i < startedC; i++) {
+		_threadJoin(threads[i]);
+	}
+	free(threads);
+	free(workers);
+	return 0;
+}
+
+// persistent workers, so a parallel loop doesn't start and join threads every time.
+// worker i (from 1) runs as thread i of the current job, if the job has that many threads.
+// the pool runs one job at a time: a loop started while it is busy, from another thread
+// or from inside a job, gets threads of its own
+static struct {
+	_mutex lock;
+	_cond wake, done;
+	_parallelFor* job;
+	// bumped for every job and for the shutdown, never wraps around in practice
+	unsigned long long generation;
+	unsigned int workersC;
+	// workers that haven't finished the current job yet
+	unsigned int activeC;
+	// the workers, joined by PVS2D_ShutdownThreads
+	_thread* threads;
+	unsigned int threadsCap;
+	char exiting;
+} _pool = { MUTEX_INIT, COND_INIT, COND_INIT, 0, 0, 0, 0, 0, 0, 0 };
+
+static THREAD_FUNC(_poolThread, arg) {
+	unsigned int me = (unsigned int)(size_t)arg;
+	// workers are started right before the job they are counted in, and generation
+	// is never 0 by then, so a new worker always takes that job
+	unsigned long long seen = 0;
+	_mutexLock(&_pool.lock);
+	while (1) {
+		while (_pool.generation == seen) _condWait(&_pool.wake, &_pool.lock);
+		seen = _pool.generation;
+		if (_pool.exiting) break;
+		_parallelFor* job = _pool.job;
+		if (!job || me >= job->threadsC) continue;
+		_mutexUnlock(&_pool.lock);
+		_parallelRun(job, me);
+		_mutexLock(&_pool.lock);
+		if (--_pool.activeC == 0) _condBroadcast(&_pool.done);
+	}
+	_mutexUnlock(&_pool.lock);
+	THREAD_RETURN;
+}
+
+void PVS2D_ShutdownThreads(void) {
+	_mutexLock(&_pool.lock);
+	_pool.exiting = 1;
+	_pool.generation++;
+	_condBroadcast(&_pool.wake);
+	_thread* threads = _pool.threads;
+	unsigned int workersC = _pool.workersC;
+	_mutexUnlock(&_pool.lock);
+	for (unsigned int i = 0; i < workersC; i++) {
+		_threadJoin(threads[i]);
+	}
+	// the next parallel loop starts the workers again
+	_mutexLock(&_pool.lock);
+	free(_pool.threads);
+	_pool.threads = 0;
+	_pool.threadsCap = 0;
+	_pool.workersC = 0;
+	_pool.exiting = 0;
+	_mutexUnlock(&_pool.lock);
+}
+
+// runs body for every index using threadsC threads (0 - one per cpu)
+static int _parallelForRun(unsigned int count, unsigned int threadsC, _parallelBody body, void* data) {
+	if (threadsC == 0) threadsC = _cpuCount();
+	if (threadsC > count) threadsC = count ? count : 1;
+	_parallelFor pf;
+	pf.body = body;
+	pf.data = data;
+	pf.threadsC = threadsC;
+	pf.ranges = (volatile unsigned long long*)malloc(threadsC * sizeof(unsigned long long));
+	DBG_ASSERT(pf.ranges, -1, "Failed to allocate thread ranges");
+	if (!pf.ranges) return -1;
+	for (unsigned int i = 0; i < threadsC; i++) {
+		pf.ranges[i] = RANGE_PACK((unsigned long long)count * i / threadsC, (unsigned long long)count * (i + 1) / threadsC);
+	}
+	int rez = 0;
+	if (threadsC == 1) {
+		_parallelRun(&pf, 0);
+	}
+	else {
+		_mutexLock(&_pool.lock);
+		if (_pool.job) {
+			_mutexUnlock(&_pool.lock);
+			rez = _parallelSpawn(&pf);
+		}
+		else {
+			while (_pool.workersC + 1 < threadsC) {
+				if (_pool.workersC == _pool.threadsCap) {
+					unsigned int cap = _pool.threadsCap ? _pool.threadsCap * 2 : 8;
+					_thread* threads = (_thread*)realloc(_pool.threads, cap * sizeof(_thread));
+					if (!threads) break;
+					_pool.threads = threads;
+					_pool.threadsCap = cap;
+				}
+				// if a worker fails to start, the rest will steal its work
+				if (_threadStart(_pool.threads + _pool.workersC, _poolThread, (void*)(size_t)(_pool.workersC + 1))) break;
+				_pool.workersC++;
+			}
+			_pool.job = &pf;
+			_pool.activeC = min(_pool.workersC, threadsC - 1);
+			_pool.generation++;
+			_condBroadcast(&_pool.wake);
+			_mutexUnlock(&_pool.lock);
+			_parallelRun(&pf, 0);
+			_mutexLock(&_pool.lock);
+			while (_pool.activeC) _condWait(&_pool.done, &_pool.lock);
+			_pool.job = 0;
+			_mutexUnlock(&_pool.lock);
+		}
+	}
+	free((void*)pf.ranges);
+	return rez;
+}
+
+// exact predicates. inputs are integers, so every point the tree and the portals are made of
+// is an intersection of lines through integer points, and its parameter on a line is a fraction
+// of 64-bit integers. they are compared with 128-bit products, and doubles are used first
+// whenever their error is small enough to decide
+
+// sign of a * b - c * d, exact for any 64-bit operands
+static int _prodDiffSign(long long a, long long b, long long c, long long d) {
+	// each product is off by at most 3 units of the last place, the difference by one more
+	double p = (double)a * (double)b, q = (double)c * (double)d;
+	double diff = p - q, err = (fabs(p) + fabs(q)) * 8.8817841970012523e-16;
+	if (diff > err) return 1;
+	if (diff < -err) return -1;
+#if defined(__SIZEOF_INT128__)
+	__int128 x = (__int128)a * b - (__int128)c * d;
+	return (x > 0) - (x < 0);
+#else
+	// sign and 128-bit magnitude of both products, from 32-bit halves
+	unsigned long long m[2][2];
+	int sign[2];
+	long long ops[2][2] = { { a, b }, { c, d } };
+	for (int k = 0; k < 2; k++) {
+		long long x = ops[k][0], y = ops[k][1];
+		sign[k] = (x > 0) - (x < 0);
+		sign[k] *= (y > 0) - (y < 0);
+		unsigned long long ux = x < 0 ? 0 - (unsigned long long)x : (unsigned long long)x;
+		unsigned long long uy = y < 0 ? 0 - (unsigned long long)y : (unsigned long long)y;
+		unsigned long long x0 = ux & 0xFFFFFFFFULL, x1 = ux >> 32, y0 = uy & 0xFFFFFFFFULL, y1 = uy >> 32;
+		unsigned long long p00 = x0 * y0, p01 = x0 * y1, p10 = x1 * y0, p11 = x1 * y1;
+		unsigned long long mid = (p00 >> 32) + (p01 & 0xFFFFFFFFULL) + (p10 & 0xFFFFFFFFULL);
+		m[k][0] = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+		m[k][1] = (mid << 32) | (p00 & 0xFFFFFFFFULL);
+	}
+	if (sign[0] != sign[1]) return sign[0] > sign[1] ? 1 : -1;
+	int cmp = m[0][0] != m[1][0] ? (m[0][0] > m[1][0] ? 1 : -1) : (m[0][1] != m[1][1] ? (m[0][1] > m[1][1] ? 1 : -1) : 0);
+	return sign[0] * cmp;
+#endif
+}
+
+static inline PVS2D_Param _param(long long num, long long den) {
+	PVS2D_Param p;
+	if (den < 0) {
+		num = -num;
+		den = -den;
+	}
+	p.num = num;
+	p.den = den;
+	return p;
+}
+
+static inline double _paramValue(PVS2D_Param p) {
+	if (!p.den) return p.num > 0 ? INFINITY : -INFINITY;
+	return (double)p.num / (double)p.den;
+}
+
+// compares two parameters, -1, 0 or 1
+static inline int _paramCmp(PVS2D_Param a, PVS2D_Param b) {
+	if (!a.den || !b.den) {
+		int ia = a.den ? 0 : (a.num > 0 ? 1 : -1);
+		int ib = b.den ? 0 : (b.num > 0 ? 1 : -1);
+		return (ia > ib) - (ia < ib);
+	}
+	return _prodDiffSign(a.num, b.den, b.num, a.den);
+}
+
+// error-free transformations of doubles: a + b = *x + *y and a * b = *x + *y
+static inline void _twoSum(double a, double b, double* x, double* y) {
+	double s = a + b, bv = s - a, av = s - bv;
+	*x = s;
+	*y = (a - av) + (b - bv);
+}
+
+static inline void _twoProduct(double a, double b, double* x, double* y) {
+	// Dekker's split of both operands into 26-bit halves
+	double c = 134217729.0 * a, ah = c - (c - a), al = a - ah;
+	c = 134217729.0 * b;
+	double bh = c - (c - b), bl = b - bh;
+	double p = a * b;
+	*x = p;
+	*y = al * bl - (((p - ah * bh) - al * bh) - ah * bl);
+}
+
+// adds b to the expansion e of n nonoverlapping components in the order of increasing
+// magnitude, dropping zeros. returns the new length, which is at most n + 1
+static int _growExpansion(double* e, int n, double b) {
+	double q = b;
+	int k = 0;
+	for (int i = 0; i < n; i++) {
+		double s, t;
+		_twoSum(q, e[i], &s, &t);
+		if (t != 0) e[k++] = t;
+		q = s;
+	}
+	if (q != 0 || k == 0) e[k++] = q;
+	return k;
+}
+
+// sign of (ax - bx) * (cy - dy) - (ay - by) * (cx - dx), the cross product of the vectors
+// from b to a and from d to c. exact for any doubles
+static int _crossSign(double ax, double ay, double bx, double by, double cx, double cy, double dx, double dy) {
+	double detl = (ax - bx) * (cy - dy), detr = (ay - by) * (cx - dx);
+	double det = detl - detr;
+	// the error bound of Shewchuk's orient2d filter
+	double err = (fabs(detl) + fabs(detr)) * 3.3306690738754716e-16;
+	if (det > err) return 1;
+	if (det < -err) return -1;
+	// the differences and the products are split into exact sums, and everything is summed up exactly
+	double abx, abxt, aby, abyt, cdx, cdxt, cdy, cdyt;
+	_twoSum(ax, -bx, &abx, &abxt);
+	_twoSum(ay, -by, &aby, &abyt);
+	_twoSum(cx, -dx, &cdx, &cdxt);
+	_twoSum(cy, -dy, &cdy, &cdyt);
+	double l[4] = { abx, abx, abxt, abxt }, r[4] = { cdy, cdyt, cdy, cdyt };
+	double l2[4] = { aby, aby, abyt, abyt }, r2[4] = { cdx, cdxt, cdx, cdxt };
+	double e[17];
+	int n = 0;
+	for (int i = 0; i < 4; i++) {
+		double x, y;
+		_twoProduct(l[i], r[i], &x, &y);
+		n = _growExpansion(e, n, y);
+		n = _growExpansion(e, n, x);
+		_twoProduct(l2[i], r2[i], &x, &y);
+		n = _growExpansion(e, n, -y);
+		n = _growExpansion(e, n, -x);
+	}
+	// the largest component decides
+	return (e[n - 1] > 0) - (e[n - 1] < 0);
+}
+
+// sign of the orientation of the points a, b, c: positive if c is to the left of the line ab,
+// negative if to the right, 0 if they are collinear. exact for any doubles
+static inline int _orient2d(double ax, double ay, double bx, double by, double cx, double cy) {
+	return _crossSign(ax, ay, cx, cy, bx, by, cx, cy);
+}
+
+// exact for coordinates up to PVS2D_MAX_COORD
+static inline void _intersect(int ax, int ay, int bx, int by, int cx, int cy, int dx, int dy, long long* numerDest, long long* denomDest) {
+	long long nx = (long long)bx - ax, ny = (long long)by - ay;
+	*numerDest = nx * ((long long)cy - ay) - ny * ((long long)cx - ax);
+	*denomDest = nx * ((long long)cy - dy) - ny * ((long long)cx - dx);
 };
 
 // returns 0 if vector (ax, ay) is on the right side of (bx, by)
@@ -85,11 +643,12 @@ static inline unsigned int _side(double ax, double ay, double bx, double by) {
 	return (ax * by > ay * bx);
 }
 
-int _cropSplitSegs(PVS2D_BSPTreeNode* node, PVS2D_Line* line, int left) {
+// crops the split segment of the node so it lies to the left (or right) of the line
+int _cropSplitSeg(PVS2D_BSPTreeNode* node, PVS2D_Line* line, int left) {
 	if (node->line == line) {
 		DBG_ASSERT(0, -1, "This should not have happened...");
 	}
-	int numer, denom;
+	long long numer, denom;
 	_intersect(
 		line->ax, line->ay, line->bx, line->by,
 		node->line->ax, node->line->ay, node->line->bx, node->line->by,
@@ -97,34 +656,21 @@ int _cropSplitSegs(PVS2D_BSPTreeNode* node, PVS2D_Line* line, int left) {
 	);
 	if (denom != 0) {
 		// crop only if not parallel.
-		double t = (double)numer / denom;
-		if (left) {
-			// crop the splitseg so it is to the left
-			if (denom > 0) {
-				node->tSplitEnd = min(t, node->tSplitEnd);
-			}
-			else {
-				node->tSplitStart = max(t, node->tSplitStart);
+		PVS2D_Param t = _param(numer, denom);
+		// crop the splitseg so it is to the left (or to the right)
+		if ((denom > 0) == (left != 0)) {
+			if (_paramCmp(t, node->exactSplitEnd) < 0) {
+				node->exactSplitEnd = t;
+				node->tSplitEnd = _paramValue(t);
 			}
 		}
 		else {
-			// crop the splitseg so it is to the right
-			if (denom > 0) {
-				node->tSplitStart = max(t, node->tSplitStart);
-			}
-			else {
-				node->tSplitEnd = min(t, node->tSplitEnd);
+			if (_paramCmp(t, node->exactSplitStart) > 0) {
+				node->exactSplitStart = t;
+				node->tSplitStart = _paramValue(t);
 			}
 		}
 	}
-	if (node->left) {
-		int rez = _cropSplitSegs(node->left, line, left);
-		if (rez) return rez;
-	}
-	if (node->right) {
-		int rez = _cropSplitSegs(node->right, line, left);
-		if (rez) return rez;
-	}
 	return 0;
 }
 
@@ -140,124 +686,519 @@ enum _side {
 	SIDE_R_FR			// faces right, is on the right
 };
 
+// tells on which side of the line the segment is, given the cross products of _intersect
+// of the line against the segment's line. exact, with the split point written to tDest
+static char _sideOfSeg(long long numer, long long denom, const PVS2D_Seg* seg, PVS2D_Param* tDest) {
+	if (denom == 0) {
+		// parallel.
+		if (numer == 0) {
+			// they are still collinear
+			// this should probably be a warning
+			return SIDE_COL;
+		}
+		// to the left or to the right
+		return numer > 0 ? SIDE_L_PARAL : SIDE_R_PARAL;
+	}
+	// not parallel. the split point
+	PVS2D_Param t = _param(numer, denom);
+	if (tDest) *tDest = t;
+	if (_paramCmp(t, seg->exactStart) > 0) {
+		if (_paramCmp(t, seg->exactEnd) < 0) {
+			// splits the segment
+			return denom < 0 ? SIDE_S_FL : SIDE_S_FR;
+		}
+		// the whole segment is before the split point.
+		// we need to take in account the orientation of the segment in order for our magic to work
+		return denom < 0 ? SIDE_R_FL : SIDE_L_FR;
+	}
+	// the whole segment is after the split point (touching it at most)
+	return denom < 0 ? SIDE_L_FL : SIDE_R_FR;
+}
+
 // tells which side of line the segment is on, as well as what orientation it has.
 // the orientation is being treated as if we would stand in line's point A looked 
 // on the point B also, if the those bits aren't 00, then the function can output the 
 // parameter of point on the segment's line of where the collision happens.
-char _split(PVS2D_Line* line, PVS2D_Seg* seg, double* tDest) {
+char _split(PVS2D_Line* line, PVS2D_Seg* seg, PVS2D_Param* tDest) {
 	if (seg->line == line) {
 		// collinear.
 		return SIDE_COL;
 	}
-	int numer, denom;
+	long long numer, denom;
 	_intersect(
 		line->ax, line->ay, line->bx, line->by,
 		seg->line->ax, seg->line->ay, seg->line->bx, seg->line->by,
 		&numer, &denom
 	);
-	if (denom == 0) {
-		// parallel.
-		if (numer == 0) {
-			// they are still collinear
-			// this should probably be a warning
-			return SIDE_COL;
-		}
-		else if (numer > 0) {
-			// to the left
-			return SIDE_L_PARAL;
-		}
-		else {
-			// to the right
-			return SIDE_R_PARAL;
+	return _sideOfSeg(numer, denom, seg, tDest);
+};
+
+// the parallel build makes about this many tasks per thread, but none smaller than BSP_MIN_TASK segments
+#define BSP_TASKS_PER_THREAD 16
+#define BSP_MIN_TASK 64
+
+// a subtree that is built by a worker thread of the parallel build
+typedef struct _bspTask {
+	PVS2D_BSPTreeNode* node;
+	PVS2D_SegStack* segs;
+	unsigned long long rng;
+	// the half-planes of its ancestors, copied out of the bounds stack
+	unsigned int boundsStart, boundsC;
+} _bspTask;
+
+// state shared by the whole _buildBSP recursion
+typedef struct _bspState {
+	PVS2D_BSPParams params;
+	// allocator of nodes and segments
+	PVS2D_Context* ctx;
+	// xorshift state used for sampling splitter candidates. every node derives the
+	// states of its children from its own, so the tree does not depend on the order of building
+	unsigned long long rng;
+	// the half-planes of all ancestors that bound the subspace of current node,
+	// from the root to the parent
+	struct _bspBound {
+		PVS2D_Line* line;
+		int left;
+	}* bounds;
+	unsigned int boundsC, boundsCap;
+	// when not 0, subtrees of at most `taskGrain` segments are not built but
+	// deferred as tasks for the worker threads
+	unsigned int taskGrain;
+	_bspTask* tasks;
+	unsigned int tasksC, tasksCap;
+	struct _bspBound* taskBounds;
+	unsigned int taskBoundsC, taskBoundsCap;
+	// the amount of threads scoring the splitter candidates of one node
+	unsigned int splitThreadsC;
+} _bspState;
+
+// enters the half-plane to the left (or right) of the line
+static int _pushBound(_bspState* state, PVS2D_Line* line, int left) {
+	if (state->boundsC == state->boundsCap) {
+		unsigned int cap = state->boundsCap ? state->boundsCap * 2 : 64;
+		struct _bspBound* bounds = (struct _bspBound*)realloc(state->bounds, cap * sizeof(struct _bspBound));
+		DBG_ASSERT(bounds, -1, "Failed to grow the bounds stack");
+		if (!bounds) return -1;
+		state->bounds = bounds;
+		state->boundsCap = cap;
+	}
+	state->bounds[state->boundsC].line = line;
+	state->bounds[state->boundsC].left = left;
+	state->boundsC++;
+	return 0;
+}
+
+static inline unsigned long long _rand(unsigned long long* state) {
+	unsigned long long x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+// splitmix64 step, gives the rng state of the left (or right) child of a node
+static inline unsigned long long _childSeed(unsigned long long seed, int left) {
+	unsigned long long x = seed + (left ? 0x9E3779B97F4A7C15ULL : 0x3C6EF372FE94F82AULL);
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	// xorshift state must not be 0
+	return x ? x : 0x9E3779B97F4A7C15ULL;
+}
+
+// segments of a node in SoA form, for scoring many splitter candidates at once.
+// (cx, cy) is the point A of the segment's line, (ex, ey) = A - B, so the cross products
+// of _intersect against a candidate are numer = nx * (cy - ay) - ny * (cx - ax) and
+// denom = nx * ey - ny * ex. ts and te are the nearest doubles of the segment's ends,
+// sLim and eLim are the least |denom| for which t can round to the same double as the end
+// without being equal to it
+typedef struct _splitSoA {
+	unsigned int segsC;
+	PVS2D_Seg** segs;
+	int* cx, * cy, * ex, * ey;
+	double* ts, * te, * sLim, * eLim;
+	// whether the cross products and the ends' parameters are all exact in doubles
+	char exactDoubles;
+	// whether any |denom| can reach the limit of some end
+	char checkEnds;
+} _splitSoA;
+
+// candidates are scored in blocks of segments, between the checks of the split bound
+#define SPLIT_BLOCK_MIN 8
+#define SPLIT_BLOCK_MAX 256
+// nodes with less work (candidates * segments) than this are scored by one thread
+#define SPLIT_PARALLEL_MIN (1u << 20)
+// up to this absolute value of coordinates the cross products take at most 51 bits
+#define SPLIT_SMALL_COORD (1 << 24)
+// integers up to this absolute value are exact in doubles
+#define SPLIT_EXACT_INT (1LL << 53)
+// doubles per vector of the scorer
+#if defined(PVS2D_AVX)
+#define SPLIT_LANES 4
+#elif defined(PVS2D_SSE2)
+#define SPLIT_LANES 2
+#else
+#define SPLIT_LANES 1
+#endif
+
+// whether the double of the parameter is its correctly rounded value
+static inline int _paramExactDouble(PVS2D_Param p) {
+	return p.den <= SPLIT_EXACT_INT && p.num >= -SPLIT_EXACT_INT && p.num <= SPLIT_EXACT_INT;
+}
+
+// t = numer / denom and the end num / den differ by at least 1 / (|denom| * den) unless equal,
+// and by at most 2^-52 * |num| / den if they round to the same double. so they can't, while
+// |num| * |denom| < 2^51, the limit keeps a margin of 2 for the rounding of the division
+static inline double _splitEndLimit(PVS2D_Param p) {
+	if (p.num == 0) return INFINITY;
+	return 1125899906842624.0 / (double)(p.num < 0 ? -p.num : p.num);
+}
+
+static int _splitSoAInit(_splitSoA* soa, PVS2D_SegStack* segs) {
+	unsigned int segsC = 0;
+	for (PVS2D_SegStack* curHead = segs; curHead != 0; curHead = curHead->next)
+		segsC++;
+	// one block for everything, doubles first to keep them aligned
+	char* block = (char*)malloc(segsC * (4 * sizeof(double) + sizeof(PVS2D_Seg*) + 4 * sizeof(int)));
+	DBG_ASSERT(block, -1, "Failed to allocate splitter candidates arrays");
+	if (!block) return -1;
+	soa->segsC = segsC;
+	soa->ts = (double*)block;
+	soa->te = soa->ts + segsC;
+	soa->sLim = soa->te + segsC;
+	soa->eLim = soa->sLim + segsC;
+	soa->segs = (PVS2D_Seg**)(soa->eLim + segsC);
+	soa->cx = (int*)(soa->segs + segsC);
+	soa->cy = soa->cx + segsC;
+	soa->ex = soa->cy + segsC;
+	soa->ey = soa->ex + segsC;
+	soa->exactDoubles = 1;
+	double maxE = 0, minLim = INFINITY;
+	unsigned int i = 0;
+	for (PVS2D_SegStack* curHead = segs; curHead != 0; curHead = curHead->next, i++) {
+		PVS2D_Seg* seg = curHead->seg;
+		const PVS2D_Line* line = seg->line;
+		soa->segs[i] = seg;
+		soa->cx[i] = line->ax;
+		soa->cy[i] = line->ay;
+		soa->ex[i] = line->ax - line->bx;
+		soa->ey[i] = line->ay - line->by;
+		soa->ts[i] = seg->tStart;
+		soa->te[i] = seg->tEnd;
+		soa->sLim[i] = _splitEndLimit(seg->exactStart);
+		soa->eLim[i] = _splitEndLimit(seg->exactEnd);
+		maxE = max(maxE, fabs((double)soa->ex[i]));
+		maxE = max(maxE, fabs((double)soa->ey[i]));
+		minLim = min(minLim, min(soa->sLim[i], soa->eLim[i]));
+		if (
+			line->ax < -SPLIT_SMALL_COORD || line->ax > SPLIT_SMALL_COORD ||
+			line->ay < -SPLIT_SMALL_COORD || line->ay > SPLIT_SMALL_COORD ||
+			line->bx < -SPLIT_SMALL_COORD || line->bx > SPLIT_SMALL_COORD ||
+			line->by < -SPLIT_SMALL_COORD || line->by > SPLIT_SMALL_COORD ||
+			!_paramExactDouble(seg->exactStart) || !_paramExactDouble(seg->exactEnd)
+		) {
+			soa->exactDoubles = 0;
 		}
 	}
-	else {
-		// not parallel. calculate the split point
-		double t = (double)numer / denom;
-		if (tDest) *tDest = t;
-		
-		if (t > seg->tStart + MATCH_TOLERANCE && t < seg->tEnd - MATCH_TOLERANCE) {
-			// splits the segment
-			if (denom < 0) {
-				// faces left
-				return SIDE_S_FL;
-			}
-			else {
-				// faces right
-				return SIDE_S_FR;
-			}
+	// |nx * ey - ny * ex| <= 2 * maxE^2, the candidates come from the same segments
+	soa->checkEnds = minLim <= 2 * maxE * maxE;
+	return 0;
+}
+
+#if defined(PVS2D_AVX) || defined(PVS2D_SSE2)
+// the amount of set bits in a 4-bit movemask
+static const unsigned char _bits4[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+#endif
+
+static inline int _splitBound(double splitCost, double bound, int keepTies) {
+	return keepTies ? splitCost > bound : splitCost >= bound;
+}
+
+// the exact _split of the segment i against the line
+static inline char _splitSoAExact(const _splitSoA* soa, unsigned int i, long long ax, long long ay, long long nx, long long ny) {
+	long long numer = nx * (soa->cy[i] - ay) - ny * (soa->cx[i] - ax);
+	long long denom = nx * soa->ey[i] - ny * soa->ex[i];
+	return _sideOfSeg(numer, denom, soa->segs[i], 0);
+}
+
+// counts of the exactly tested segments, apart from the vector counters
+// so that those can stay in registers
+typedef struct _sideCounts {
+	unsigned int splitC, leftC, rightC;
+} _sideCounts;
+
+static inline void _countSide(char side, _sideCounts* counts) {
+	switch (side) {
+	case SIDE_S_FL:
+	case SIDE_S_FR:
+		counts->splitC++;
+		counts->leftC++;
+		counts->rightC++;
+		break;
+	case SIDE_L_PARAL:
+	case SIDE_L_FL:
+	case SIDE_L_FR:
+		counts->leftC++;
+		break;
+	case SIDE_R_PARAL:
+	case SIDE_R_FL:
+	case SIDE_R_FR:
+		counts->rightC++;
+		break;
+	default:
+		break;
+	}
+}
+
+#if defined(PVS2D_AVX)
+// classifies 4 segments from i on into the counters, returns the mask of the ambiguous ones.
+// checkEnds is a constant after inlining, so areas with no ambiguous ends skip its work
+static inline int _splitVec(const _splitSoA* soa, unsigned int i, __m256d vax, __m256d vay, __m256d vnx, __m256d vny, int checkEnds, unsigned int* splitC, unsigned int* leftC, unsigned int* rightC) {
+	__m256d zero = _mm256_setzero_pd();
+	__m256d cx = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(soa->cx + i)));
+	__m256d cy = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(soa->cy + i)));
+	__m256d ex = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(soa->ex + i)));
+	__m256d ey = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(soa->ey + i)));
+	__m256d numer = _mm256_sub_pd(_mm256_mul_pd(vnx, _mm256_sub_pd(cy, vay)), _mm256_mul_pd(vny, _mm256_sub_pd(cx, vax)));
+	__m256d denom = _mm256_sub_pd(_mm256_mul_pd(vnx, ey), _mm256_mul_pd(vny, ex));
+	__m256d t = _mm256_div_pd(numer, denom);
+	__m256d ts = _mm256_loadu_pd(soa->ts + i), te = _mm256_loadu_pd(soa->te + i);
+	int parM = _mm256_movemask_pd(_mm256_cmp_pd(denom, zero, _CMP_EQ_OQ)), ambM = 0;
+	if (checkEnds) {
+		__m256d adenom = _mm256_andnot_pd(_mm256_set1_pd(-0.0), denom);
+		__m256d amb = _mm256_or_pd(
+			_mm256_and_pd(_mm256_cmp_pd(t, ts, _CMP_EQ_OQ), _mm256_cmp_pd(adenom, _mm256_loadu_pd(soa->sLim + i), _CMP_GE_OQ)),
+			_mm256_and_pd(_mm256_cmp_pd(t, te, _CMP_EQ_OQ), _mm256_cmp_pd(adenom, _mm256_loadu_pd(soa->eLim + i), _CMP_GE_OQ)));
+		ambM = _mm256_movemask_pd(amb) & ~parM;
+	}
+	int gtM = _mm256_movemask_pd(_mm256_cmp_pd(t, ts, _CMP_GT_OQ)), dnegM = _mm256_movemask_pd(_mm256_cmp_pd(denom, zero, _CMP_LT_OQ));
+	int splitM = gtM & _mm256_movemask_pd(_mm256_cmp_pd(t, te, _CMP_LT_OQ)) & ~parM & ~ambM;
+	int parL = _mm256_movemask_pd(_mm256_cmp_pd(numer, zero, _CMP_GT_OQ)) & parM;
+	int parR = _mm256_movemask_pd(_mm256_cmp_pd(numer, zero, _CMP_LT_OQ)) & parM;
+	// not split: after the split point to the right iff it faces right, before it iff it faces left
+	int sideM = ~(parM | splitM | ambM) & 15;
+	int rightM = ~(gtM ^ dnegM) & 15;
+	*splitC += _bits4[splitM];
+	*leftC += _bits4[splitM | parL | (sideM & ~rightM)];
+	*rightC += _bits4[splitM | parR | (sideM & rightM)];
+	return ambM;
+}
+#elif defined(PVS2D_SSE2)
+// classifies 2 segments from i on, the same as the AVX one
+static inline int _splitVec(const _splitSoA* soa, unsigned int i, __m128d vax, __m128d vay, __m128d vnx, __m128d vny, int checkEnds, unsigned int* splitC, unsigned int* leftC, unsigned int* rightC) {
+	__m128d zero = _mm_setzero_pd();
+	__m128d cx = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(soa->cx + i)));
+	__m128d cy = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(soa->cy + i)));
+	__m128d ex = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(soa->ex + i)));
+	__m128d ey = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(soa->ey + i)));
+	__m128d numer = _mm_sub_pd(_mm_mul_pd(vnx, _mm_sub_pd(cy, vay)), _mm_mul_pd(vny, _mm_sub_pd(cx, vax)));
+	__m128d denom = _mm_sub_pd(_mm_mul_pd(vnx, ey), _mm_mul_pd(vny, ex));
+	__m128d t = _mm_div_pd(numer, denom);
+	__m128d ts = _mm_loadu_pd(soa->ts + i), te = _mm_loadu_pd(soa->te + i);
+	int parM = _mm_movemask_pd(_mm_cmpeq_pd(denom, zero)), ambM = 0;
+	if (checkEnds) {
+		__m128d adenom = _mm_andnot_pd(_mm_set1_pd(-0.0), denom);
+		__m128d amb = _mm_or_pd(
+			_mm_and_pd(_mm_cmpeq_pd(t, ts), _mm_cmpge_pd(adenom, _mm_loadu_pd(soa->sLim + i))),
+			_mm_and_pd(_mm_cmpeq_pd(t, te), _mm_cmpge_pd(adenom, _mm_loadu_pd(soa->eLim + i))));
+		ambM = _mm_movemask_pd(amb) & ~parM;
+	}
+	int gtM = _mm_movemask_pd(_mm_cmpgt_pd(t, ts)), dnegM = _mm_movemask_pd(_mm_cmplt_pd(denom, zero));
+	int splitM = gtM & _mm_movemask_pd(_mm_cmplt_pd(t, te)) & ~parM & ~ambM;
+	int parL = _mm_movemask_pd(_mm_cmpgt_pd(numer, zero)) & parM;
+	int parR = _mm_movemask_pd(_mm_cmplt_pd(numer, zero)) & parM;
+	int sideM = ~(parM | splitM | ambM) & 3;
+	int rightM = ~(gtM ^ dnegM) & 3;
+	*splitC += _bits4[splitM];
+	*leftC += _bits4[splitM | parL | (sideM & ~rightM)];
+	*rightC += _bits4[splitM | parR | (sideM & rightM)];
+	return ambM;
+}
+#endif
+
+// evaluates the line of given candidate against all segments in the area.
+// classifies every segment exactly as _split does: when the cross products and the ends
+// are exact in doubles, t and the ends are correctly rounded, and rounding keeps the order,
+// so only the segments which end rounds to the same double as t, while not provably equal
+// to it, are tested exactly. segments of the candidate's own line give
+// numer = denom = 0 and count as collinear.
+// returns the cost, or INFINITY as soon as the splits alone make it not less than `bound`
+// (greater than `bound`, if candidates of equal cost matter)
+static double _splitterCost(const _splitSoA* soa, unsigned int cand, const PVS2D_BSPParams* params, double bound, int keepTies) {
+	const PVS2D_Line* line = soa->segs[cand]->line;
+	long long lax = line->ax, lay = line->ay, lnx = (long long)line->bx - line->ax, lny = (long long)line->by - line->ay;
+	unsigned int splitC = 0, leftC = 0, rightC = 0;
+	_sideCounts exact = { 0, 0, 0 };
+#if defined(PVS2D_AVX)
+	__m256d vax = _mm256_set1_pd((double)lax), vay = _mm256_set1_pd((double)lay);
+	__m256d vnx = _mm256_set1_pd((double)lnx), vny = _mm256_set1_pd((double)lny);
+#elif defined(PVS2D_SSE2)
+	__m128d vax = _mm_set1_pd((double)lax), vay = _mm_set1_pd((double)lay);
+	__m128d vnx = _mm_set1_pd((double)lnx), vny = _mm_set1_pd((double)lny);
+#endif
+	// blocks grow, since most candidates are rejected after the first few segments
+	for (unsigned int base = 0, block = SPLIT_BLOCK_MIN; base < soa->segsC; base += block, block = min(block * 2, (unsigned int)SPLIT_BLOCK_MAX)) {
+		unsigned int i = base, end = min(base + block, soa->segsC);
+		if (!soa->exactDoubles) end = base;
+#if defined(PVS2D_AVX) || defined(PVS2D_SSE2)
+		if (!soa->checkEnds) {
+			for (; i + SPLIT_LANES <= end; i += SPLIT_LANES)
+				_splitVec(soa, i, vax, vay, vnx, vny, 0, &splitC, &leftC, &rightC);
 		}
 		else {
-			// doesn't split the segment.
-			// in order to get more accurate result, we will use middle point of the segment
-			// to determine the side it is on
-			double middle = (seg->tStart + seg->tEnd) / 2;
-			// we need to take in account the orientation of the segment in order for our magic to work
-			// the rest here are mostly self-explainatory
-			if (denom < 0) {
-				if (middle > t) {
-					return SIDE_L_FL;
-				}
-				else {
-					return SIDE_R_FL;
-				}
+			// masks of the ambiguous lanes by the first segment of the vector,
+			// they are tested exactly after the block
+			unsigned char ambs[SPLIT_BLOCK_MAX];
+			int ambAny = 0;
+			for (; i + SPLIT_LANES <= end; i += SPLIT_LANES) {
+				int ambM = _splitVec(soa, i, vax, vay, vnx, vny, 1, &splitC, &leftC, &rightC);
+				ambs[i - base] = (unsigned char)ambM;
+				ambAny |= ambM;
 			}
-			else {
-				if (middle > t) {
-					return SIDE_R_FR;
-				}
-				else {
-					return SIDE_L_FR;
+			for (unsigned int j = base; ambAny && j < i; j += SPLIT_LANES) {
+				for (int k = 0, ambM = ambs[j - base]; ambM; k++, ambM >>= 1) {
+					if (ambM & 1) _countSide(_splitSoAExact(soa, j + k, lax, lay, lnx, lny), &exact);
 				}
 			}
 		}
+#endif
+		// scalar fallback, the tail and large coordinates
+		for (end = min(base + block, soa->segsC); i < end; i++) {
+			char side = _splitSoAExact(soa, i, lax, lay, lnx, lny);
+			_countSide(side, &exact);
+			if ((side == SIDE_S_FL || side == SIDE_S_FR) && _splitBound(params->splitWeight * (splitC + exact.splitC), bound, keepTies)) return INFINITY;
+		}
+		// the balance term is never negative, so splits alone bound the cost from below
+		if (_splitBound(params->splitWeight * (splitC + exact.splitC), bound, keepTies)) return INFINITY;
 	}
+	splitC += exact.splitC;
+	leftC += exact.leftC;
+	rightC += exact.rightC;
+	double cost = params->splitWeight * splitC;
+	if (params->balanceWeight != 0) {
+		cost += params->balanceWeight * (leftC > rightC ? leftC - rightC : rightC - leftC);
+	}
+	return cost;
+}
 
-};
-
-int _buildBSP(PVS2D_BSPTreeNode* cur_node, PVS2D_SegStack* cur_segs, unsigned int* leafIndex) {
-	DBG_ASSERT(cur_node, -1, "cur_node can't be NULL (node must be allocated before calling the function)")
-	DBG_ASSERT(cur_segs, -1, "cur_segs can't be NULL (segment array can't have 0 segments)");
-	cur_node->left = 0;
-	cur_node->right = 0;
-	cur_node->leftLeaf = 0;
-	cur_node->rightLeaf = 0;
-	cur_node->line = 0;
-	cur_node->segs = 0;
-	cur_node->tSplitStart = -INFINITY;
-	cur_node->tSplitEnd = INFINITY;
-	cur_node->portals = 0;
+// the best candidate found by one thread, padded to its own cache line
+typedef struct _splitBest {
+	double cost;
+	unsigned int index;
+	char pad[64 - sizeof(double) - sizeof(unsigned int)];
+} _splitBest;
 
+// candidates scored in parallel. the result is the first candidate of the minimal cost,
+// the same one the sequential loop finds
+typedef struct _splitEval {
+	const _splitSoA* soa;
+	const unsigned int* cands;
+	const PVS2D_BSPParams* params;
+	_splitBest* best;
+	// the first candidate of zero cost found so far, nothing after it has to be scored
+	volatile unsigned long long zeroIndex;
+} _splitEval;
 
-	PVS2D_Seg* rootSeg = 0;
-	unsigned int minsplits = -1;        // UINT_MAX
-	// the index of leaves, tells the amount of leaves compiled.
-	// the static is used instead of global variable to reduce junk.
-	// this was done in order to not use uint max for the same thing, 
-	// so the leaf 0 is 'invalid' leaf
+static void _splitEvalBody(void* data, unsigned int thread, unsigned int index) {
+	_splitEval* ev = (_splitEval*)data;
+	if (index > _load64(&ev->zeroIndex)) return;
+	_splitBest* best = ev->best + thread;
+	// candidates may come in any order, so the ones of equal cost are not pruned
+	double cost = _splitterCost(ev->soa, ev->cands[index], ev->params, best->cost, 1);
+	if (cost < best->cost || (cost == best->cost && index < best->index)) {
+		best->cost = cost;
+		best->index = index;
+	}
+	if (cost <= 0) {
+		unsigned long long z;
+		do {
+			z = _load64(&ev->zeroIndex);
+		} while (index < z && !_cas64(&ev->zeroIndex, z, index));
+	}
+}
 
-	for (PVS2D_SegStack* rootHead = cur_segs; rootHead != 0; rootHead = rootHead->next) {
-		// choose any segment and see how much it splits
-		unsigned int splitC = 0;
-		for (PVS2D_SegStack* curHead = cur_segs; curHead != 0; curHead = curHead->next) {
-			char side = _split(rootHead->seg->line, curHead->seg, 0);
-			if (side == SIDE_S_FL || side == SIDE_S_FR) {
-				// it splits it
-				splitC++;
+// scores the candidates in the given order, returns the index of the first one of the minimal cost
+static unsigned int _bestSplitter(const _splitSoA* soa, const unsigned int* cands, unsigned int candsC, _bspState* state) {
+	const PVS2D_BSPParams* params = &state->params;
+	unsigned int threadsC = state->splitThreadsC;
+	if (threadsC > candsC) threadsC = candsC;
+	if (threadsC > 1 && (unsigned long long)candsC * soa->segsC >= SPLIT_PARALLEL_MIN) {
+		_splitEval ev;
+		ev.soa = soa;
+		ev.cands = cands;
+		ev.params = params;
+		ev.zeroIndex = candsC;
+		ev.best = (_splitBest*)malloc(threadsC * sizeof(_splitBest));
+		if (ev.best) {
+			for (unsigned int i = 0; i < threadsC; i++) {
+				ev.best[i].cost = INFINITY;
+				ev.best[i].index = candsC;
+			}
+			_parallelForRun(candsC, threadsC, _splitEvalBody, &ev);
+			unsigned int bestIndex = candsC;
+			double mincost = INFINITY;
+			for (unsigned int i = 0; i < threadsC; i++) {
+				if (ev.best[i].cost < mincost || (ev.best[i].cost == mincost && ev.best[i].index < bestIndex)) {
+					mincost = ev.best[i].cost;
+					bestIndex = ev.best[i].index;
+				}
 			}
+			free(ev.best);
+			return bestIndex;
 		}
-		if (splitC < minsplits) {
-			minsplits = splitC;
-			rootSeg = rootHead->seg;
+		// without memory for the threads, score them here
+	}
+	unsigned int bestIndex = candsC;
+	double mincost = INFINITY;
+	for (unsigned int i = 0; i < candsC; i++) {
+		double cost = _splitterCost(soa, cands[i], params, mincost, 0);
+		if (cost < mincost) {
+			mincost = cost;
+			bestIndex = i;
+			if (mincost <= 0) break;	// can't do better than that
 		}
 	}
+	return bestIndex;
+}
 
-	// use the min segment and split all segments into right ones, left ones and etc.
-	PVS2D_SegStack* segsLeft = 0;
-	PVS2D_SegStack* segsRight = 0;
-	cur_node->line = rootSeg->line;
-	PVS2D_SegStack* curHead, * nextHead = cur_segs;
-	while (1) {
+// chooses the segment, which line will split the area, according to the splitter policy
+static PVS2D_Seg* _chooseSplitter(PVS2D_SegStack* cur_segs, _bspState* state) {
+	const PVS2D_BSPParams* params = &state->params;
+	_splitSoA soa;
+	if (_splitSoAInit(&soa, cur_segs)) return 0;
+	unsigned int* cands = (unsigned int*)malloc(soa.segsC * sizeof(unsigned int));
+	if (!cands) {
+		free(soa.ts);
+		DBG_ASSERT(0, 0, "Failed to allocate splitter candidates array");
+		return 0;
+	}
+	for (unsigned int i = 0; i < soa.segsC; i++)
+		cands[i] = i;
+	unsigned int candsC = soa.segsC;
+	if (params->policy == PVS2D_SPLIT_SAMPLED && soa.segsC > params->sampleC) {
+		// test only `sampleC` random segments
+		candsC = params->sampleC;
+		for (unsigned int i = 0; i < candsC; i++) {
+			// partial Fisher-Yates shuffle, so no candidate is tested twice
+			unsigned int j = i + (unsigned int)(_rand(&state->rng) % (soa.segsC - i));
+			unsigned int cand = cands[j];
+			cands[j] = cands[i];
+			cands[i] = cand;
+		}
+	}
+	// otherwise choose any segment and see how much it splits
+	unsigned int best = _bestSplitter(&soa, cands, candsC, state);
+	PVS2D_Seg* rootSeg = best < candsC ? soa.segs[cands[best]] : 0;
+	free(cands);
+	free(soa.ts);
+	return rootSeg;
+}
+
+// sorts the segments into the ones on the line, to the left and to the right of it. the ones
+// crossing the line are split in two, the new pieces are allocated from ctx
+static int _partitionSegs(PVS2D_Context* ctx, PVS2D_Line* line, PVS2D_SegStack* segs, PVS2D_SegStack** colDest, PVS2D_SegStack** leftDest, unsigned int* leftC, PVS2D_SegStack** rightDest, unsigned int* rightC) {
+	PVS2D_SegStack* curHead, * nextHead = segs;
+	while (1) {
 		if (nextHead == 0) {
 			break;
 		}
@@ -265,179 +1206,491 @@ int _buildBSP(PVS2D_BSPTreeNode* cur_node, PVS2D_SegStack* cur_segs, unsigned in
 		nextHead = curHead->next;
 		// this juncture above was used instead of for loop to allow us modifying curHead->next ptr 
 
-		double t;
-		char side = _split(rootSeg->line, curHead->seg, &t);
+		PVS2D_Param t;
+		char side = _split(line, curHead->seg, &t);
 
 		switch (side) {
 		case SIDE_COL:;
-			curHead->next = cur_node->segs;
-			cur_node->segs = curHead;
+			curHead->next = *colDest;
+			*colDest = curHead;
 			break;
 		case SIDE_L_PARAL:;
 		case SIDE_L_FL:;
 		case SIDE_L_FR:;
-			curHead->next = segsLeft;
-			segsLeft = curHead;
+			curHead->next = *leftDest;
+			*leftDest = curHead;
+			(*leftC)++;
 			break;
 		case SIDE_R_PARAL:;
 		case SIDE_R_FL:;
 		case SIDE_R_FR:;
-			curHead->next = segsRight;
-			segsRight = curHead;
+			curHead->next = *rightDest;
+			*rightDest = curHead;
+			(*rightC)++;
 			break;
 		case SIDE_S_FL:;
 		case SIDE_S_FR:;
-			PVS2D_SegStack* newElem = (PVS2D_SegStack*)malloc(sizeof(PVS2D_SegStack));
+			PVS2D_SegStack* newElem = (PVS2D_SegStack*)_alloc(ctx, sizeof(PVS2D_SegStack));
 			DBG_ASSERT(newElem, -1, "Failed to allocate new seg stack node");
+			if (!newElem) return -1;
 			*newElem = *curHead;
-			newElem->seg = (PVS2D_Seg*)malloc(sizeof(PVS2D_Seg));
+			newElem->seg = (PVS2D_Seg*)_alloc(ctx, sizeof(PVS2D_Seg));
 			DBG_ASSERT(newElem->seg, -1, "Failed to allocate new segment");
+			if (!newElem->seg) return -1;
 			*newElem->seg = *curHead->seg;
-			newElem->seg->tStart = t;
-			curHead->seg->tEnd = t;
+			newElem->seg->exactStart = t;
+			newElem->seg->tStart = _paramValue(t);
+			curHead->seg->exactEnd = t;
+			curHead->seg->tEnd = newElem->seg->tStart;
 			if (side == SIDE_S_FL) {
-				newElem->next = segsLeft;
-				segsLeft = newElem;
-				curHead->next = segsRight;
-				segsRight = curHead;
+				newElem->next = *leftDest;
+				*leftDest = newElem;
+				curHead->next = *rightDest;
+				*rightDest = curHead;
 			}
 			else {
-				newElem->next = segsRight;
-				segsRight = newElem;
-				curHead->next = segsLeft;
-				segsLeft = curHead;
+				newElem->next = *rightDest;
+				*rightDest = newElem;
+				curHead->next = *leftDest;
+				*leftDest = curHead;
 			}
+			(*leftC)++;
+			(*rightC)++;
 			break;
 		default:
 			// something is wrong here
 			break;
 		}
+	}
+	return 0;
+}
+
+static int _buildChild(PVS2D_BSPTreeNode* parent, PVS2D_SegStack* segs, unsigned int segsC, int left, unsigned long long seed, _bspState* state, PVS2D_BSPTreeNode** childDest);
+
+int _buildBSP(PVS2D_BSPTreeNode* cur_node, PVS2D_SegStack* cur_segs, _bspState* state) {
+	DBG_ASSERT(cur_node, -1, "cur_node can't be NULL (node must be allocated before calling the function)")
+	DBG_ASSERT(cur_segs, -1, "cur_segs can't be NULL (segment array can't have 0 segments)");
+	cur_node->left = 0;
+	cur_node->right = 0;
+	cur_node->leftLeaf = 0;
+	cur_node->rightLeaf = 0;
+	cur_node->line = 0;
+	cur_node->segs = 0;
+	cur_node->tSplitStart = -INFINITY;
+	cur_node->tSplitEnd = INFINITY;
+	cur_node->exactSplitStart = _param(-1, 0);
+	cur_node->exactSplitEnd = _param(1, 0);
+	cur_node->portals = 0;
+
+	unsigned long long seed = state->rng;
+	PVS2D_Seg* rootSeg = _chooseSplitter(cur_segs, state);
+	DBG_ASSERT(rootSeg, -1, "Failed to choose splitter");
+	if (!rootSeg) return -1;
 
+	// use the min segment and split all segments into right ones, left ones and etc.
+	PVS2D_SegStack* segsLeft = 0;
+	PVS2D_SegStack* segsRight = 0;
+	unsigned int leftC = 0, rightC = 0;
+	cur_node->line = rootSeg->line;
+	// crop the split segment by the half-planes of all ancestors, nearest first
+	for (unsigned int i = state->boundsC; i-- > 0;) {
+		int rez = _cropSplitSeg(cur_node, state->bounds[i].line, state->bounds[i].left);
+		if (rez) return rez;	// error encountered
 	}
+	int rez = _partitionSegs(state->ctx, rootSeg->line, cur_segs, &cur_node->segs, &segsLeft, &leftC, &segsRight, &rightC);
+	if (rez) return rez;	// error encountered
 	// now all segments are sorted to their lists. 
-	// now we also have to calculate tSplitStart and tSplitEnd
-	// this is done by each node descending its children and "cutting" their split segment by itself
+	// tSplitStart and tSplitEnd of children are calculated by themselves, since
+	// they know the half-planes of all their ancestors.
+	// leaves are numbered afterwards by _numberLeaves
 	// time for recursion
-	if (segsLeft == 0) {
-		// we don't have any segs to the left, therefore its a leaf.
-		cur_node->left = 0;
-		cur_node->leftLeaf = (*leafIndex)++;
+	if (segsLeft) {
+		int rez = _buildChild(cur_node, segsLeft, leftC, 1, seed, state, &cur_node->left);
+		if (rez) return rez;   // error encountered
 	}
-	else {
-		PVS2D_BSPTreeNode* newNode = (PVS2D_BSPTreeNode*)malloc(sizeof(PVS2D_BSPTreeNode));
-		DBG_ASSERT(newNode, -1, "Failed to allocate new BSP tree node");
-		int rez = _buildBSP(newNode, segsLeft, leafIndex);
+	if (segsRight) {
+		int rez = _buildChild(cur_node, segsRight, rightC, 0, seed, state, &cur_node->right);
 		if (rez) return rez;   // error encountered
-		cur_node->left = newNode;
-		cur_node->leftLeaf = 0;
-		// crop left children
-		rez = _cropSplitSegs(newNode, cur_node->line, 1);
-		if (rez) return rez;	// error encountered
 	}
+	// nothing seems needs freeing.
+
+	return 0;
+
+};
 
-	if (segsRight == 0) {
-		// we don't have any segs to the right, therefore its a leaf
-		cur_node->right = 0;
-		cur_node->rightLeaf = (*leafIndex)++;
+// builds the subtree of segments on one side of the node (or defers it as a task)
+static int _buildChild(PVS2D_BSPTreeNode* parent, PVS2D_SegStack* segs, unsigned int segsC, int left, unsigned long long seed, _bspState* state, PVS2D_BSPTreeNode** childDest) {
+	PVS2D_BSPTreeNode* newNode = (PVS2D_BSPTreeNode*)_alloc(state->ctx, sizeof(PVS2D_BSPTreeNode));
+	DBG_ASSERT(newNode, -1, "Failed to allocate new BSP tree node");
+	if (!newNode) return -1;
+	int rez = _pushBound(state, parent->line, left);
+	if (rez) {
+		// the node isn't in the tree yet, the arena one is freed with the context
+		if (!state->ctx) free(newNode);
+		return rez;	// error encountered
+	}
+	if (state->taskGrain && segsC <= state->taskGrain) {
+		if (state->tasksC == state->tasksCap) {
+			unsigned int cap = state->tasksCap ? state->tasksCap * 2 : 64;
+			_bspTask* tasks = (_bspTask*)realloc(state->tasks, cap * sizeof(_bspTask));
+			if (!tasks) {
+				// the old list stays valid, and is freed with the state
+				if (!state->ctx) free(newNode);
+				DBG_ASSERT(0, -1, "Failed to grow the task list");
+				return -1;
+			}
+			state->tasks = tasks;
+			state->tasksCap = cap;
+		}
+		if (state->taskBoundsC + state->boundsC > state->taskBoundsCap) {
+			unsigned int cap = state->taskBoundsCap ? state->taskBoundsCap : 256;
+			while (cap < state->taskBoundsC + state->boundsC) cap *= 2;
+			struct _bspBound* bounds = (struct _bspBound*)realloc(state->taskBounds, cap * sizeof(struct _bspBound));
+			if (!bounds) {
+				if (!state->ctx) free(newNode);
+				DBG_ASSERT(0, -1, "Failed to grow the task bounds");
+				return -1;
+			}
+			state->taskBounds = bounds;
+			state->taskBoundsCap = cap;
+		}
+		_bspTask* task = state->tasks + state->tasksC++;
+		task->node = newNode;
+		task->segs = segs;
+		task->rng = _childSeed(seed, left);
+		task->boundsStart = state->taskBoundsC;
+		task->boundsC = state->boundsC;
+		memcpy(state->taskBounds + state->taskBoundsC, state->bounds, state->boundsC * sizeof(struct _bspBound));
+		state->taskBoundsC += state->boundsC;
 	}
 	else {
-		PVS2D_BSPTreeNode* newNode = (PVS2D_BSPTreeNode*)malloc(sizeof(PVS2D_BSPTreeNode));
-		DBG_ASSERT(newNode, -1, "Failed to allocate new BSP tree node");
-		int rez = _buildBSP(newNode, segsRight, leafIndex);
+		state->rng = _childSeed(seed, left);
+		rez = _buildBSP(newNode, segs, state);
 		if (rez) return rez;   // error encountered
-		cur_node->right = newNode;
-		cur_node->rightLeaf = 0;
-		// crop right children
-		rez = _cropSplitSegs(newNode, cur_node->line, 0);
-		if (rez) return rez;	// error encountered
 	}
-	// nothing seems needs freeing.
-
+	state->boundsC--;
+	*childDest = newNode;
 	return 0;
+}
 
-};
+// numbers the leaves left to right, so the numbering does not depend on the order of building
+static void _numberLeaves(PVS2D_BSPTreeNode* node, unsigned int* leafIndex) {
+	if (node->left) _numberLeaves(node->left, leafIndex);
+	else node->leftLeaf = (*leafIndex)++;
+	if (node->right) _numberLeaves(node->right, leafIndex);
+	else node->rightLeaf = (*leafIndex)++;
+}
+
+// worker threads of the parallel build, every one with its own state and arena
+typedef struct _bspBuild {
+	_bspState* main;
+	_bspState* states;
+	int* rez;
+} _bspBuild;
+
+static void _bspTaskBody(void* data, unsigned int thread, unsigned int index) {
+	_bspBuild* build = (_bspBuild*)data;
+	_bspState* state = build->states + thread;
+	_bspTask* task = build->main->tasks + index;
+	state->boundsC = 0;
+	for (unsigned int i = 0; i < task->boundsC; i++) {
+		struct _bspBound* bound = build->main->taskBounds + task->boundsStart + i;
+		if (_pushBound(state, bound->line, bound->left)) {
+			build->rez[index] = -1;
+			return;
+		}
+	}
+	state->rng = task->rng;
+	build->rez[index] = _buildBSP(task->node, task->segs, state);
+}
+
+// canonical form of a line through two integer points: the direction vector reduced by gcd
+// and normalized so that it points to positive x (or positive y if vertical), and the
+// offset of the line along its normal. two segments are collinear iff their keys are equal
+typedef struct _lkey {
+	long long dx, dy, c;
+} _lkey;
+
+static inline long long _gcd(long long a, long long b) {
+	if (a < 0) a = -a;
+	if (b < 0) b = -b;
+	while (b) {
+		long long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static inline _lkey _lineKey(int ax, int ay, int bx, int by) {
+	_lkey key;
+	long long dx = (long long)bx - ax, dy = (long long)by - ay;
+	long long g = _gcd(dx, dy);
+	dx /= g;
+	dy /= g;
+	if (dx < 0 || (dx == 0 && dy < 0)) {
+		dx = -dx;
+		dy = -dy;
+	}
+	key.dx = dx;
+	key.dy = dy;
+	key.c = dy * ax - dx * ay;
+	return key;
+}
+
+static inline size_t _lkeyHash(_lkey key) {
+	unsigned long long h = (unsigned long long)key.dx * 0x9E3779B97F4A7C15ULL;
+	h ^= (unsigned long long)key.dy * 0xC2B2AE3D27D4EB4FULL + (h << 6) + (h >> 2);
+	h ^= (unsigned long long)key.c * 0x165667B19E3779F9ULL + (h << 6) + (h >> 2);
+	return (size_t)(h ^ (h >> 29));
+}
+
+void PVS2D_DefaultBSPParams(PVS2D_BSPParams* paramsDest) {
+	paramsDest->policy = PVS2D_SPLIT_EXHAUSTIVE;
+	paramsDest->sampleC = 16;
+	paramsDest->splitWeight = 1.0;
+	paramsDest->balanceWeight = 0.0;
+	paramsDest->seed = 0;
+	paramsDest->threadsC = 1;
+}
 
 int PVS2D_BuildBSPTree(int* segs, unsigned int segsC, PVS2D_BSPTreeNode* rootDest) {
-	typedef struct _lstack {
-		PVS2D_Line* line;
-		struct _lstack* next;
-	} _lstack;
+	return PVS2D_BuildBSPTreeEx(0, segs, segsC, 0, rootDest);
+}
 
-	PVS2D_SegStack* prSegs = 0;
-	_lstack* prLines = 0;
-	for (unsigned int i = 0; i < segsC; i++) {
-		int ax = segs[5 * i],
-			ay = segs[5 * i + 1],
-			bx = segs[5 * i + 2],
-			by = segs[5 * i + 3],
-			opq = segs[5 * i + 4];
-		_lstack* match = 0;
-		for (_lstack* top = prLines; top != 0; top = top->next) {
-			if (_collinear(ax, ay, bx, by, top->line->ax, top->line->ay) &&
-				_collinear(ax, ay, bx, by, top->line->bx, top->line->by)
-			) {
-				match = top;
-				break;
+// hash table of lines, keyed by their canonical form.
+// open addressing with linear probing, kept at most half full
+typedef struct _lslot {
+	_lkey key;
+	PVS2D_Line* line;
+} _lslot;
+
+typedef struct _lineTable {
+	_lslot* slots;
+	size_t cap, count;
+} _lineTable;
+
+static int _lineTableInit(_lineTable* table, size_t count) {
+	table->cap = 16;
+	while (table->cap < count * 2) table->cap <<= 1;
+	table->count = 0;
+	table->slots = (_lslot*)calloc(table->cap, sizeof(_lslot));
+	DBG_ASSERT(table->slots, -1, "Failed to allocate line hash table");
+	if (!table->slots) return -1;
+	return 0;
+}
+
+// the slot of the line with this key, or the empty slot where it should go
+static _lslot* _lineTableFind(_lineTable* table, _lkey key) {
+	_lslot* slot = table->slots + (_lkeyHash(key) & (table->cap - 1));
+	while (slot->line && (slot->key.dx != key.dx || slot->key.dy != key.dy || slot->key.c != key.c)) {
+		if (++slot == table->slots + table->cap) slot = table->slots;
+	}
+	return slot;
+}
+
+static int _lineTableGrow(_lineTable* table) {
+	_lineTable grown;
+	if (_lineTableInit(&grown, table->cap)) return -1;
+	for (size_t i = 0; i < table->cap; i++) {
+		if (table->slots[i].line) *_lineTableFind(&grown, table->slots[i].key) = table->slots[i];
+	}
+	grown.count = table->count;
+	free(table->slots);
+	*table = grown;
+	return 0;
+}
+
+// fills the segment (ax, ay) - (bx, by): finds its line in the table, or makes a new one,
+// and adds the segment to the line's members
+static int _makeSeg(PVS2D_Context* ctx, _lineTable* table, int ax, int ay, int bx, int by, int opq, PVS2D_Seg* seg) {
+	// checked in release builds too: a zero length segment has no line, and _lineKey would divide by 0
+	char valid = ax != bx || ay != by;
+	DBG_ASSERT(valid, -1, "Segment can't have zero length");
+	char inRange =
+		ax >= -PVS2D_MAX_COORD && ax <= PVS2D_MAX_COORD && ay >= -PVS2D_MAX_COORD && ay <= PVS2D_MAX_COORD &&
+		bx >= -PVS2D_MAX_COORD && bx <= PVS2D_MAX_COORD && by >= -PVS2D_MAX_COORD && by <= PVS2D_MAX_COORD;
+	DBG_ASSERT(inRange, -1, "Segment coordinates are out of range");
+	if (!valid || !inRange) return -1;
+	if ((table->count + 1) * 2 > table->cap && _lineTableGrow(table)) return -1;
+	_lkey key = _lineKey(ax, ay, bx, by);
+	_lslot* slot = _lineTableFind(table, key);
+	PVS2D_Line* match = slot->line;
+	PVS2D_Param tStart = _param(0, 1), tEnd = _param(1, 1);
+	if (match == 0) {
+		PVS2D_Line* newLine = (PVS2D_Line*)_alloc(ctx, sizeof(PVS2D_Line));
+		DBG_ASSERT(newLine, -1, "Failed to allocate new line");
+		newLine->ax = ax;
+		newLine->ay = ay;
+		newLine->bx = bx;
+		newLine->by = by;
+		newLine->mems = (PVS2D_SegStack*)_alloc(ctx, sizeof(PVS2D_SegStack));
+		DBG_ASSERT(newLine->mems, -1, "Failed to allocate new segment into lines's stack");
+		newLine->mems->seg = seg;
+		newLine->mems->next = 0;
+		slot->key = key;
+		slot->line = newLine;
+		table->count++;
+
+		seg->line = newLine;
+	}
+	else {
+		if (ax == bx) {
+			tStart = _param((long long)ay - match->ay, (long long)match->by - match->ay);
+			tEnd = _param((long long)by - match->ay, (long long)match->by - match->ay);
+		}
+		else {
+			tStart = _param((long long)ax - match->ax, (long long)match->bx - match->ax);
+			tEnd = _param((long long)bx - match->ax, (long long)match->bx - match->ax);
+		}
+		if (_paramCmp(tStart, tEnd) > 0) {
+			PVS2D_Param _t = tStart;
+			tStart = tEnd;
+			tEnd = _t;
+		}
+		seg->line = match;
+		PVS2D_SegStack* newEntry = (PVS2D_SegStack*)_alloc(ctx, sizeof(PVS2D_SegStack));
+		DBG_ASSERT(newEntry, -1, "Failed to allocate new entry to global seg stack");
+		newEntry->seg = seg;
+		newEntry->next = match->mems;
+		match->mems = newEntry;
+	}
+	seg->exactStart = tStart;
+	seg->exactEnd = tEnd;
+	seg->tStart = _paramValue(tStart);
+	seg->tEnd = _paramValue(tEnd);
+	if (opq < 0) {
+		// doors are transparent segments, PVS2D_DOOR(id) == -1 - id
+		seg->opq = 0;
+		seg->door = (unsigned int)(-1 - opq);
+	}
+	else {
+		seg->opq = opq;
+		seg->door = PVS2D_NO_DOOR;
+	}
+	return 0;
+}
+
+// builds the subtree of the node out of the segments, in the subspace bounded by the
+// half-planes `bounds` (from the root down). the leaves are left unnumbered
+static int _buildSubtree(
+	PVS2D_Context* ctx, const PVS2D_BSPParams* params, unsigned long long rng,
+	const struct _bspBound* bounds, unsigned int boundsC,
+	PVS2D_BSPTreeNode* node, PVS2D_SegStack* segs, unsigned int segsC
+) {
+	_bspState state;
+	state.params = *params;
+	state.ctx = ctx;
+	state.rng = rng;
+	state.bounds = 0;
+	state.boundsC = 0;
+	state.boundsCap = 0;
+	for (unsigned int i = 0; i < boundsC; i++) {
+		if (_pushBound(&state, bounds[i].line, bounds[i].left)) {
+			free(state.bounds);
+			return -1;
+		}
+	}
+	unsigned int threadsC = state.params.threadsC ? state.params.threadsC : _cpuCount();
+	// the top of the tree is built here, and every subtree small enough to be built
+	// by one thread becomes a task. several tasks per thread keep them balanced
+	state.taskGrain = threadsC > 1 ? max(segsC / (threadsC * BSP_TASKS_PER_THREAD), (unsigned int)BSP_MIN_TASK) : 0;
+	state.tasks = 0;
+	state.tasksC = 0;
+	state.tasksCap = 0;
+	state.taskBounds = 0;
+	state.taskBoundsC = 0;
+	state.taskBoundsCap = 0;
+	state.splitThreadsC = threadsC;
+	int rez = _buildBSP(node, segs, &state);
+	if (!rez && state.tasksC) {
+		if (threadsC > state.tasksC) threadsC = state.tasksC;
+		_bspBuild build;
+		build.main = &state;
+		build.states = (_bspState*)malloc(threadsC * sizeof(_bspState));
+		build.rez = (int*)calloc(state.tasksC, sizeof(int));
+		if (!build.states || !build.rez) {
+			free(build.states);
+			free(build.rez);
+			free(state.bounds);
+			free(state.tasks);
+			free(state.taskBounds);
+			DBG_ASSERT(0, -1, "Failed to allocate build threads");
+			return -1;
+		}
+		unsigned int statesC = 0;
+		for (; statesC < threadsC; statesC++) {
+			_bspState* worker = build.states + statesC;
+			*worker = state;
+			worker->ctx = 0;
+			worker->bounds = 0;
+			worker->boundsC = 0;
+			worker->boundsCap = 0;
+			worker->taskGrain = 0;
+			// the workers are busy with their subtrees already
+			worker->splitThreadsC = 1;
+			if (ctx) {
+				// every thread allocates from its own arena, which is given to ctx afterwards
+				worker->ctx = PVS2D_CreateContext();
+				if (!worker->ctx) {
+					rez = -1;
+					break;
+				}
 			}
 		}
-		PVS2D_SegStack* newSeg = (PVS2D_SegStack*)malloc(sizeof(PVS2D_SegStack));
+		if (!rez) rez = _parallelForRun(state.tasksC, threadsC, _bspTaskBody, &build);
+		for (unsigned int i = 0; i < state.tasksC && !rez; i++) {
+			rez = build.rez[i];
+		}
+		for (unsigned int i = 0; i < statesC; i++) {
+			if (build.states[i].ctx) _adoptContext(ctx, build.states[i].ctx);
+			free(build.states[i].bounds);
+		}
+		free(build.states);
+		free(build.rez);
+	}
+	free(state.bounds);
+	free(state.tasks);
+	free(state.taskBounds);
+	return rez;
+}
+
+int PVS2D_BuildBSPTreeEx(PVS2D_Context* ctx, int* segs, unsigned int segsC, const PVS2D_BSPParams* params, PVS2D_BSPTreeNode* rootDest) {
+	PVS2D_BSPParams bspParams;
+	if (params) {
+		bspParams = *params;
+	}
+	else {
+		PVS2D_DefaultBSPParams(&bspParams);
+	}
+	DBG_ASSERT(bspParams.policy != PVS2D_SPLIT_SAMPLED || bspParams.sampleC, -1, "sampleC can't be 0");
+	// lines seen so far
+	_lineTable lines;
+	if (_lineTableInit(&lines, segsC)) return -1;
+
+	PVS2D_SegStack* prSegs = 0;
+	for (unsigned int i = 0; i < segsC; i++) {
+		PVS2D_SegStack* newSeg = (PVS2D_SegStack*)_alloc(ctx, sizeof(PVS2D_SegStack));
 		DBG_ASSERT(newSeg, -1, "Failed to allocate new segment stack node");
-		newSeg->seg = (PVS2D_Seg*)malloc(sizeof(PVS2D_Seg));
+		newSeg->seg = (PVS2D_Seg*)_alloc(ctx, sizeof(PVS2D_Seg));
 		DBG_ASSERT(newSeg->seg, -1, "Failed to allocate new segment");
-		double tStart = 0.0, tEnd = 1.0;
-		if (match == 0) {
-			_lstack* newLine = (_lstack*)malloc(sizeof(_lstack));
-			DBG_ASSERT(newLine, -1, "Failed to allocate new line into stack");
-			newLine->line = (PVS2D_Line*)malloc(sizeof(PVS2D_Line));
-			DBG_ASSERT(newLine->line, -1, "Failed to allocate new line in stack node");
-			newLine->line->ax = ax;
-			newLine->line->ay = ay;
-			newLine->line->bx = bx;
-			newLine->line->by = by;
-			newLine->line->mems = (PVS2D_SegStack*)malloc(sizeof(PVS2D_SegStack));
-			DBG_ASSERT(newLine->line->mems, -1, "Failed to allocate new segment into lines's stack");
-			newLine->line->mems->seg = newSeg->seg;
-			newLine->line->mems->next = 0;
-			newLine->next = prLines;
-			prLines = newLine;
-
-			newSeg->seg->line = newLine->line;
+		if (_makeSeg(ctx, &lines, segs[5 * i], segs[5 * i + 1], segs[5 * i + 2], segs[5 * i + 3], segs[5 * i + 4], newSeg->seg)) {
+			free(lines.slots);
+			return -1;
 		}
-		else {
-			if (ax == bx) {
-				tStart = (double)(ay - match->line->ay) / (match->line->by - match->line->ay);
-				tEnd = (double)(by - match->line->ay) / (match->line->by - match->line->ay);
-			}
-			else {
-				tStart = (double)(ax - match->line->ax) / (match->line->bx - match->line->ax);
-				tEnd = (double)(bx - match->line->ax) / (match->line->bx - match->line->ax);
-			}
-			if (tStart > tEnd) {
-				double _t = tStart;
-				tStart = tEnd;
-				tEnd = _t;
-			}
-			newSeg->seg->line = match->line;
-			PVS2D_SegStack* newEntry = (PVS2D_SegStack*)malloc(sizeof(PVS2D_SegStack));
-			DBG_ASSERT(newEntry, -1, "Failed to allocate new entry to global seg stack");
-			newEntry->seg = newSeg->seg;
-			newEntry->next = match->line->mems;
-			match->line->mems = newEntry;
-		}
-		newSeg->seg->tStart = tStart;
-		newSeg->seg->tEnd = tEnd;
-		newSeg->seg->opq = opq;
+		newSeg->seg->id = i;
 		newSeg->next = prSegs;
 		prSegs = newSeg;
 	}
-	// free line stack (but not the lines themselves)
-	for (_lstack* prLine = prLines; prLine != 0;) {
-		_lstack* next = prLine->next;
-		free(prLine);
-		prLine = next;
+	// free line hash table (but not the lines themselves)
+	free(lines.slots);
+	// xorshift state must not be 0
+	int rez = _buildSubtree(ctx, &bspParams, 0x9E3779B97F4A7C15ULL ^ bspParams.seed, 0, 0, rootDest, prSegs, segsC);
+	if (!rez) {
+		unsigned int leafIndex = 0;
+		_numberLeaves(rootDest, &leafIndex);
 	}
-	unsigned int leafIndex = 0;
-	return _buildBSP(rootDest, prSegs, &leafIndex);
+	return rez;
 
 };
 
@@ -457,97 +1710,392 @@ unsigned int PVS2D_FindLeafOfPoint(PVS2D_BSPTreeNode* root, double x, double y)
 	}
 }
 
-void PVS2D_FindLeafsOfSegment(PVS2D_BSPTreeNode* root, double ax, double ay, double bx, double by, char* leafbitset) {
-	double numer, denom, t = 0;
-	_intersectF(
-		root->line->ax, root->line->ay, root->line->bx, root->line->by,
-		ax, ay, bx, by, &numer, &denom
-	);
-	char l = 0, r = 0;
-	if (fabs(denom) < MATCH_TOLERANCE) {
-		// parallel.
-		if (numer > -MATCH_TOLERANCE) {
-			// to the left
-			l = 1;
-		}
-		if (numer < MATCH_TOLERANCE) {
-			// to the right
-			r = 1;
-		}
+static unsigned int _countNodes(PVS2D_BSPTreeNode* node) {
+	unsigned int ret = 1;
+	if (node->left) ret += _countNodes(node->left);
+	if (node->right) ret += _countNodes(node->right);
+	return ret;
+}
+
+// writes the subtree into the array in preorder, so the left child always
+// follows its parent. returns the index of the subtree root
+static int _bakeNode(PVS2D_BSPTreeNode* node, PVS2D_BakedNode* nodes, int* nextIndex) {
+	int idx = (*nextIndex)++;
+	PVS2D_BakedNode* baked = nodes + idx;
+	baked->nx = -(node->line->by - node->line->ay);
+	baked->ny = node->line->bx - node->line->ax;
+	baked->ox = node->line->ax;
+	baked->oy = node->line->ay;
+	baked->left = node->left ? _bakeNode(node->left, nodes, nextIndex) : ~(int)node->leftLeaf;
+	baked->right = node->right ? _bakeNode(node->right, nodes, nextIndex) : ~(int)node->rightLeaf;
+	return idx;
+}
+
+int PVS2D_BakeBSPTree(PVS2D_Context* ctx, PVS2D_BSPTreeNode* root, PVS2D_BakedBSPTree* dest) {
+	DBG_ASSERT(root, -1, "'root' can't be nullptr");
+	DBG_ASSERT(dest, -1, "'dest' can't be nullptr");
+	dest->nodesC = _countNodes(root);
+	dest->nodes = (PVS2D_BakedNode*)_alloc(ctx, dest->nodesC * sizeof(PVS2D_BakedNode));
+	DBG_ASSERT(dest->nodes, -1, "Failed to allocate baked nodes array");
+	int nextIndex = 0;
+	_bakeNode(root, dest->nodes, &nextIndex);
+	return 0;
+}
+
+static inline unsigned int _findLeafBakedFrom(const PVS2D_BakedNode* nodes, int idx, double x, double y) {
+	do {
+		const PVS2D_BakedNode* node = nodes + idx;
+		// the same as _side of the line direction and the point, but against the normal
+		idx = (node->ny * (y - node->oy) + node->nx * (x - node->ox) > 0) ? node->left : node->right;
+	} while (idx >= 0);
+	return (unsigned int)~idx;
+}
+
+unsigned int PVS2D_FindLeafOfPointBaked(const PVS2D_BakedBSPTree* tree, double x, double y) {
+	return _findLeafBakedFrom(tree->nodes, 0, x, y);
+}
+
+// the amount of points traversing the baked tree together
+#define PACKET_SIZE 64
+// subpackets of this size or less are traversed point by point
+#define PACKET_MIN 2
+
+// for each point of the packet writes whether it is to the left of the node's line,
+// returns the amount of points to the left.
+// uses exactly the same arithmetic as PVS2D_FindLeafOfPointBaked, so results match
+static unsigned int _sidesOfPacket(const PVS2D_BakedNode* node, const double* px, const double* py, unsigned int count, unsigned char* sides) {
+	unsigned int i = 0, leftC = 0;
+#if defined(PVS2D_AVX)
+	__m256d nx = _mm256_set1_pd(node->nx), ny = _mm256_set1_pd(node->ny);
+	__m256d ox = _mm256_set1_pd(node->ox), oy = _mm256_set1_pd(node->oy);
+	__m256d zero = _mm256_setzero_pd();
+	for (; i + 4 <= count; i += 4) {
+		__m256d d = _mm256_add_pd(
+			_mm256_mul_pd(ny, _mm256_sub_pd(_mm256_loadu_pd(py + i), oy)),
+			_mm256_mul_pd(nx, _mm256_sub_pd(_mm256_loadu_pd(px + i), ox))
+		);
+		int mask = _mm256_movemask_pd(_mm256_cmp_pd(d, zero, _CMP_GT_OQ));
+		sides[i] = mask & 1;
+		sides[i + 1] = (mask >> 1) & 1;
+		sides[i + 2] = (mask >> 2) & 1;
+		sides[i + 3] = (mask >> 3) & 1;
+		leftC += sides[i] + sides[i + 1] + sides[i + 2] + sides[i + 3];
 	}
-	else {
-		// not parallel. calculate the split point
-		t = numer / denom;
+#elif defined(PVS2D_SSE2)
+	__m128d nx = _mm_set1_pd(node->nx), ny = _mm_set1_pd(node->ny);
+	__m128d ox = _mm_set1_pd(node->ox), oy = _mm_set1_pd(node->oy);
+	__m128d zero = _mm_setzero_pd();
+	for (; i + 2 <= count; i += 2) {
+		__m128d d = _mm_add_pd(
+			_mm_mul_pd(ny, _mm_sub_pd(_mm_loadu_pd(py + i), oy)),
+			_mm_mul_pd(nx, _mm_sub_pd(_mm_loadu_pd(px + i), ox))
+		);
+		int mask = _mm_movemask_pd(_mm_cmpgt_pd(d, zero));
+		sides[i] = mask & 1;
+		sides[i + 1] = (mask >> 1) & 1;
+		leftC += sides[i] + sides[i + 1];
+	}
+#endif
+	// scalar fallback and the tail
+	for (; i < count; i++) {
+		sides[i] = (node->ny * (py[i] - node->oy) + node->nx * (px[i] - node->ox) > 0);
+		leftC += sides[i];
+	}
+	return leftC;
+}
 
-		if (t > MATCH_TOLERANCE && t < 1 - MATCH_TOLERANCE) {
-			// splits the segment
-			l = 1;
-			r = 1;
+void PVS2D_FindLeavesOfPoints(const PVS2D_BakedBSPTree* tree, const double* xs, const double* ys, unsigned int n, unsigned int* out) {
+	// coordinates and original indices of the points in the packet.
+	// the packet is reordered so that every subpacket going into the same subtree is continuous
+	double px[PACKET_SIZE], py[PACKET_SIZE];
+	unsigned int pidx[PACKET_SIZE];
+	unsigned char sides[PACKET_SIZE];
+	// left and right halves of the subpacket being split
+	double tx[PACKET_SIZE], ty[PACKET_SIZE], rx[PACKET_SIZE], ry[PACKET_SIZE];
+	unsigned int ti[PACKET_SIZE], ri[PACKET_SIZE];
+	// every subpacket on the stack is non-empty and they don't intersect,
+	// so there can't be more of them than points
+	struct {
+		int node;
+		unsigned int start, count;
+	} stack[PACKET_SIZE];
+
+	for (unsigned int base = 0; base < n; base += PACKET_SIZE) {
+		unsigned int packetC = min(n - base, (unsigned int)PACKET_SIZE);
+		for (unsigned int i = 0; i < packetC; i++) {
+			px[i] = xs[base + i];
+			py[i] = ys[base + i];
+			pidx[i] = base + i;
 		}
-		else {
-			if (denom < 0) {
-				if (0.5 > t) {
-					l = 1;
+		unsigned int top = 0;
+		stack[top].node = 0;
+		stack[top].start = 0;
+		stack[top].count = packetC;
+		top++;
+		while (top) {
+			top--;
+			const PVS2D_BakedNode* node = tree->nodes + stack[top].node;
+			unsigned int start = stack[top].start, count = stack[top].count;
+
+			// small subpackets are cheaper to finish one point at a time
+			if (count <= PACKET_MIN) {
+				for (unsigned int i = start; i < start + count; i++)
+					out[pidx[i]] = _findLeafBakedFrom(tree->nodes, stack[top].node, px[i], py[i]);
+				continue;
+			}
+			unsigned int l = _sidesOfPacket(node, px + start, py + start, count, sides);
+
+			if (l != 0 && l != count) {
+				// the packet diverges. split the subpacket: left points to the beginning, right ones
+				// to the end. both destinations are written every time to avoid unpredictable branches
+				unsigned int lC = 0, rC = 0;
+				for (unsigned int i = start; i < start + count; i++) {
+					unsigned int s = sides[i - start];
+					tx[lC] = px[i]; ty[lC] = py[i]; ti[lC] = pidx[i];
+					rx[rC] = px[i]; ry[rC] = py[i]; ri[rC] = pidx[i];
+					lC += s;
+					rC += 1 - s;
+				}
+				memcpy(px + start, tx, lC * sizeof(double));
+				memcpy(py + start, ty, lC * sizeof(double));
+				memcpy(pidx + start, ti, lC * sizeof(unsigned int));
+				memcpy(px + start + lC, rx, rC * sizeof(double));
+				memcpy(py + start + lC, ry, rC * sizeof(double));
+				memcpy(pidx + start + lC, ri, rC * sizeof(unsigned int));
+			}
+
+			// right subpacket is pushed first, so the left one is processed next
+			if (l < count) {
+				if (node->right < 0) {
+					for (unsigned int i = start + l; i < start + count; i++)
+						out[pidx[i]] = (unsigned int)~node->right;
 				}
 				else {
-					r = 1;
+					stack[top].node = node->right;
+					stack[top].start = start + l;
+					stack[top].count = count - l;
+					top++;
 				}
 			}
-			else {
-				if (0.5 > t) {
-					r = 1;
+			if (l > 0) {
+				if (node->left < 0) {
+					for (unsigned int i = start; i < start + l; i++)
+						out[pidx[i]] = (unsigned int)~node->left;
 				}
 				else {
-					l = 1;
+					stack[top].node = node->left;
+					stack[top].start = start;
+					stack[top].count = l;
+					top++;
 				}
 			}
 		}
 	}
-	if (l) {
+}
+
+// marks the leaf either in the char array or in the bitset, whichever is given
+static inline void _markLeaf(unsigned int leaf, char* leafchars, PVS2D_BitsetWord* leafbits) {
+	if (leafchars) leafchars[leaf] = 1;
+	else PVS2D_BitsetSet(leafbits, leaf);
+}
+
+// the sides of the line that the part [t0, t1] of the segment goes to, and the piece of it on each.
+// a part crossing the line is cut at the crossing, a part lying on the line goes to both sides
+typedef struct _segSplit {
+	char l, r;
+	// which of the pieces comes first from the start of the segment
+	char leftFirst;
+	double tl0, tl1, tr0, tr1;
+} _segSplit;
+
+static inline _segSplit _splitSegPart(const PVS2D_Line* line, double ax, double ay, double bx, double by, double t0, double t1) {
+	_segSplit split;
+	double dx = (double)line->bx - line->ax, dy = (double)line->by - line->ay;
+	// how far to the left of the line the ends are, the same sign as in PVS2D_FindLeafOfPoint
+	double da = dx * (ay - line->ay) - dy * (ax - line->ax);
+	double db = dx * (by - line->ay) - dy * (bx - line->ax);
+	double d0 = da + t0 * (db - da), d1 = da + t1 * (db - da);
+	split.l = d0 > 0 || d1 > 0 || (d0 == 0 && d1 == 0);
+	split.r = d0 < 0 || d1 < 0 || (d0 == 0 && d1 == 0);
+	split.tl0 = split.tr0 = t0;
+	split.tl1 = split.tr1 = t1;
+	if ((d0 > 0 && d1 < 0) || (d0 < 0 && d1 > 0)) {
+		// the part crosses the line, each side gets its own piece
+		double t = da / (da - db);
+		t = min(max(t, t0), t1);
+		if (d0 > 0) {
+			split.tl1 = t;
+			split.tr0 = t;
+		}
+		else {
+			split.tr1 = t;
+			split.tl0 = t;
+		}
+	}
+	split.leftFirst = d0 > 0 || (d0 == 0 && d1 >= 0);
+	return split;
+}
+
+static void _findLeafsOfSegment(PVS2D_BSPTreeNode* root, double ax, double ay, double bx, double by, double t0, double t1, char* leafchars, PVS2D_BitsetWord* leafbits) {
+	// every subtree gets only the piece of the segment that lies in it
+	_segSplit split = _splitSegPart(root->line, ax, ay, bx, by, t0, t1);
+	if (split.l) {
 		if (root->left) {
-			PVS2D_FindLeafsOfSegment(root->left, ax, ay, bx, by, leafbitset);
+			_findLeafsOfSegment(root->left, ax, ay, bx, by, split.tl0, split.tl1, leafchars, leafbits);
 		}
 		else {
-			leafbitset[root->leftLeaf] = 1;
+			_markLeaf(root->leftLeaf, leafchars, leafbits);
 		}
 	}
-	if (r) {
+	if (split.r) {
 		if (root->right) {
-			PVS2D_FindLeafsOfSegment(root->right, ax, ay, bx, by, leafbitset);
+			_findLeafsOfSegment(root->right, ax, ay, bx, by, split.tr0, split.tr1, leafchars, leafbits);
 		}
 		else {
-			leafbitset[root->rightLeaf] = 1;
+			_markLeaf(root->rightLeaf, leafchars, leafbits);
 		}
 	}
 }
 
+void PVS2D_FindLeafsOfSegment(PVS2D_BSPTreeNode* root, double ax, double ay, double bx, double by, char* leafbitset) {
+	_findLeafsOfSegment(root, ax, ay, bx, by, 0, 1, leafbitset, 0);
+}
+
+void PVS2D_FindLeafsOfSegmentBits(PVS2D_BSPTreeNode* root, double ax, double ay, double bx, double by, PVS2D_BitsetWord* leafbits) {
+	_findLeafsOfSegment(root, ax, ay, bx, by, 0, 1, 0, leafbits);
+}
+
+// entries of the segment traversal stack held on the C stack, it grows onto the heap past that
+#define SEGMENT_STACK 64
+
+// a part [t0, t1] of the segment that is left to walk through the subtree of the node,
+// or through the leaf if there is no node
+typedef struct _segPart {
+	PVS2D_BSPTreeNode* node;
+	unsigned int leaf;
+	double t0, t1;
+} _segPart;
+
+static inline void _segPartSet(_segPart* part, PVS2D_BSPTreeNode* node, unsigned int leaf, double t0, double t1) {
+	part->node = node;
+	part->leaf = leaf;
+	part->t0 = t0;
+	part->t1 = t1;
+}
+
+unsigned int PVS2D_FindLeafsOfSegmentList(
+	PVS2D_BSPTreeNode* root,
+	double ax, double ay, double bx, double by,
+	unsigned int* out, unsigned int outCap
+) {
+	DBG_ASSERT(root, 0, "'root' can't be nullptr");
+	DBG_ASSERT(out || !outCap, 0, "'out' can't be nullptr");
+	_segPart local[SEGMENT_STACK];
+	_segPart* stack = local;
+	unsigned int cap = SEGMENT_STACK, top = 0, outC = 0;
+	_segPartSet(stack + top++, root, 0, 0, 1);
+	while (top) {
+		_segPart part = stack[--top];
+		if (!part.node) {
+			// past the capacity the leaves are only counted
+			if (outC < outCap) out[outC] = part.leaf;
+			outC++;
+			continue;
+		}
+		// at most two parts are pushed
+		if (top + 2 > cap) {
+			_segPart* grown = (_segPart*)malloc(cap * 2 * sizeof(_segPart));
+			if (!grown) {
+				// the count would be incomplete
+				outC = ~0u;
+				break;
+			}
+			memcpy(grown, stack, top * sizeof(_segPart));
+			if (stack != local) free(stack);
+			stack = grown;
+			cap *= 2;
+		}
+		_segSplit split = _splitSegPart(part.node->line, ax, ay, bx, by, part.t0, part.t1);
+		// the far side is pushed first, so the pieces come out from the start of the segment to its end
+		for (int i = 0; i < 2; i++) {
+			char left = (i == 0) != split.leftFirst;
+			if (left && split.l) _segPartSet(stack + top++, part.node->left, part.node->leftLeaf, split.tl0, split.tl1);
+			if (!left && split.r) _segPartSet(stack + top++, part.node->right, part.node->rightLeaf, split.tr0, split.tr1);
+		}
+	}
+	if (stack != local) free(stack);
+	return outC;
+}
+
 
 typedef struct _pairfc {
-	double p;
+	PVS2D_Param p;
 	signed char d;
 } _pairfc;
 
 int _pairfc_cmp(const void* a, const void* b) {
-	double ap = ((_pairfc*)a)->p;
-	double bp = ((_pairfc*)b)->p;
-	if (fabs(ap - bp) < MATCH_TOLERANCE) {
+	int cmp = _paramCmp(((_pairfc*)a)->p, ((_pairfc*)b)->p);
+	if (cmp == 0) {
 		signed char ad = ((_pairfc*)a)->d;
 		signed char bd = ((_pairfc*)b)->d;
 		if (ad < bd) return 1;
 		if (ad > bd) return -1;
 		return 0;
 	}
-	else {
-		if (ap < bp) return -1;
-		if (ap > bp) return 1;
-		return 0;
+	return cmp;
+}
+
+static inline void _setPortalParams(PVS2D_Portal* portal, PVS2D_Param tStart, PVS2D_Param tEnd) {
+	portal->seg.exactStart = tStart;
+	portal->seg.exactEnd = tEnd;
+	portal->seg.tStart = _paramValue(tStart);
+	portal->seg.tEnd = _paramValue(tEnd);
+}
+
+// cuts the transparent portals lying on the node's doors, so the part on a door gets its id.
+// the portals go from the end of the line to the start, and the pieces keep that order
+static int _splitDoorPortals(PVS2D_Context* ctx, PVS2D_BSPTreeNode* node, PVS2D_PortalStack* portals) {
+	for (PVS2D_SegStack* curSeg = node->segs; curSeg != 0; curSeg = curSeg->next) {
+		PVS2D_Seg* door = curSeg->seg;
+		if (door->door == PVS2D_NO_DOOR) continue;
+		for (PVS2D_PortalStack* prt = portals; prt; prt = prt->next) {
+			PVS2D_Seg* seg = &prt->portal->seg;
+			if (seg->opq || seg->door != PVS2D_NO_DOOR) continue;
+			PVS2D_Param lo = _paramCmp(seg->exactStart, door->exactStart) > 0 ? seg->exactStart : door->exactStart;
+			PVS2D_Param hi = _paramCmp(seg->exactEnd, door->exactEnd) < 0 ? seg->exactEnd : door->exactEnd;
+			if (_paramCmp(lo, hi) >= 0) continue;
+			PVS2D_Param pieces[4] = { seg->exactEnd, hi, lo, seg->exactStart };
+			unsigned int doors[3] = { PVS2D_NO_DOOR, door->door, PVS2D_NO_DOOR };
+			// this portal becomes the first non-empty piece, the rest go right after it
+			PVS2D_PortalStack* cur = 0;
+			for (int i = 0; i < 3; i++) {
+				if (_paramCmp(pieces[i + 1], pieces[i]) == 0) continue;
+				if (cur) {
+					PVS2D_PortalStack* newElem = (PVS2D_PortalStack*)_alloc(ctx, sizeof(PVS2D_PortalStack));
+					DBG_ASSERT(newElem, -1, "Failed to create new portal stack element");
+					*newElem = *cur;
+					newElem->portal = (PVS2D_Portal*)_alloc(ctx, sizeof(PVS2D_Portal));
+					DBG_ASSERT(newElem->portal, -1, "Failed to create new portal");
+					*newElem->portal = *cur->portal;
+					cur->next = newElem;
+					cur = newElem;
+				}
+				else {
+					cur = prt;
+				}
+				_setPortalParams(cur->portal, pieces[i + 1], pieces[i]);
+				cur->portal->seg.door = doors[i];
+			}
+			prt = cur;
+		}
 	}
+	return 0;
 }
 
 // converts node's segments into portals that node contains.
 // it will return the pointer to the stack of created portals
 // or 0 if errors happened
-PVS2D_PortalStack* _portalsOfNode(PVS2D_BSPTreeNode* node) {
+PVS2D_PortalStack* _portalsOfNode(PVS2D_Context* ctx, PVS2D_BSPTreeNode* node) {
 	int segsC = 0;
 	for (PVS2D_SegStack* curSeg = node->segs; curSeg != 0; curSeg = curSeg->next) {
 		if (curSeg->seg->opq)
@@ -558,39 +2106,42 @@ PVS2D_PortalStack* _portalsOfNode(PVS2D_BSPTreeNode* node) {
 	segsC = 0;
 	for (PVS2D_SegStack* curSeg = node->segs; curSeg != 0; curSeg = curSeg->next) {
 		if (curSeg->seg->opq) {
-			th[segsC].p = curSeg->seg->tStart;
+			th[segsC].p = curSeg->seg->exactStart;
 			th[segsC++].d = 1;
-			th[segsC].p = curSeg->seg->tEnd;
+			th[segsC].p = curSeg->seg->exactEnd;
 			th[segsC++].d = -1;
 		}
 	}
-	th[segsC].p = node->tSplitStart;
+	th[segsC].p = node->exactSplitStart;
 	th[segsC++].d = -1;
-	th[segsC].p = node->tSplitEnd;
+	th[segsC].p = node->exactSplitEnd;
 	th[segsC++].d = 1;
 	qsort(th, segsC, sizeof(_pairfc), _pairfc_cmp);
 	int l = 1;
-	double prevSeg = NAN;
+	PVS2D_Param prevSeg = { 0, 0 };
+	// until an opaque part starts, there is no previous portal end
+	char noPrev = 1;
 	PVS2D_PortalStack* portals = 0;
 	for (int i = 0; i < segsC; i++) {
 		if (i == 0 && th[i].d == 1) {
 			// we are starting with opaque segment
 			prevSeg = th[i].p;
+			noPrev = 0;
 		}
 		if (i == segsC - 1 && th[i].d == -1) {
 			// we are ending with opaque segment
-			if (isnan(prevSeg)) {
+			if (noPrev) {
 				// "outside" segment. happens when there is transparent portal at tSplitStart
 				prevSeg = th[0].p;
 			}
-			PVS2D_PortalStack* newElem = (PVS2D_PortalStack*)malloc(sizeof(PVS2D_PortalStack));
+			PVS2D_PortalStack* newElem = (PVS2D_PortalStack*)_alloc(ctx, sizeof(PVS2D_PortalStack));
 			DBG_ASSERT(newElem, 0, "Failed to create new portal stack element");
-			newElem->portal = (PVS2D_Portal*)malloc(sizeof(PVS2D_Portal));
+			newElem->portal = (PVS2D_Portal*)_alloc(ctx, sizeof(PVS2D_Portal));
 			DBG_ASSERT(newElem->portal, 0, "Failed to create new portal");
 			newElem->portal->seg.line = node->line;
+			newElem->portal->seg.door = PVS2D_NO_DOOR;
 			newElem->portal->seg.opq = 1;
-			newElem->portal->seg.tStart = prevSeg;
-			newElem->portal->seg.tEnd = th[i].p;
+			_setPortalParams(newElem->portal, prevSeg, th[i].p);
 			newElem->next = portals;
 			portals = newElem;
 			prevSeg = th[i].p;
@@ -599,14 +2150,14 @@ PVS2D_PortalStack* _portalsOfNode(PVS2D_BSPTreeNode* node) {
 		if (th[i].d == 1) {
 			if (l == 0) {
 				// stop previous transparent portal and put it into stack
-				PVS2D_PortalStack* newElem = (PVS2D_PortalStack*)malloc(sizeof(PVS2D_PortalStack));
+				PVS2D_PortalStack* newElem = (PVS2D_PortalStack*)_alloc(ctx, sizeof(PVS2D_PortalStack));
 				DBG_ASSERT(newElem, 0, "Failed to create new portal stack element");
-				newElem->portal = (PVS2D_Portal*)malloc(sizeof(PVS2D_Portal));
+				newElem->portal = (PVS2D_Portal*)_alloc(ctx, sizeof(PVS2D_Portal));
 				DBG_ASSERT(newElem->portal, 0, "Failed to create new portal");
 				newElem->portal->seg.line = node->line;
+				newElem->portal->seg.door = PVS2D_NO_DOOR;
 				newElem->portal->seg.opq = 0;
-				newElem->portal->seg.tStart = prevSeg;
-				newElem->portal->seg.tEnd = th[i].p;
+				_setPortalParams(newElem->portal, prevSeg, th[i].p);
 				newElem->next = portals;
 				portals = newElem;
 				prevSeg = th[i].p;
@@ -616,20 +2167,21 @@ PVS2D_PortalStack* _portalsOfNode(PVS2D_BSPTreeNode* node) {
 		if (th[i].d == -1) {
 			if (l == 1) {
 				// stop previous opaque portal and put it into stack, if it was not portal from "outside"
-				if (isnan(prevSeg)) {
+				if (noPrev) {
 					// "outside" segment. happens when there is transparent portal at tSplitStart
 					prevSeg = th[i].p;
+					noPrev = 0;
 					l--;
 					continue;
 				}
-				PVS2D_PortalStack* newElem = (PVS2D_PortalStack*)malloc(sizeof(PVS2D_PortalStack));
+				PVS2D_PortalStack* newElem = (PVS2D_PortalStack*)_alloc(ctx, sizeof(PVS2D_PortalStack));
 				DBG_ASSERT(newElem, 0, "Failed to create new portal stack element");
-				newElem->portal = (PVS2D_Portal*)malloc(sizeof(PVS2D_Portal));
+				newElem->portal = (PVS2D_Portal*)_alloc(ctx, sizeof(PVS2D_Portal));
 				DBG_ASSERT(newElem->portal, 0, "Failed to create new portal");
 				newElem->portal->seg.line = node->line;
+				newElem->portal->seg.door = PVS2D_NO_DOOR;
 				newElem->portal->seg.opq = 1;
-				newElem->portal->seg.tStart = prevSeg;
-				newElem->portal->seg.tEnd = th[i].p;
+				_setPortalParams(newElem->portal, prevSeg, th[i].p);
 				newElem->next = portals;
 				portals = newElem;
 				prevSeg = th[i].p;
@@ -640,12 +2192,13 @@ PVS2D_PortalStack* _portalsOfNode(PVS2D_BSPTreeNode* node) {
 	}
 	// i hope there is no need to check for closing the sequence.
 	free(th);
+	if (_splitDoorPortals(ctx, node, portals)) return 0;
 	return portals;
 }
 
 // the function should not modify the order of elements in adjacents, 
 // but can insert elements
-int _buildPortals(PVS2D_BSPTreeNode* node, PVS2D_PortalStack* adjacent) {
+int _buildPortals(PVS2D_Context* ctx, PVS2D_BSPTreeNode* node, PVS2D_PortalStack* adjacent) {
 	// adjacent, if provided, must be circular linked list, meaning that it's "last" element
 	// should just point to the "first", as well as, since it forms an array of 
 	// segment that enclose a certain area, they must be present in counter-clockwise order.
@@ -666,7 +2219,7 @@ int _buildPortals(PVS2D_BSPTreeNode* node, PVS2D_PortalStack* adjacent) {
 		adjNxt = adjNxt->next;
 
 		// process the portal
-		double t;
+		PVS2D_Param t;
 		char side = _split(node->line, &adjCur->portal->seg, &t);
 		switch (side) {
 		case SIDE_COL:
@@ -696,21 +2249,21 @@ int _buildPortals(PVS2D_BSPTreeNode* node, PVS2D_PortalStack* adjacent) {
 		case SIDE_S_FL:
 		case SIDE_S_FR:
 			// found split
-			adjNew = (PVS2D_PortalStack*)malloc(sizeof(PVS2D_PortalStack));
+			adjNew = (PVS2D_PortalStack*)_alloc(ctx, sizeof(PVS2D_PortalStack));
 			DBG_ASSERT(adjNew, -1, "Failed to create new portal stack node");
 			*adjNew = *adjCur;
-			adjNew->portal = (PVS2D_Portal*)malloc(sizeof(PVS2D_Portal));
+			adjNew->portal = (PVS2D_Portal*)_alloc(ctx, sizeof(PVS2D_Portal));
 			DBG_ASSERT(adjNew->portal, -1, "Failed to create new portal");
 			*adjNew->portal = *adjCur->portal;
 			// depending on the side the portal we at, put new one at the "end" of the segment
 			// or not, since we can only put new one after ourselves
 			if (adjCur->left) {
-				adjNew->portal->seg.tStart = t;
-				adjCur->portal->seg.tEnd = t;
+				_setPortalParams(adjNew->portal, t, adjNew->portal->seg.exactEnd);
+				_setPortalParams(adjCur->portal, adjCur->portal->seg.exactStart, t);
 			}
 			else {
-				adjNew->portal->seg.tEnd = t;
-				adjCur->portal->seg.tStart = t;
+				_setPortalParams(adjNew->portal, adjNew->portal->seg.exactStart, t);
+				_setPortalParams(adjCur->portal, t, adjCur->portal->seg.exactEnd);
 			}
 			adjNew->next = adjCur->next;
 			adjCur->next = adjNew;
@@ -756,7 +2309,7 @@ int _buildPortals(PVS2D_BSPTreeNode* node, PVS2D_PortalStack* adjacent) {
 
 
 	// step 2 - now that we splitted adjacents (sorta), we need to add portals from our node
-	PVS2D_PortalStack* portals = _portalsOfNode(node);
+	PVS2D_PortalStack* portals = _portalsOfNode(ctx, node);
 	DBG_ASSERT(portals, -1, "Failed to create node's portals");
 	// the portals have the reverse order of node->line, so for the left subspace they will be counterclockwise
 
@@ -803,7 +2356,7 @@ int _buildPortals(PVS2D_BSPTreeNode* node, PVS2D_PortalStack* adjacent) {
 	}
 	// now just feed 'portals' to the recursion
 	if (node->right) {
-		_buildPortals(node->right, portals);
+		_buildPortals(ctx, node->right, portals);
 		// we should get kinda the same thing
 	}
 	else {
@@ -905,7 +2458,7 @@ int _buildPortals(PVS2D_BSPTreeNode* node, PVS2D_PortalStack* adjacent) {
 	// now we have tportals ready to be fed into left child
 
 	if (node->left) {
-		_buildPortals(node->left, tportals);
+		_buildPortals(ctx, node->left, tportals);
 	}
 	else {
 		for (PVS2D_PortalStack* prt = tportals; ; prt = prt->next) {
@@ -973,7 +2526,11 @@ int _buildPortals(PVS2D_BSPTreeNode* node, PVS2D_PortalStack* adjacent) {
 }
 
 int PVS2D_BuildPortals(PVS2D_BSPTreeNode* root) {
-	return _buildPortals(root, 0);
+	return _buildPortals(0, root, 0);
+}
+
+int PVS2D_BuildPortalsEx(PVS2D_Context* ctx, PVS2D_BSPTreeNode* root) {
+	return _buildPortals(ctx, root, 0);
 }
 
 unsigned int _findLeafCount(PVS2D_BSPTreeNode* node) {
@@ -985,7 +2542,9 @@ unsigned int _findLeafCount(PVS2D_BSPTreeNode* node) {
 		ret = node->leftLeaf;
 	}
 	if (node->right) {
-		ret = max(ret, _findLeafCount(node->right));
+		// not inside max, which would evaluate it twice
+		unsigned int right = _findLeafCount(node->right);
+		ret = max(ret, right);
 	}
 	else {
 		ret = max(ret, node->rightLeaf);
@@ -993,7 +2552,7 @@ unsigned int _findLeafCount(PVS2D_BSPTreeNode* node) {
 	return ret;
 }
 
-void _buildLeafGraphFromPortals(PVS2D_BSPTreeNode* node, PVS2D_LeafGraphNode* nodes) {
+void _buildLeafGraphFromPortals(PVS2D_Context* ctx, PVS2D_BSPTreeNode* node, PVS2D_LeafGraphNode* nodes) {
 	for (PVS2D_PortalStack* prt = node->portals; prt; prt = prt->next) {
 		if (prt->portal->seg.opq)
 			continue;		// we are interested only in transparent portals connecting leaves
@@ -1004,13 +2563,13 @@ void _buildLeafGraphFromPortals(PVS2D_BSPTreeNode* node, PVS2D_LeafGraphNode* no
 			nodes[lleaf].oob = 1;
 			nodes[rleaf].oob = 1;
 		}
-		PVS2D_LGEdgeStack* lElem = (PVS2D_LGEdgeStack*)malloc(sizeof(PVS2D_LGEdgeStack));
+		PVS2D_LGEdgeStack* lElem = (PVS2D_LGEdgeStack*)_alloc(ctx, sizeof(PVS2D_LGEdgeStack));
 		DBG_ASSERT(lElem, , "Failed to create leaf edge stack node");
 		lElem->prt = prt->portal;
 		lElem->node = nodes + rleaf;
 		lElem->next = nodes[lleaf].adjs;
 		nodes[lleaf].adjs = lElem;
-		PVS2D_LGEdgeStack* rElem = (PVS2D_LGEdgeStack*)malloc(sizeof(PVS2D_LGEdgeStack));
+		PVS2D_LGEdgeStack* rElem = (PVS2D_LGEdgeStack*)_alloc(ctx, sizeof(PVS2D_LGEdgeStack));
 		DBG_ASSERT(rElem, , "Failed to create leaf edge stack node");
 		rElem->prt = prt->portal;
 		rElem->node = nodes + lleaf;
@@ -1018,10 +2577,10 @@ void _buildLeafGraphFromPortals(PVS2D_BSPTreeNode* node, PVS2D_LeafGraphNode* no
 		nodes[rleaf].adjs = rElem;
 	}
 	if (node->left) {
-		_buildLeafGraphFromPortals(node->left, nodes);
+		_buildLeafGraphFromPortals(ctx, node->left, nodes);
 	}
 	if (node->right) {
-		_buildLeafGraphFromPortals(node->right, nodes);
+		_buildLeafGraphFromPortals(ctx, node->right, nodes);
 	}
 }
 
@@ -1037,12 +2596,16 @@ void _dfsTag(PVS2D_LeafGraphNode* node, char* tagged) {
 }
 
 PVS2D_LeafGraphNode* PVS2D_BuildLeafGraph(PVS2D_BSPTreeNode* root, unsigned int* nodesCDest) {
+	return PVS2D_BuildLeafGraphEx(0, root, nodesCDest);
+}
+
+PVS2D_LeafGraphNode* PVS2D_BuildLeafGraphEx(PVS2D_Context* ctx, PVS2D_BSPTreeNode* root, unsigned int* nodesCDest) {
 	DBG_ASSERT(root, 0, "'root' can't be nullptr");
 	DBG_ASSERT(nodesCDest, 0, "'nodesCDest' can't be nullptr");
 	int leafC = _findLeafCount(root) + 1;
 	// be aware of the fact that leaves count from 0
 	DBG_ASSERT(leafC, 0, "Incorrect BSP Tree data");
-	PVS2D_LeafGraphNode* nodes = (PVS2D_LeafGraphNode*)calloc(leafC, sizeof(PVS2D_LeafGraphNode));
+	PVS2D_LeafGraphNode* nodes = (PVS2D_LeafGraphNode*)_alloc(ctx, leafC * sizeof(PVS2D_LeafGraphNode));
 	DBG_ASSERT(nodes, 0, "Failed to create leaf graph nodes array");
 	*nodesCDest = leafC;
 	for (int i = 0; i < leafC; i++) {
@@ -1050,7 +2613,7 @@ PVS2D_LeafGraphNode* PVS2D_BuildLeafGraph(PVS2D_BSPTreeNode* root, unsigned int*
 		nodes[i].adjs = 0;
 		nodes[i].oob = 0;
 	}
-	_buildLeafGraphFromPortals(root, nodes);
+	_buildLeafGraphFromPortals(ctx, root, nodes);
 
 	// now we must spread oob tag
 	char* tagged = (char*)calloc(leafC, sizeof(char));
@@ -1073,88 +2636,118 @@ typedef struct _frustum {
 	double a1x, a1y, a2x, a2y, b1x, b1y, b2x, b2y;
 } _frustum;
 
-void _makeFrustumBetweenSegs(PVS2D_Seg* seg1, PVS2D_Seg* seg2, _frustum* frustum) {
-	DBG_ASSERT(!isinf(seg1->tStart), , "Input segments can't be infinite");
-	DBG_ASSERT(!isinf(seg2->tStart), , "Input segments can't be infinite");
-	DBG_ASSERT(!isinf(seg1->tEnd), , "Input segments can't be infinite");
-	DBG_ASSERT(!isinf(seg2->tEnd), , "Input segments can't be infinite");
-	frustum->a1x = seg1->line->ax + seg1->tStart * (seg1->line->bx - seg1->line->ax);
-	frustum->a1y = seg1->line->ay + seg1->tStart * (seg1->line->by - seg1->line->ay);
-	frustum->a2x = seg2->line->ax + seg2->tStart * (seg2->line->bx - seg2->line->ax);
-	frustum->a2y = seg2->line->ay + seg2->tStart * (seg2->line->by - seg2->line->ay);
-
-	frustum->b1x = seg1->line->ax + seg1->tEnd * (seg1->line->bx - seg1->line->ax);
-	frustum->b1y = seg1->line->ay + seg1->tEnd * (seg1->line->by - seg1->line->ay);
-	frustum->b2x = seg2->line->ax + seg2->tEnd * (seg2->line->bx - seg2->line->ax);
-	frustum->b2y = seg2->line->ay + seg2->tEnd * (seg2->line->by - seg2->line->ay);
-
-	// if b1 is to the right of a1a2 line -> swap a1 and b1
-	if (
-		(frustum->b1x - frustum->a1x) * (frustum->a2y - frustum->a1y) >
-		(frustum->b1y - frustum->a1y) * (frustum->a2x - frustum->a1x) + MATCH_TOLERANCE
-	) {
-		double t;
-		t = frustum->a1x;
-		frustum->a1x = frustum->b1x;
-		frustum->b1x = t;
-		t = frustum->a1y;
-		frustum->a1y = frustum->b1y;
-		frustum->b1y = t;
-	}
-	// if b2 is to the left of a1a2 line -> swap a2 and b2
-	if (
-		(frustum->b2x - frustum->a1x) * (frustum->a2y - frustum->a1y) <
-		(frustum->b2y - frustum->a1y) * (frustum->a2x - frustum->a1x) - MATCH_TOLERANCE
-	) {
-		double t;
-		t = frustum->a2x;
-		frustum->a2x = frustum->b2x;
-		frustum->b2x = t;
-		t = frustum->a2y;
-		frustum->a2y = frustum->b2y;
-		frustum->b2y = t;
+// the portal of an edge the way the CSR graph keeps it: its ends, the point (ox, oy), the direction
+// (dx, dy) and the normal (nx, ny) of its line, and its part [tStart, tEnd] of the line
+typedef struct _portalGeom {
+	double x1, y1, x2, y2, ox, oy, dx, dy, nx, ny, tStart, tEnd;
+} _portalGeom;
+
+static inline void _portalGeomOf(const PVS2D_Portal* prt, _portalGeom* g) {
+	const PVS2D_Line* line = prt->seg.line;
+	g->ox = line->ax;
+	g->oy = line->ay;
+	g->dx = line->bx - line->ax;
+	g->dy = line->by - line->ay;
+	g->nx = line->ay - line->by;
+	g->ny = line->bx - line->ax;
+	g->tStart = prt->seg.tStart;
+	g->tEnd = prt->seg.tEnd;
+	g->x1 = g->ox + g->tStart * g->dx;
+	g->y1 = g->oy + g->tStart * g->dy;
+	g->x2 = g->ox + g->tEnd * g->dx;
+	g->y2 = g->oy + g->tEnd * g->dy;
+}
+
+static inline void _portalGeomPoint(const _portalGeom* g, double t, double* x, double* y) {
+	if (t == g->tStart) {
+		*x = g->x1;
+		*y = g->y1;
+	}
+	else if (t == g->tEnd) {
+		*x = g->x2;
+		*y = g->y2;
+	}
+	else {
+		*x = g->ox + t * g->dx;
+		*y = g->oy + t * g->dy;
 	}
+}
 
-	// again
-	// if b1 is to the right of a1a2 line -> swap a1 and b1
-	if (
-		(frustum->b1x - frustum->a1x) * (frustum->a2y - frustum->a1y) >
-		(frustum->b1y - frustum->a1y) * (frustum->a2x - frustum->a1x) + MATCH_TOLERANCE
-	) {
-		double t;
-		t = frustum->a1x;
-		frustum->a1x = frustum->b1x;
-		frustum->b1x = t;
-		t = frustum->a1y;
-		frustum->a1y = frustum->b1y;
-		frustum->b1y = t;
-	}
-	// if b2 is to the left of a1a2 line -> swap a2 and b2
-	if (
-		(frustum->b2x - frustum->a1x) * (frustum->a2y - frustum->a1y) <
-		(frustum->b2y - frustum->a1y) * (frustum->a2x - frustum->a1x) - MATCH_TOLERANCE
-	) {
-		double t;
-		t = frustum->a2x;
-		frustum->a2x = frustum->b2x;
-		frustum->b2x = t;
-		t = frustum->a2y;
-		frustum->a2y = frustum->b2y;
-		frustum->b2y = t;
+// point of the portal of the edge at `t`, taken from the precomputed endpoints when it is one of them
+static inline void _portalPoint(const PVS2D_CSRLeafGraph* graph, unsigned int e, double t, double* x, double* y) {
+	if (t == graph->tStart[e]) {
+		*x = graph->x1[e];
+		*y = graph->y1[e];
+	}
+	else if (t == graph->tEnd[e]) {
+		*x = graph->x2[e];
+		*y = graph->y2[e];
+	}
+	else {
+		*x = graph->ox[e] + t * graph->dx[e];
+		*y = graph->oy[e] + t * graph->dy[e];
 	}
+}
 
-	// double check
-	if (
-		(frustum->b1x - frustum->a1x) * (frustum->a2y - frustum->a1y) >
-		(frustum->b1y - frustum->a1y) * (frustum->a2x - frustum->a1x) + MATCH_TOLERANCE
-	) {
-		printf("FUCK\n");
+static inline void _swapPoints(double* ax, double* ay, double* bx, double* by) {
+	double t;
+	t = *ax;
+	*ax = *bx;
+	*bx = t;
+	t = *ay;
+	*ay = *by;
+	*by = t;
+}
+
+// whether a1a2 has b1 to the left and b2 to the right, and b1b2 has a1 to the right and a2 to the left
+// (or on them), so the lines cross between the segments
+static inline char _frustumCrosses(const _frustum* frustum) {
+	return
+		_orient2d(frustum->a1x, frustum->a1y, frustum->a2x, frustum->a2y, frustum->b1x, frustum->b1y) >= 0 &&
+		_orient2d(frustum->a1x, frustum->a1y, frustum->a2x, frustum->a2y, frustum->b2x, frustum->b2y) <= 0 &&
+		_orient2d(frustum->b1x, frustum->b1y, frustum->b2x, frustum->b2y, frustum->a1x, frustum->a1y) <= 0 &&
+		_orient2d(frustum->b1x, frustum->b1y, frustum->b2x, frustum->b2y, frustum->a2x, frustum->a2y) >= 0;
+}
+
+// turns the ends a1, b1 of one segment and a2, b2 of the other into the frustum between them
+static void _orderFrustum(_frustum* frustum) {
+	// the line a1a2 must have b1 to the left and b2 to the right (or on it).
+	// if b1 is to the right of a1a2 line -> swap a1 and b1,
+	// if b2 is to the left of a1a2 line -> swap a2 and b2. twice, as each swap moves the line
+	for (int round = 0; round < 2; round++) {
+		if (_orient2d(frustum->a1x, frustum->a1y, frustum->a2x, frustum->a2y, frustum->b1x, frustum->b1y) < 0) {
+			_swapPoints(&frustum->a1x, &frustum->a1y, &frustum->b1x, &frustum->b1y);
+		}
+		if (_orient2d(frustum->a1x, frustum->a1y, frustum->a2x, frustum->a2y, frustum->b2x, frustum->b2y) > 0) {
+			_swapPoints(&frustum->a2x, &frustum->a2y, &frustum->b2x, &frustum->b2y);
+		}
+	}
+	if (_frustumCrosses(frustum)) return;
+	// when an end of one segment is on the line of the other, a1a2 fits with either end of it,
+	// and b1b2 may then be the line past both segments, cutting off the ones seen between them.
+	// take the pair of ends for which both lines fit
+	for (int k = 0; k < 4; k++) {
+		_swapPoints(&frustum->a1x, &frustum->a1y, &frustum->b1x, &frustum->b1y);
+		if (k & 1) _swapPoints(&frustum->a2x, &frustum->a2y, &frustum->b2x, &frustum->b2y);
+		if (_frustumCrosses(frustum)) return;
 	}
 	if (
-		(frustum->b2x - frustum->a1x) * (frustum->a2y - frustum->a1y) <
-		(frustum->b2y - frustum->a1y) * (frustum->a2x - frustum->a1x) - MATCH_TOLERANCE
+		_orient2d(frustum->a1x, frustum->a1y, frustum->a2x, frustum->a2y, frustum->b1x, frustum->b1y) < 0 ||
+		_orient2d(frustum->a1x, frustum->a1y, frustum->a2x, frustum->a2y, frustum->b2x, frustum->b2y) > 0
 	) {
-		printf("FUCK 2\n");
+		// the swaps went in circles, which happens only when the segments touch or overlap.
+		// take the first of the four lines between their ends that fits
+		for (int k = 0; k < 4; k++) {
+			_swapPoints(&frustum->a1x, &frustum->a1y, &frustum->b1x, &frustum->b1y);
+			if (k & 1) _swapPoints(&frustum->a2x, &frustum->a2y, &frustum->b2x, &frustum->b2y);
+			if (
+				_orient2d(frustum->a1x, frustum->a1y, frustum->a2x, frustum->a2y, frustum->b1x, frustum->b1y) >= 0 &&
+				_orient2d(frustum->a1x, frustum->a1y, frustum->a2x, frustum->a2y, frustum->b2x, frustum->b2y) <= 0
+			) {
+				break;
+			}
+		}
+		// all the ends are collinear otherwise, and any of them will do
 	}
 	//// the dot product here
 	//if (
@@ -1198,104 +2791,2343 @@ void _makeFrustumBetweenSegs(PVS2D_Seg* seg1, PVS2D_Seg* seg2, _frustum* frustum
 	//}
 }
 
-// here you might end up with the fact that tStart > tEnd, which is kinda mathematically correct
-// you might also end up with one or two of them being inf. that is also mathematically correct
-// lastly, if line is ON the line of frustrum, you'll get nans
-// god bless float-point arithmetics
-void _cropLineByFrustum(PVS2D_Line* line, _frustum* frustum, double* tStartDest, double* tEndDest) {
-	*tStartDest = -INFINITY;
-	*tEndDest = INFINITY;
-	
-	double tAn, tAd, tBn, tBd;
-	_intersectF(
-		frustum->a1x, frustum->a1y, frustum->a2x, frustum->a2y, 
-		line->ax, line->ay, line->bx, line->by, &tAn, &tAd
-	);
-	_intersectF(
-		frustum->b1x, frustum->b1y, frustum->b2x, frustum->b2y,
-		line->ax, line->ay, line->bx, line->by, &tBn, &tBd
-	);
-	// now we must determine which part of line is inside the frustum
-	if (fabs(tAd) > MATCH_TOLERANCE) {
-		if (tAd < 0) {
-			// line goes to the right relatively to frustrum's lineA
-			*tEndDest = min(*tEndDest, tAn / tAd);
-		}
-		else {
-			*tStartDest = max(*tStartDest, tAn / tAd);
-		}
-	}
-	if (fabs(tBd) > MATCH_TOLERANCE) {
-		if (tBd < 0) {
-			*tStartDest = max(*tStartDest, tBn / tBd);
-		}
-		else {
-			*tEndDest = min(*tEndDest, tBn / tBd);
-		}
-	}
+// the segments are the parts [tStart1, tEnd1] and [tStart2, tEnd2] of the portals of the edges
+void _makeFrustumBetweenSegs(
+	const PVS2D_CSRLeafGraph* graph,
+	unsigned int prt1, double tStart1, double tEnd1,
+	unsigned int prt2, double tStart2, double tEnd2,
+	_frustum* frustum
+) {
+	DBG_ASSERT(!isinf(tStart1), , "Input segments can't be infinite");
+	DBG_ASSERT(!isinf(tStart2), , "Input segments can't be infinite");
+	DBG_ASSERT(!isinf(tEnd1), , "Input segments can't be infinite");
+	DBG_ASSERT(!isinf(tEnd2), , "Input segments can't be infinite");
+	_portalPoint(graph, prt1, tStart1, &frustum->a1x, &frustum->a1y);
+	_portalPoint(graph, prt2, tStart2, &frustum->a2x, &frustum->a2y);
+	_portalPoint(graph, prt1, tEnd1, &frustum->b1x, &frustum->b1y);
+	_portalPoint(graph, prt2, tEnd2, &frustum->b2x, &frustum->b2y);
+	_orderFrustum(frustum);
+}
 
+// the same as _makeFrustumBetweenSegs, for the portals of the linked leaf graph
+static void _makeFrustumBetweenGeoms(
+	const _portalGeom* prt1, double tStart1, double tEnd1,
+	const _portalGeom* prt2, double tStart2, double tEnd2,
+	_frustum* frustum
+) {
+	_portalGeomPoint(prt1, tStart1, &frustum->a1x, &frustum->a1y);
+	_portalGeomPoint(prt2, tStart2, &frustum->a2x, &frustum->a2y);
+	_portalGeomPoint(prt1, tEnd1, &frustum->b1x, &frustum->b1y);
+	_portalGeomPoint(prt2, tEnd2, &frustum->b2x, &frustum->b2y);
+	_orderFrustum(frustum);
 }
 
-typedef struct _frustumStack {
-	struct _frustum* frustum;
-	struct _frustumStack* next;
-} _frustumStack;
+// a line bounding the area seen along the path, going from the previous portal to the next.
+// the area is to the right of it for the `a` lines of the frustums and to the left for the `b`
+typedef struct _pvsBound {
+	double x1, y1, x2, y2;
+	char left;
+} _pvsBound;
 
-void _dfsPVSCalc(PVS2D_LeafGraphNode* node, PVS2D_Seg* prevSeg, _frustumStack* frs, char* visited, char* pvs) {
-	pvs[node->leaf] = 1;
-	for (PVS2D_LGEdgeStack* edge = node->adjs; edge; edge = edge->next) {
-		if (!prevSeg) {
-			// we are at root node
-			// all neighboor nodes are visible from root
-			visited[edge->node->leaf] = 1;
-			_dfsPVSCalc(edge->node, &edge->prt->seg, frs, visited, pvs);
-			visited[edge->node->leaf] = 0;
-		}
-		else {
-			if (!visited[edge->node->leaf]) {
-				// go through all of the frustums in frs and crop the segment accordingly
-				double tStart = edge->prt->seg.tStart, tEnd = edge->prt->seg.tEnd;
-				char ok = 1;
-				for (_frustumStack* fr = frs; fr; fr = fr->next) {
-					double ttStart = 0, ttEnd = 0;
-					_cropLineByFrustum(edge->prt->seg.line, fr->frustum, &ttStart, &ttEnd);
-					tStart = max(tStart, ttStart);
-					tEnd = min(tEnd, ttEnd);
-					if (tStart > tEnd + MATCH_TOLERANCE) {
-						// it's not intersecting it anymore
-						ok = 0;
-						break;
-					}
-				}
-				if (ok) {
-					// we can go here
-
-					// create new frustum and put it into stack
-					// since we are using recursion, we can just 
-					// allocate it on stack, and be fine with it
-					_frustum newFrustum = { 0 };
-					_makeFrustumBetweenSegs(prevSeg, &edge->prt->seg, &newFrustum);
-					_frustumStack newNode = { 0 };
-					newNode.frustum = &newFrustum;
-					newNode.next = frs;
-					visited[edge->node->leaf] = 1;
-					_dfsPVSCalc(edge->node, &edge->prt->seg, &newNode, visited, pvs);
-					visited[edge->node->leaf] = 0;
-					// no need to delete anything since we allocated on stack :)
-				}
-			}
-		}
+// crops the portal of the edge to the side of the bound the area is on. which of its ends are
+// inside is decided exactly, so a portal parallel to the bound is either all in or all out,
+// and one touching it is cropped to the point it touches it at
+static inline void _cropGeomByBound(const _portalGeom* g, const _pvsBound* bound, double* tStart, double* tEnd) {
+	int s1 = _orient2d(bound->x1, bound->y1, bound->x2, bound->y2, g->x1, g->y1);
+	int s2 = _orient2d(bound->x1, bound->y1, bound->x2, bound->y2, g->x2, g->y2);
+	if (!bound->left) {
+		s1 = -s1;
+		s2 = -s2;
+	}
+	if (s1 >= 0 && s2 >= 0) return;
+	if (s1 < 0 && s2 < 0) {
+		*tStart = INFINITY;
+		return;
 	}
+	// the ends are on the different sides, so the crossing is inside the portal.
+	// the rounded one is kept inside too, and the end on the bound is taken as is
+	double t;
+	if (s1 < 0 ? s2 == 0 : s1 == 0) {
+		t = s1 < 0 ? g->tEnd : g->tStart;
+	}
+	else {
+		double bdx = bound->x2 - bound->x1, bdy = bound->y2 - bound->y1;
+		double tn = bdx * (g->oy - bound->y1) - bdy * (g->ox - bound->x1);
+		double td = bdx * g->nx + bdy * g->ny;
+		t = tn / td;
+		// a nan crops nothing
+		if (!(t >= g->tStart)) t = s1 < 0 ? g->tStart : g->tEnd;
+		if (t > g->tEnd) t = g->tEnd;
+	}
+	if (s1 < 0) *tStart = max(*tStart, t);
+	else *tEnd = min(*tEnd, t);
 }
 
-char* PVS2D_GetLeafPVS(PVS2D_LeafGraphNode* node, unsigned int leafC) {
-	DBG_ASSERT(!node->oob, 0, "Can't build PVS of Out-Of-Bounds node");
-	char* visited = (char*)calloc(leafC, sizeof(char));
-	DBG_ASSERT(visited, 0, "Failed to create array of visited nodes");
-	char* pvs = (char*)calloc(leafC, sizeof(char));
-	DBG_ASSERT(pvs, 0, "Failed to create PVS array");
-	visited[node->leaf] = 1;
-	_dfsPVSCalc(node, 0, 0, visited, pvs);
-	free(visited);
-	return pvs;
+// the same for the portal of the edge of the CSR graph
+static inline void _cropPortalByBound(const PVS2D_CSRLeafGraph* graph, unsigned int e, const _pvsBound* bound, double* tStart, double* tEnd) {
+	_portalGeom g = {
+		graph->x1[e], graph->y1[e], graph->x2[e], graph->y2[e], graph->ox[e], graph->oy[e],
+		graph->dx[e], graph->dy[e], graph->nx[e], graph->ny[e], graph->tStart[e], graph->tEnd[e]
+	};
+	_cropGeomByBound(&g, bound, tStart, tEnd);
+}
+
+// whether the bound `by` is tighter than `bound` everywhere past the portal `by` ends on.
+// both are on the same side, and the area past the portal is all that is ever looked at
+// through it, so then `bound` doesn't crop anything anymore. decided exactly
+static char _boundDominated(const _pvsBound* bound, const _pvsBound* by) {
+	// they must look the same way. the dot product is the cross product with `by` turned
+	// clockwise, and has the opposite sign
+	if (_crossSign(bound->x2, bound->y2, bound->x1, bound->y1, by->y2, by->x1, by->y1, by->x2) >= 0) return 0;
+	// `by` must be turned inwards (or be parallel), so it stays tighter far away
+	int turn = _crossSign(bound->x2, bound->y2, bound->x1, bound->y1, by->x2, by->y2, by->x1, by->y1);
+	// and be inside (or on `bound`) on the portal
+	int inside = _orient2d(bound->x1, bound->y1, bound->x2, bound->y2, by->x2, by->y2);
+	if (bound->left) return turn >= 0 && inside >= 0;
+	return turn <= 0 && inside <= 0;
+}
+
+// one level of the PVS traversal: the leaf, the next of its edges to try,
+// the edge through which the leaf was entered and the cropped part [tStart, tEnd] of its portal,
+// and the bounds [bounds, bounds + boundsC) of the area its neighbours are seen through
+typedef struct _pvsFrame {
+	unsigned int leaf, edge, prt;
+	double tStart, tEnd;
+	unsigned int bounds, boundsC;
+} _pvsFrame;
+
+// explicit stack of the PVS traversal. a path never visits a leaf twice, so depth never
+// exceeds leafC. the area seen along the path is the intersection of the frustums between
+// its consecutive portals, and is kept as the bounding lines of those that still crop
+// anything past the last portal. most get overtaken by the newer ones right away,
+// so every frame holds a few bounds, and the portals are cropped by just them.
+// can be reused between traversals
+typedef struct _pvsStack {
+	_pvsFrame* frames;
+	unsigned int cap;
+	_pvsBound* bounds;
+	unsigned int boundsCap;
+} _pvsStack;
+
+// makes sure the stack can hold `depth` frames and `boundsC` bounds
+static int _pvsStackReserve(_pvsStack* st, unsigned int depth, unsigned int boundsC) {
+	if (depth > st->cap) {
+		unsigned int cap = st->cap ? st->cap : 64;
+		while (cap < depth) cap *= 2;
+		_pvsFrame* frames = (_pvsFrame*)realloc(st->frames, cap * sizeof(_pvsFrame));
+		DBG_ASSERT(frames, -1, "Failed to grow PVS traversal stack");
+		// the old frames stay valid, and are freed with the stack
+		if (!frames) return -1;
+		st->frames = frames;
+		st->cap = cap;
+	}
+	if (boundsC > st->boundsCap) {
+		unsigned int cap = st->boundsCap ? st->boundsCap : 256;
+		while (cap < boundsC) cap *= 2;
+		_pvsBound* bounds = (_pvsBound*)realloc(st->bounds, cap * sizeof(_pvsBound));
+		DBG_ASSERT(bounds, -1, "Failed to grow frustum stack");
+		if (!bounds) return -1;
+		st->bounds = bounds;
+		st->boundsCap = cap;
+	}
+	return 0;
+}
+
+static void _pvsStackFree(_pvsStack* st) {
+	free(st->frames);
+	free(st->bounds);
+	st->frames = 0;
+	st->bounds = 0;
+	st->cap = 0;
+	st->boundsCap = 0;
+}
+
+// depth first search over the leaf graph from the source, going only through portals that
+// can be seen through all the previous ones on the path. visited must contain the source
+// (and the leaves not to be entered), and is left the same way.
+// if `found` is given, the leaves newly added to pvs are appended to it
+int _dfsPVSCalc(
+	const PVS2D_CSRLeafGraph* graph, unsigned int source, _pvsStack* st,
+	PVS2D_BitsetWord* visited, PVS2D_BitsetWord* pvs, unsigned int* found, unsigned int* foundC
+) {
+	if (_pvsStackReserve(st, 2, 0)) return -1;
+	if (found && !PVS2D_BitsetTest(pvs, source)) found[(*foundC)++] = source;
+	PVS2D_BitsetSet(pvs, source);
+	st->frames[0].leaf = source;
+	st->frames[0].edge = graph->adjStart[source];
+	st->frames[0].bounds = 0;
+	st->frames[0].boundsC = 0;
+	unsigned int depth = 0;
+	while (1) {
+		_pvsFrame* frame = st->frames + depth;
+		if (frame->edge == graph->adjStart[frame->leaf + 1]) {
+			// all edges are done, go back
+			if (depth == 0) break;
+			PVS2D_BitsetClear(visited, frame->leaf);
+			depth--;
+			continue;
+		}
+		unsigned int prt = frame->edge++;
+		unsigned int next = graph->leaf[prt];
+
+		double tStart = graph->tStart[prt], tEnd = graph->tEnd[prt];
+		unsigned int bounds = frame->bounds + frame->boundsC, boundsC = 0;
+		if (depth > 0) {
+			if (PVS2D_BitsetTest(visited, next)) continue;
+			// crop the segment by the area seen along the path
+			char ok = 1;
+			for (unsigned int i = frame->bounds; i < frame->bounds + frame->boundsC; i++) {
+				_cropPortalByBound(graph, prt, st->bounds + i, &tStart, &tEnd);
+				if (tStart > tEnd) {
+					// it's not intersecting it anymore
+					ok = 0;
+					break;
+				}
+			}
+			if (!ok) continue;
+
+			// only the cropped part of the portal can be seen through the previous ones,
+			// so pass on just it. that keeps the following frustums as narrow as possible.
+			// a portal touched at a single point passes on just it
+
+			// create new frustum, and put its lines along with the bounds it doesn't
+			// overtake on top of the stack
+			_frustum frustum;
+			_makeFrustumBetweenSegs(graph, frame->prt, frame->tStart, frame->tEnd, prt, tStart, tEnd, &frustum);
+			_pvsBound a = { frustum.a1x, frustum.a1y, frustum.a2x, frustum.a2y, 0 };
+			_pvsBound b = { frustum.b1x, frustum.b1y, frustum.b2x, frustum.b2y, 1 };
+			if (_pvsStackReserve(st, 0, bounds + frame->boundsC + 2)) return -1;
+			// newest bounds go first, as they are the narrowest
+			st->bounds[bounds + boundsC++] = a;
+			st->bounds[bounds + boundsC++] = b;
+			for (unsigned int i = frame->bounds; i < frame->bounds + frame->boundsC; i++) {
+				_pvsBound* bound = st->bounds + i;
+				if (_boundDominated(bound, bound->left ? &b : &a)) continue;
+				st->bounds[bounds + boundsC++] = *bound;
+			}
+		}
+		// else we are at root node
+		// all neighboor nodes are visible from root
+
+		if (_pvsStackReserve(st, depth + 2, 0)) return -1;
+		depth++;
+		frame = st->frames + depth;
+		frame->leaf = next;
+		frame->edge = graph->adjStart[next];
+		frame->prt = prt;
+		frame->tStart = tStart;
+		frame->tEnd = tEnd;
+		frame->bounds = bounds;
+		frame->boundsC = boundsC;
+		PVS2D_BitsetSet(visited, next);
+		if (found && !PVS2D_BitsetTest(pvs, next)) found[(*foundC)++] = next;
+		PVS2D_BitsetSet(pvs, next);
+	}
+	return 0;
+}
+
+// a level of the traversal of the linked leaf graph, the same as _pvsFrame
+typedef struct _pvsLinkedFrame {
+	PVS2D_LeafGraphNode* node;
+	PVS2D_LGEdgeStack* edge;
+	_portalGeom prt;
+	double tStart, tEnd;
+	unsigned int bounds, boundsC;
+} _pvsLinkedFrame;
+
+// the same as _dfsPVSCalc, but over the linked leaf graph, so a single query doesn't have to
+// build the CSR one first. `frames` must hold as many frames as there are leaves,
+// only the bounds of `st` are used
+static int _dfsPVSCalcLinked(
+	PVS2D_LeafGraphNode* source, _pvsLinkedFrame* frames, _pvsStack* st,
+	PVS2D_BitsetWord* visited, PVS2D_BitsetWord* pvs
+) {
+	PVS2D_BitsetSet(pvs, source->leaf);
+	frames[0].node = source;
+	frames[0].edge = source->adjs;
+	frames[0].bounds = 0;
+	frames[0].boundsC = 0;
+	unsigned int depth = 0;
+	while (1) {
+		_pvsLinkedFrame* frame = frames + depth;
+		PVS2D_LGEdgeStack* edge = frame->edge;
+		if (!edge) {
+			// all edges are done, go back
+			if (depth == 0) break;
+			PVS2D_BitsetClear(visited, frame->node->leaf);
+			depth--;
+			continue;
+		}
+		frame->edge = edge->next;
+		PVS2D_LeafGraphNode* next = edge->node;
+		if (depth > 0 && PVS2D_BitsetTest(visited, next->leaf)) continue;
+
+		_portalGeom prt;
+		_portalGeomOf(edge->prt, &prt);
+		double tStart = prt.tStart, tEnd = prt.tEnd;
+		unsigned int bounds = frame->bounds + frame->boundsC, boundsC = 0;
+		if (depth > 0) {
+			char ok = 1;
+			for (unsigned int i = frame->bounds; i < frame->bounds + frame->boundsC; i++) {
+				_cropGeomByBound(&prt, st->bounds + i, &tStart, &tEnd);
+				if (tStart > tEnd) {
+					ok = 0;
+					break;
+				}
+			}
+			if (!ok) continue;
+
+			_frustum frustum;
+			_makeFrustumBetweenGeoms(&frame->prt, frame->tStart, frame->tEnd, &prt, tStart, tEnd, &frustum);
+			_pvsBound a = { frustum.a1x, frustum.a1y, frustum.a2x, frustum.a2y, 0 };
+			_pvsBound b = { frustum.b1x, frustum.b1y, frustum.b2x, frustum.b2y, 1 };
+			if (_pvsStackReserve(st, 0, bounds + frame->boundsC + 2)) return -1;
+			st->bounds[bounds + boundsC++] = a;
+			st->bounds[bounds + boundsC++] = b;
+			for (unsigned int i = frame->bounds; i < frame->bounds + frame->boundsC; i++) {
+				_pvsBound* bound = st->bounds + i;
+				if (_boundDominated(bound, bound->left ? &b : &a)) continue;
+				st->bounds[bounds + boundsC++] = *bound;
+			}
+		}
+
+		depth++;
+		frame = frames + depth;
+		frame->node = next;
+		frame->edge = next->adjs;
+		frame->prt = prt;
+		frame->tStart = tStart;
+		frame->tEnd = tEnd;
+		frame->bounds = bounds;
+		frame->boundsC = boundsC;
+		PVS2D_BitsetSet(visited, next->leaf);
+		PVS2D_BitsetSet(pvs, next->leaf);
+	}
+	return 0;
+}
+
+static void _countLeafGraph(PVS2D_LeafGraphNode* graph, unsigned int leafC, unsigned int* edgesC) {
+	*edgesC = 0;
+	for (unsigned int i = 0; i < leafC; i++) {
+		for (PVS2D_LGEdgeStack* edge = graph[i].adjs; edge; edge = edge->next) (*edgesC)++;
+	}
+}
+
+int PVS2D_BuildCSRLeafGraph(PVS2D_Context* ctx, PVS2D_LeafGraphNode* graph, unsigned int leafC, PVS2D_CSRLeafGraph* dest) {
+	DBG_ASSERT(graph, -1, "'graph' can't be nullptr");
+	DBG_ASSERT(dest, -1, "'dest' can't be nullptr");
+	unsigned int edgesC;
+	_countLeafGraph(graph, leafC, &edgesC);
+	// the arrays of doubles go first, so they are aligned
+	double** arrays[] = {
+		&dest->x1, &dest->y1, &dest->x2, &dest->y2, &dest->ox, &dest->oy,
+		&dest->dx, &dest->dy, &dest->nx, &dest->ny, &dest->tStart, &dest->tEnd
+	};
+	unsigned int arraysC = sizeof(arrays) / sizeof(arrays[0]);
+	size_t arraySize = (size_t)edgesC * sizeof(double);
+	size_t leafSize = (size_t)edgesC * sizeof(unsigned int);
+	size_t startSize = ((size_t)leafC + 1) * sizeof(unsigned int);
+	unsigned char* block = (unsigned char*)_alloc(ctx, arraysC * arraySize + 2 * leafSize + startSize + leafC);
+	DBG_ASSERT(block, -1, "Failed to create CSR leaf graph");
+	for (unsigned int i = 0; i < arraysC; i++) {
+		*arrays[i] = (double*)(block + i * arraySize);
+	}
+	block += arraysC * arraySize;
+	dest->leafC = leafC;
+	dest->leaf = (unsigned int*)block;
+	dest->door = (unsigned int*)(block + leafSize);
+	dest->adjStart = (unsigned int*)(block + 2 * leafSize);
+	dest->oob = block + 2 * leafSize + startSize;
+	unsigned int e = 0;
+	for (unsigned int i = 0; i < leafC; i++) {
+		dest->adjStart[i] = e;
+		dest->oob[i] = (unsigned char)graph[i].oob;
+		for (PVS2D_LGEdgeStack* edge = graph[i].adjs; edge; edge = edge->next, e++) {
+			_portalGeom g;
+			_portalGeomOf(edge->prt, &g);
+			dest->leaf[e] = edge->node->leaf;
+			dest->door[e] = edge->prt->seg.door;
+			dest->x1[e] = g.x1;
+			dest->y1[e] = g.y1;
+			dest->x2[e] = g.x2;
+			dest->y2[e] = g.y2;
+			dest->ox[e] = g.ox;
+			dest->oy[e] = g.oy;
+			dest->dx[e] = g.dx;
+			dest->dy[e] = g.dy;
+			dest->nx[e] = g.nx;
+			dest->ny[e] = g.ny;
+			dest->tStart[e] = g.tStart;
+			dest->tEnd[e] = g.tEnd;
+		}
+	}
+	dest->adjStart[leafC] = e;
+	return 0;
+}
+
+PVS2D_BitsetWord* PVS2D_GetLeafPVSBitsCSR(const PVS2D_CSRLeafGraph* graph, unsigned int leaf) {
+	DBG_ASSERT(graph, 0, "'graph' can't be nullptr");
+	DBG_ASSERT(!graph->oob[leaf], 0, "Can't build PVS of Out-Of-Bounds node");
+	unsigned int wordsC = PVS2D_BITSET_WORDS(graph->leafC);
+	PVS2D_BitsetWord* visited = (PVS2D_BitsetWord*)calloc(wordsC, sizeof(PVS2D_BitsetWord));
+	PVS2D_BitsetWord* pvs = (PVS2D_BitsetWord*)calloc(wordsC, sizeof(PVS2D_BitsetWord));
+	_pvsStack st = { 0 };
+	int rez = -1;
+	if (visited && pvs) {
+		PVS2D_BitsetSet(visited, leaf);
+		rez = _dfsPVSCalc(graph, leaf, &st, visited, pvs, 0, 0);
+	}
+	if (rez) {
+		free(pvs);
+		pvs = 0;
+	}
+	_pvsStackFree(&st);
+	free(visited);
+	return pvs;
+}
+
+struct PVS2D_PVSWorkspaceState {
+	// both are all zeros between the queries
+	PVS2D_BitsetWord* visited;
+	PVS2D_BitsetWord* pvs;
+	_pvsStack st;
+};
+
+int PVS2D_InitPVSWorkspace(unsigned int leafC, PVS2D_PVSWorkspace* dest) {
+	DBG_ASSERT(dest, -1, "'dest' can't be nullptr");
+	memset(dest, 0, sizeof(PVS2D_PVSWorkspace));
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC);
+	struct PVS2D_PVSWorkspaceState* state = (struct PVS2D_PVSWorkspaceState*)calloc(1, sizeof(struct PVS2D_PVSWorkspaceState));
+	DBG_ASSERT(state, -1, "Failed to allocate workspace state");
+	if (!state) return -1;
+	dest->state = state;
+	dest->leafC = leafC;
+	dest->leaves = (unsigned int*)malloc(((size_t)leafC + 1) * sizeof(unsigned int));
+	state->visited = (PVS2D_BitsetWord*)calloc((size_t)wordsC + 1, sizeof(PVS2D_BitsetWord));
+	state->pvs = (PVS2D_BitsetWord*)calloc((size_t)wordsC + 1, sizeof(PVS2D_BitsetWord));
+	// a path never visits a leaf twice, and a flood keeps two bounds per frame,
+	// so PVS2D_FloodFromPoint never has to grow the stack
+	if (!dest->leaves || !state->visited || !state->pvs || _pvsStackReserve(&state->st, leafC + 1, 2 * leafC + 2)) {
+		PVS2D_FreePVSWorkspace(dest);
+		return -1;
+	}
+	return 0;
+}
+
+void PVS2D_FreePVSWorkspace(PVS2D_PVSWorkspace* ws) {
+	if (!ws) return;
+	if (ws->state) {
+		free(ws->state->visited);
+		free(ws->state->pvs);
+		_pvsStackFree(&ws->state->st);
+		free(ws->state);
+	}
+	free(ws->leaves);
+	memset(ws, 0, sizeof(PVS2D_PVSWorkspace));
+}
+
+int PVS2D_GetLeafPVSInto(const PVS2D_CSRLeafGraph* graph, unsigned int leaf, PVS2D_PVSWorkspace* ws, char* out) {
+	DBG_ASSERT(graph && ws && ws->state, -1, "'graph' and 'ws' can't be nullptr");
+	DBG_ASSERT(graph->leafC <= ws->leafC, -1, "The workspace is too small for the graph");
+	DBG_ASSERT(leaf < graph->leafC, -1, "Leaf index is out of range");
+	struct PVS2D_PVSWorkspaceState* state = ws->state;
+	// only the leaves of the previous query are set in the output
+	if (out) {
+		for (unsigned int i = 0; i < ws->leavesC; i++) out[ws->leaves[i]] = 0;
+	}
+	ws->leavesC = 0;
+	DBG_ASSERT(!graph->oob[leaf], -1, "Can't build PVS of Out-Of-Bounds node");
+	if (graph->oob[leaf]) return -1;
+	PVS2D_BitsetSet(state->visited, leaf);
+	int rez = _dfsPVSCalc(graph, leaf, &state->st, state->visited, state->pvs, ws->leaves, &ws->leavesC);
+	PVS2D_BitsetClear(state->visited, leaf);
+	for (unsigned int i = 0; i < ws->leavesC; i++) {
+		PVS2D_BitsetClear(state->pvs, ws->leaves[i]);
+		if (out) out[ws->leaves[i]] = 1;
+	}
+	if (rez) {
+		// the traversal stopped halfway, and could have left some leaves visited
+		memset(state->visited, 0, PVS2D_BITSET_WORDS(ws->leafC) * sizeof(PVS2D_BitsetWord));
+	}
+	return rez;
+}
+
+PVS2D_BitsetWord* PVS2D_GetLeafPVSBits(PVS2D_LeafGraphNode* node, unsigned int leafC) {
+	DBG_ASSERT(!node->oob, 0, "Can't build PVS of Out-Of-Bounds node");
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC);
+	PVS2D_BitsetWord* visited = (PVS2D_BitsetWord*)calloc(wordsC, sizeof(PVS2D_BitsetWord));
+	PVS2D_BitsetWord* pvs = (PVS2D_BitsetWord*)calloc(wordsC, sizeof(PVS2D_BitsetWord));
+	// a path never visits a leaf twice
+	_pvsLinkedFrame* frames = (_pvsLinkedFrame*)malloc((size_t)leafC * sizeof(_pvsLinkedFrame));
+	_pvsStack st = { 0 };
+	int rez = -1;
+	if (visited && pvs && frames) {
+		PVS2D_BitsetSet(visited, node->leaf);
+		rez = _dfsPVSCalcLinked(node, frames, &st, visited, pvs);
+	}
+	if (rez) {
+		free(pvs);
+		pvs = 0;
+	}
+	_pvsStackFree(&st);
+	free(frames);
+	free(visited);
+	return pvs;
+}
+
+char* PVS2D_GetLeafPVS(PVS2D_LeafGraphNode* node, unsigned int leafC) {
+	PVS2D_BitsetWord* bits = PVS2D_GetLeafPVSBits(node, leafC);
+	DBG_ASSERT(bits, 0, "Failed to build PVS");
+	char* pvs = (char*)malloc(leafC * sizeof(char));
+	DBG_ASSERT(pvs, 0, "Failed to create PVS array");
+	for (unsigned int i = 0; i < leafC; i++) {
+		pvs[i] = (char)PVS2D_BitsetTest(bits, i);
+	}
+	free(bits);
+	return pvs;
+}
+
+static inline unsigned int _popcount(PVS2D_BitsetWord x) {
+#if defined(__GNUC__) || defined(__clang__)
+	return (unsigned int)__builtin_popcountll(x);
+#else
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (unsigned int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// index of the lowest set bit, x must not be 0
+static inline unsigned int _ctz(PVS2D_BitsetWord x) {
+#if defined(__GNUC__) || defined(__clang__)
+	return (unsigned int)__builtin_ctzll(x);
+#else
+	unsigned int i = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+// sources of the memoized mode go in rounds of this many. a round only uses the rows of the
+// previous ones, so the result doesn't depend on the number of threads
+#define PVS_ROUND_SIZE 64
+
+typedef struct _allPVS {
+	const PVS2D_CSRLeafGraph* graph;
+	unsigned int wordsC;
+	PVS2D_BitsetWord* out;
+	// visited bitsets of every thread, `wordsC` words each
+	PVS2D_BitsetWord* visited;
+	// traversal stacks of every thread
+	_pvsStack* stacks;
+	// memoized mode only: the order of the sources, position of every leaf in it,
+	// how many sources were done in the previous rounds and the bitset of them
+	unsigned int* order;
+	unsigned int* rank;
+	unsigned int doneC;
+	PVS2D_BitsetWord* done;
+	// transposed matrix of the done rows: the leaves that see the given one
+	PVS2D_BitsetWord* seenBy;
+	// set by any thread whose traversal failed
+	volatile char failed;
+} _allPVS;
+
+static void _allPVSBody(void* data, unsigned int thread, unsigned int leaf) {
+	_allPVS* all = (_allPVS*)data;
+	PVS2D_BitsetWord* pvs = all->out + (size_t)leaf * all->wordsC;
+	memset(pvs, 0, all->wordsC * sizeof(PVS2D_BitsetWord));
+	if (all->graph->oob[leaf]) return;
+	// the dfs leaves visited as it was, so only the source needs to be cleared afterwards
+	PVS2D_BitsetWord* visited = all->visited + (size_t)thread * all->wordsC;
+	PVS2D_BitsetSet(visited, leaf);
+	if (_dfsPVSCalc(all->graph, leaf, all->stacks + thread, visited, pvs, 0, 0)) all->failed = 1;
+	PVS2D_BitsetClear(visited, leaf);
+}
+
+// same as _allPVSBody, but the pairs with the done leaves were already decided by them.
+// so the done leaves that don't see the source, and everything behind them, are not
+// looked at: they are marked as visited beforehand, and the dfs never enters them
+static void _allPVSMemoBody(void* data, unsigned int thread, unsigned int index) {
+	_allPVS* all = (_allPVS*)data;
+	unsigned int leaf = all->order[all->doneC + index];
+	PVS2D_BitsetWord* pvs = all->out + (size_t)leaf * all->wordsC;
+	PVS2D_BitsetWord* seenBy = all->seenBy + (size_t)leaf * all->wordsC;
+	PVS2D_BitsetWord* visited = all->visited + (size_t)thread * all->wordsC;
+	for (unsigned int w = 0; w < all->wordsC; w++) {
+		visited[w] = all->done[w] & ~seenBy[w];
+	}
+	PVS2D_BitsetSet(visited, leaf);
+	if (_dfsPVSCalc(all->graph, leaf, all->stacks + thread, visited, pvs, 0, 0)) all->failed = 1;
+	for (unsigned int w = 0; w < all->wordsC; w++) {
+		pvs[w] = (pvs[w] & ~all->done[w]) | seenBy[w];
+	}
+}
+
+// compares the matrix with the brute force one, where every pair is taken from the row
+// of the leaf that goes first, and returns the number of pairs that differ
+static int _verifyAllPVS(_allPVS* all, unsigned int leafC, unsigned int threadsC) {
+	PVS2D_BitsetWord* out = all->out;
+	all->out = (PVS2D_BitsetWord*)malloc((size_t)leafC * all->wordsC * sizeof(PVS2D_BitsetWord));
+	if (!all->out) {
+		all->out = out;
+		DBG_ASSERT(0, -1, "Failed to create brute force PVS matrix");
+		return -1;
+	}
+	// the memoized mode leaves the visited bitsets dirty
+	memset(all->visited, 0, (size_t)threadsC * all->wordsC * sizeof(PVS2D_BitsetWord));
+	int rez = _parallelForRun(leafC, threadsC, _allPVSBody, all);
+	unsigned int diffC = 0;
+	for (unsigned int i = 0; i < leafC && !rez; i++) {
+		if (all->graph->oob[i]) continue;
+		const PVS2D_BitsetWord* brute = all->out + (size_t)i * all->wordsC;
+		const PVS2D_BitsetWord* pvs = out + (size_t)i * all->wordsC;
+		for (unsigned int j = 0; j < leafC; j++) {
+			if (all->graph->oob[j] || all->rank[j] < all->rank[i]) continue;
+			diffC += PVS2D_BitsetTest(brute, j) != PVS2D_BitsetTest(pvs, j);
+		}
+	}
+	free(all->out);
+	all->out = out;
+	return rez ? rez : (int)diffC;
+}
+
+// fills the matrix in rounds, in breadth first order of the leaves, so most of what a source
+// sees around it is already done. every pair is decided by the leaf that goes first,
+// so the result is symmetric
+static int _buildAllPVSMemo(_allPVS* all, unsigned int leafC, unsigned int threadsC, char verify) {
+	all->order = (unsigned int*)malloc(leafC * sizeof(unsigned int));
+	all->rank = (unsigned int*)malloc(leafC * sizeof(unsigned int));
+	if (!all->order || !all->rank) {
+		free(all->order);
+		free(all->rank);
+		DBG_ASSERT(0, -1, "Failed to create order of sources");
+		return -1;
+	}
+	for (unsigned int i = 0; i < leafC; i++) {
+		all->rank[i] = leafC;
+	}
+	unsigned int orderC = 0;
+	for (unsigned int start = 0; start < leafC; start++) {
+		if (all->graph->oob[start] || all->rank[start] != leafC) continue;
+		// the order itself is the queue
+		all->rank[start] = orderC;
+		all->order[orderC++] = start;
+		for (unsigned int head = orderC - 1; head < orderC; head++) {
+			unsigned int node = all->order[head];
+			for (unsigned int e = all->graph->adjStart[node]; e < all->graph->adjStart[node + 1]; e++) {
+				unsigned int leaf = all->graph->leaf[e];
+				if (all->graph->oob[leaf] || all->rank[leaf] != leafC) continue;
+				all->rank[leaf] = orderC;
+				all->order[orderC++] = leaf;
+			}
+		}
+	}
+
+	memset(all->out, 0, (size_t)leafC * all->wordsC * sizeof(PVS2D_BitsetWord));
+	all->seenBy = (PVS2D_BitsetWord*)calloc((size_t)leafC * all->wordsC, sizeof(PVS2D_BitsetWord));
+	all->done = (PVS2D_BitsetWord*)calloc(all->wordsC, sizeof(PVS2D_BitsetWord));
+	if (!all->seenBy || !all->done) {
+		free(all->seenBy);
+		free(all->done);
+		free(all->rank);
+		free(all->order);
+		DBG_ASSERT(0, -1, "Failed to create transposed PVS matrix");
+		return -1;
+	}
+	int rez = 0;
+	for (all->doneC = 0; all->doneC < orderC && !rez;) {
+		unsigned int roundC = min(PVS_ROUND_SIZE, orderC - all->doneC);
+		rez = _parallelForRun(roundC, threadsC, _allPVSMemoBody, all);
+		for (unsigned int i = all->doneC; i < all->doneC + roundC; i++) {
+			unsigned int leaf = all->order[i];
+			PVS2D_BitsetSet(all->done, leaf);
+			PVS2D_BitsetWord* pvs = all->out + (size_t)leaf * all->wordsC;
+			// the pairs within the round are decided by the leaf that goes first as well
+			for (unsigned int j = all->doneC; j < i; j++) {
+				unsigned int other = all->order[j];
+				PVS2D_BitsetClear(pvs, other);
+				if (PVS2D_BitsetTest(all->out + (size_t)other * all->wordsC, leaf)) {
+					PVS2D_BitsetSet(pvs, other);
+				}
+			}
+			for (unsigned int w = 0; w < all->wordsC; w++) {
+				for (PVS2D_BitsetWord bits = pvs[w]; bits; bits &= bits - 1) {
+					PVS2D_BitsetSet(all->seenBy + (size_t)(w * 64 + _ctz(bits)) * all->wordsC, leaf);
+				}
+			}
+		}
+		all->doneC += roundC;
+	}
+	free(all->done);
+
+	// and the one that goes second gets the pair too
+	for (unsigned int i = 0; i < orderC; i++) {
+		unsigned int leaf = all->order[i];
+		PVS2D_BitsetUnion(all->out + (size_t)leaf * all->wordsC, all->seenBy + (size_t)leaf * all->wordsC, all->wordsC);
+	}
+	free(all->seenBy);
+
+	if (verify && !rez) {
+		rez = _verifyAllPVS(all, leafC, threadsC);
+	}
+	free(all->rank);
+	free(all->order);
+	return rez;
+}
+
+int PVS2D_BuildAllPVS(PVS2D_LeafGraphNode* graph, unsigned int leafC, unsigned int threadsC, PVS2D_BitsetWord* out) {
+	return PVS2D_BuildAllPVSEx(graph, leafC, threadsC, PVS2D_PVS_BRUTE, out);
+}
+
+int PVS2D_BuildAllPVSEx(
+	PVS2D_LeafGraphNode* graph, unsigned int leafC, unsigned int threadsC,
+	PVS2D_PVSMode mode, PVS2D_BitsetWord* out
+) {
+	DBG_ASSERT(graph, -1, "'graph' can't be nullptr");
+	PVS2D_CSRLeafGraph csr;
+	if (PVS2D_BuildCSRLeafGraph(0, graph, leafC, &csr)) return -1;
+	int rez = PVS2D_BuildAllPVSCSR(&csr, threadsC, mode, out);
+	free(csr.x1);
+	return rez;
+}
+
+int PVS2D_BuildAllPVSCSR(
+	const PVS2D_CSRLeafGraph* graph, unsigned int threadsC,
+	PVS2D_PVSMode mode, PVS2D_BitsetWord* out
+) {
+	DBG_ASSERT(graph, -1, "'graph' can't be nullptr");
+	DBG_ASSERT(out, -1, "'out' can't be nullptr");
+	unsigned int leafC = graph->leafC;
+	if (threadsC == 0) threadsC = _cpuCount();
+	_allPVS all;
+	all.graph = graph;
+	all.wordsC = PVS2D_BITSET_WORDS(leafC);
+	all.out = out;
+	all.failed = 0;
+	all.visited = (PVS2D_BitsetWord*)calloc((size_t)threadsC * all.wordsC, sizeof(PVS2D_BitsetWord));
+	all.stacks = (_pvsStack*)calloc(threadsC, sizeof(_pvsStack));
+	if (!all.visited || !all.stacks) {
+		free(all.visited);
+		free(all.stacks);
+		DBG_ASSERT(0, -1, "Failed to create traversal stacks");
+		return -1;
+	}
+	int rez;
+	if (mode == PVS2D_PVS_BRUTE) {
+		rez = _parallelForRun(leafC, threadsC, _allPVSBody, &all);
+	}
+	else {
+		rez = _buildAllPVSMemo(&all, leafC, threadsC, mode == PVS2D_PVS_VERIFY);
+	}
+	// a traversal that failed to grow its stack left its row incomplete
+	if (all.failed && rez >= 0) rez = -1;
+	for (unsigned int i = 0; i < threadsC; i++) {
+		_pvsStackFree(all.stacks + i);
+	}
+	free(all.stacks);
+	free(all.visited);
+	return rez;
+}
+
+int PVS2D_FilterPVSByDoors(
+	const PVS2D_CSRLeafGraph* graph,
+	const PVS2D_BitsetWord* pvs, unsigned int leaf,
+	const PVS2D_BitsetWord* openDoors,
+	PVS2D_BitsetWord* out
+) {
+	DBG_ASSERT(graph, -1, "'graph' can't be nullptr");
+	DBG_ASSERT(pvs && out, -1, "'pvs' and 'out' can't be nullptr");
+	DBG_ASSERT(leaf < graph->leafC, -1, "Leaf index is out of range");
+	memset(out, 0, PVS2D_BITSET_WORDS(graph->leafC) * sizeof(PVS2D_BitsetWord));
+	// every leaf seen through closed doors is still reached over the open ones, since the
+	// line of sight passes through all the leaves between. out is the visited set
+	unsigned int* stack = (unsigned int*)malloc(graph->leafC * sizeof(unsigned int));
+	if (!stack) return -1;
+	unsigned int top = 0;
+	PVS2D_BitsetSet(out, leaf);
+	stack[top++] = leaf;
+	while (top) {
+		unsigned int cur = stack[--top];
+		for (unsigned int e = graph->adjStart[cur]; e < graph->adjStart[cur + 1]; e++) {
+			unsigned int next = graph->leaf[e];
+			if (PVS2D_BitsetTest(out, next) || !PVS2D_BitsetTest(pvs, next)) continue;
+			if (graph->door[e] != PVS2D_NO_DOOR && !PVS2D_BitsetTest(openDoors, graph->door[e])) continue;
+			PVS2D_BitsetSet(out, next);
+			stack[top++] = next;
+		}
+	}
+	free(stack);
+	return 0;
+}
+
+// view cones this wide or wider are not convex, so they don't restrict the view at all
+#define FLOOD_MAX_FOV 3.14159265358979323846
+
+// the same traversal as _dfsPVSCalc, but everything is seen from a single point, so the area
+// seen through a portal is just the cone of rays from the point through its cropped part.
+// that cone is inside the previous one, so every frame keeps only its two bounds.
+// like PVS2D_GetLeafPVSInto, it runs on the stack and bitsets of the workspace
+int PVS2D_FloodFromPoint(
+	const PVS2D_CSRLeafGraph* graph, PVS2D_BSPTreeNode* tree,
+	double x, double y, double fovDir, double fovAngle,
+	PVS2D_PVSWorkspace* ws, char* out
+) {
+	DBG_ASSERT(graph && tree, -1, "'graph' and 'tree' can't be nullptr");
+	DBG_ASSERT(ws && ws->state, -1, "'ws' can't be nullptr");
+	DBG_ASSERT(graph->leafC <= ws->leafC, -1, "The workspace is too small for the graph");
+	struct PVS2D_PVSWorkspaceState* state = ws->state;
+	// only the leaves of the previous query are set in the output
+	if (out) {
+		for (unsigned int i = 0; i < ws->leavesC; i++) out[ws->leaves[i]] = 0;
+	}
+	ws->leavesC = 0;
+	unsigned int source = PVS2D_FindLeafOfPoint(tree, x, y);
+	DBG_ASSERT(source < graph->leafC, -1, "The tree doesn't match the graph");
+	if (graph->oob[source]) return -1;
+	_pvsStack* st = &state->st;
+	if (_pvsStackReserve(st, 2, 4)) return -1;
+	st->frames[0].leaf = source;
+	st->frames[0].edge = graph->adjStart[source];
+	st->frames[0].bounds = 0;
+	st->frames[0].boundsC = 0;
+	if (fovAngle < FLOOD_MAX_FOV) {
+		// the view cone is to the right of its left edge and to the left of its right one
+		_pvsBound a = { x, y, x + cos(fovDir + fovAngle / 2), y + sin(fovDir + fovAngle / 2), 0 };
+		_pvsBound b = { x, y, x + cos(fovDir - fovAngle / 2), y + sin(fovDir - fovAngle / 2), 1 };
+		st->bounds[0] = a;
+		st->bounds[1] = b;
+		st->frames[0].boundsC = 2;
+	}
+	PVS2D_BitsetSet(state->visited, source);
+	PVS2D_BitsetSet(state->pvs, source);
+	ws->leaves[ws->leavesC++] = source;
+	int rez = 0;
+	unsigned int depth = 0;
+	while (!rez) {
+		_pvsFrame* frame = st->frames + depth;
+		if (frame->edge == graph->adjStart[frame->leaf + 1]) {
+			if (depth == 0) break;
+			PVS2D_BitsetClear(state->visited, frame->leaf);
+			depth--;
+			continue;
+		}
+		unsigned int prt = frame->edge++;
+		unsigned int next = graph->leaf[prt];
+		if (PVS2D_BitsetTest(state->visited, next)) continue;
+		double tStart = graph->tStart[prt], tEnd = graph->tEnd[prt];
+		char ok = 1;
+		for (unsigned int i = frame->bounds; i < frame->bounds + frame->boundsC; i++) {
+			_cropPortalByBound(graph, prt, st->bounds + i, &tStart, &tEnd);
+			if (tStart > tEnd) {
+				ok = 0;
+				break;
+			}
+		}
+		if (!ok) continue;
+
+		// when the point is on the line of the portal, the portal is only touched at a single
+		// point or is infinite, the cone can't be narrowed, and the previous one is kept
+		unsigned int bounds = frame->bounds, boundsC = frame->boundsC;
+		if (tStart < tEnd && !isinf(tStart) && !isinf(tEnd)) {
+			double x1, y1, x2, y2;
+			_portalPoint(graph, prt, tStart, &x1, &y1);
+			_portalPoint(graph, prt, tEnd, &x2, &y2);
+			int side = _orient2d(x, y, x1, y1, x2, y2);
+			if (side != 0) {
+				if (side > 0) _swapPoints(&x1, &y1, &x2, &y2);
+				// the frames above this one use the bounds up to their depth only
+				bounds = 2 * (depth + 1);
+				boundsC = 2;
+				if (_pvsStackReserve(st, 0, bounds + 2)) {
+					rez = -1;
+					break;
+				}
+				_pvsBound a = { x, y, x1, y1, 0 };
+				_pvsBound b = { x, y, x2, y2, 1 };
+				st->bounds[bounds] = a;
+				st->bounds[bounds + 1] = b;
+			}
+		}
+		if (_pvsStackReserve(st, depth + 2, 0)) {
+			rez = -1;
+			break;
+		}
+		depth++;
+		frame = st->frames + depth;
+		frame->leaf = next;
+		frame->edge = graph->adjStart[next];
+		frame->prt = prt;
+		frame->tStart = tStart;
+		frame->tEnd = tEnd;
+		frame->bounds = bounds;
+		frame->boundsC = boundsC;
+		PVS2D_BitsetSet(state->visited, next);
+		if (!PVS2D_BitsetTest(state->pvs, next)) {
+			PVS2D_BitsetSet(state->pvs, next);
+			ws->leaves[ws->leavesC++] = next;
+		}
+	}
+	// only the current path is left in visited, which is just the source if it went to the end
+	for (unsigned int i = 0; i <= depth; i++) {
+		PVS2D_BitsetClear(state->visited, st->frames[i].leaf);
+	}
+	for (unsigned int i = 0; i < ws->leavesC; i++) {
+		PVS2D_BitsetClear(state->pvs, ws->leaves[i]);
+		if (out) out[ws->leaves[i]] = 1;
+	}
+	return rez;
+}
+
+// --------------------------------------------------------
+//                        BITSETS
+// --------------------------------------------------------
+
+void PVS2D_BitsetUnion(PVS2D_BitsetWord* dest, const PVS2D_BitsetWord* src, unsigned int wordsC) {
+	for (unsigned int i = 0; i < wordsC; i++) {
+		dest[i] |= src[i];
+	}
+}
+
+void PVS2D_BitsetIntersect(PVS2D_BitsetWord* dest, const PVS2D_BitsetWord* src, unsigned int wordsC) {
+	for (unsigned int i = 0; i < wordsC; i++) {
+		dest[i] &= src[i];
+	}
+}
+
+unsigned int PVS2D_BitsetCount(const PVS2D_BitsetWord* set, unsigned int wordsC) {
+	unsigned int ret = 0;
+	for (unsigned int i = 0; i < wordsC; i++) {
+		ret += _popcount(set[i]);
+	}
+	return ret;
+}
+
+// --------------------------------------------------------
+//                     COMPRESSED PVS
+// --------------------------------------------------------
+
+// the rows are compressed by bytes: a zero byte is followed by the number of zero bytes
+// in the run (including itself), the rest are stored as is. returns the compressed size
+static size_t _compressRow(const PVS2D_BitsetWord* row, unsigned int leafC, unsigned char* dest) {
+	unsigned int bytesC = (leafC + 7) / 8;
+	size_t size = 0;
+	for (unsigned int i = 0; i < bytesC;) {
+		unsigned char b = (unsigned char)(row[i >> 3] >> ((i & 7) * 8));
+		i++;
+		if (b) {
+			if (dest) dest[size] = b;
+			size++;
+			continue;
+		}
+		unsigned int run = 1;
+		while (i < bytesC && run < 255 && !(unsigned char)(row[i >> 3] >> ((i & 7) * 8))) {
+			i++;
+			run++;
+		}
+		if (dest) {
+			dest[size] = 0;
+			dest[size + 1] = (unsigned char)run;
+		}
+		size += 2;
+	}
+	return size;
+}
+
+// the index has a checkpoint every PVS_INDEX_STEP compressed bytes, so a query decodes at most
+// that many bytes after a binary search. a checkpoint is the row byte decoded at its position
+// shifted by 1, and the low bit set if the position is the count of a zero run,
+// so the decoding starts from the next byte
+#define PVS_INDEX_STEP 16
+#define PVS_MAX_ROW_BYTES 0x7FFF
+
+// returns the size of the compressed rows, or (size_t)-1 if the matrix is too big
+static size_t _compressedPVSSize(const PVS2D_BitsetWord* matrix, unsigned int leafC) {
+	if ((leafC + 7) / 8 > PVS_MAX_ROW_BYTES) return (size_t)-1;
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC);
+	size_t size = 0;
+	for (unsigned int i = 0; i < leafC; i++) {
+		size += _compressRow(matrix + (size_t)i * wordsC, leafC, 0);
+	}
+	return size > 0xFFFFFFFFu ? (size_t)-1 : size;
+}
+
+// fills the arrays of the compressed pvs, sized with _compressedPVSSize
+static void _compressPVS(const PVS2D_BitsetWord* matrix, unsigned int leafC, PVS2D_CompressedPVS* dest) {
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC);
+	size_t offset = 0;
+	for (unsigned int i = 0; i < leafC; i++) {
+		dest->rowStart[i] = (unsigned int)offset;
+		offset += _compressRow(matrix + (size_t)i * wordsC, leafC, dest->rows + offset);
+	}
+	dest->rowStart[leafC] = (unsigned int)offset;
+	for (unsigned int i = 0; i < leafC; i++) {
+		unsigned int pos = 0;
+		for (unsigned int o = dest->rowStart[i]; o < dest->rowStart[i + 1];) {
+			unsigned int len = dest->rows[o] ? 1 : 2;
+			unsigned int next = pos + (dest->rows[o] ? 1 : dest->rows[o + 1]);
+			if (o % PVS_INDEX_STEP == 0) {
+				dest->index[o / PVS_INDEX_STEP] = (unsigned short)(pos << 1);
+			}
+			else if (len == 2 && (o + 1) % PVS_INDEX_STEP == 0) {
+				dest->index[(o + 1) / PVS_INDEX_STEP] = (unsigned short)((next << 1) | 1);
+			}
+			o += len;
+			pos = next;
+		}
+	}
+}
+
+// checks that the rows of `size` bytes are exactly what _compressPVS writes for a matrix of
+// cpvs->leafC leaves, together with the index, so the queries stay inside the arrays
+static int _compressedPVSCheck(const PVS2D_CompressedPVS* cpvs, size_t size) {
+	unsigned int leafC = cpvs->leafC, bytesC = (leafC + 7) / 8;
+	if (bytesC > PVS_MAX_ROW_BYTES) return -1;
+	if (cpvs->rowStart[0] != 0 || cpvs->rowStart[leafC] != size) return -1;
+	for (unsigned int i = 0; i < leafC; i++) {
+		unsigned int start = cpvs->rowStart[i], end = cpvs->rowStart[i + 1];
+		if (end < start || end > size) return -1;
+		unsigned int pos = 0;
+		for (unsigned int o = start; o < end;) {
+			unsigned char b = cpvs->rows[o];
+			unsigned int len = b ? 1 : 2;
+			if (o + len > end || (!b && !cpvs->rows[o + 1])) return -1;
+			unsigned int next = pos + (b ? 1 : cpvs->rows[o + 1]);
+			if (next > bytesC) return -1;
+			// no bits past the last leaf, List would return them
+			if (b && next == bytesC && (leafC & 7) && (b >> (leafC & 7))) return -1;
+			if (o % PVS_INDEX_STEP == 0) {
+				if (cpvs->index[o / PVS_INDEX_STEP] != (unsigned short)(pos << 1)) return -1;
+			}
+			else if (len == 2 && (o + 1) % PVS_INDEX_STEP == 0) {
+				if (cpvs->index[(o + 1) / PVS_INDEX_STEP] != (unsigned short)((next << 1) | 1)) return -1;
+			}
+			o += len;
+			pos = next;
+		}
+		if (pos != bytesC) return -1;
+	}
+	return 0;
+}
+
+int PVS2D_CompressPVS(
+	PVS2D_Context* ctx, const PVS2D_BitsetWord* matrix, unsigned int leafC,
+	PVS2D_CompressedPVS* dest
+) {
+	DBG_ASSERT(matrix, -1, "'matrix' can't be nullptr");
+	DBG_ASSERT(dest, -1, "'dest' can't be nullptr");
+	size_t size = _compressedPVSSize(matrix, leafC);
+	if (size == (size_t)-1) return -1;
+	size_t indexC = (size + PVS_INDEX_STEP - 1) / PVS_INDEX_STEP;
+	size_t startSize = ((size_t)leafC + 1) * sizeof(unsigned int);
+	size_t indexSize = indexC * sizeof(unsigned short);
+	unsigned char* block = (unsigned char*)_alloc(ctx, startSize + indexSize + size);
+	if (!block) return -1;
+	dest->leafC = leafC;
+	dest->rowStart = (unsigned int*)block;
+	dest->index = (unsigned short*)(block + startSize);
+	dest->rows = block + startSize + indexSize;
+	_compressPVS(matrix, leafC, dest);
+	return 0;
+}
+
+// finds where decoding of byte `byte` of the row starts
+static inline const unsigned char* _compressedPVSSeek(
+	const PVS2D_CompressedPVS* cpvs, unsigned int leaf, unsigned int byte, unsigned int* posDest
+) {
+	unsigned int start = cpvs->rowStart[leaf], end = cpvs->rowStart[leaf + 1];
+	unsigned int first = (start + PVS_INDEX_STEP - 1) / PVS_INDEX_STEP;
+	unsigned int lo = first, hi = (end + PVS_INDEX_STEP - 1) / PVS_INDEX_STEP;
+	// the last checkpoint of the row not after the byte
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if ((unsigned int)(cpvs->index[mid] >> 1) <= byte) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == first) {
+		*posDest = 0;
+		return cpvs->rows + start;
+	}
+	unsigned int cp = cpvs->index[lo - 1];
+	*posDest = cp >> 1;
+	return cpvs->rows + (lo - 1) * PVS_INDEX_STEP + (cp & 1);
+}
+
+int PVS2D_CompressedPVSTest(const PVS2D_CompressedPVS* cpvs, unsigned int from, unsigned int to) {
+	DBG_ASSERT(cpvs, -1, "'cpvs' can't be nullptr");
+	DBG_ASSERT(from < cpvs->leafC && to < cpvs->leafC, -1, "Leaf index is out of range");
+	unsigned int byte = to >> 3, pos;
+	const unsigned char* src = _compressedPVSSeek(cpvs, from, byte, &pos);
+	const unsigned char* end = cpvs->rows + cpvs->rowStart[from + 1];
+	while (src < end) {
+		if (*src) {
+			if (pos == byte) return (*src >> (to & 7)) & 1;
+			pos++;
+			src++;
+		}
+		else {
+			pos += src[1];
+			if (pos > byte) return 0;
+			src += 2;
+		}
+	}
+	return 0;
+}
+
+unsigned int PVS2D_CompressedPVSList(const PVS2D_CompressedPVS* cpvs, unsigned int leaf, unsigned int* out) {
+	DBG_ASSERT(cpvs && out, 0, "'cpvs' and 'out' can't be nullptr");
+	DBG_ASSERT(leaf < cpvs->leafC, 0, "Leaf index is out of range");
+	const unsigned char* src = cpvs->rows + cpvs->rowStart[leaf];
+	const unsigned char* end = cpvs->rows + cpvs->rowStart[leaf + 1];
+	unsigned int count = 0, pos = 0;
+	while (src < end) {
+		if (*src) {
+			for (unsigned int bits = *src; bits; bits &= bits - 1) {
+				out[count++] = pos * 8 + _ctz(bits);
+			}
+			pos++;
+			src++;
+		}
+		else {
+			pos += src[1];
+			src += 2;
+		}
+	}
+	return count;
+}
+
+int PVS2D_CompressedPVSRow(const PVS2D_CompressedPVS* cpvs, unsigned int leaf, PVS2D_BitsetWord* out) {
+	DBG_ASSERT(cpvs && out, -1, "'cpvs' and 'out' can't be nullptr");
+	DBG_ASSERT(leaf < cpvs->leafC, -1, "Leaf index is out of range");
+	memset(out, 0, PVS2D_BITSET_WORDS(cpvs->leafC) * sizeof(PVS2D_BitsetWord));
+	const unsigned char* src = cpvs->rows + cpvs->rowStart[leaf];
+	const unsigned char* end = cpvs->rows + cpvs->rowStart[leaf + 1];
+	unsigned int pos = 0;
+	while (src < end) {
+		if (*src) {
+			out[pos >> 3] |= (PVS2D_BitsetWord)*src << ((pos & 7) * 8);
+			pos++;
+			src++;
+		}
+		else {
+			pos += src[1];
+			src += 2;
+		}
+	}
+	return 0;
+}
+
+// --------------------------------------------------------
+//                      SCENE FILES
+// --------------------------------------------------------
+
+// the file is the header followed by the sections, each aligned to 8 bytes.
+// everything is little endian, so on such machines loading is just copying
+#define SCENE_MAGIC 0x32535650u		// "PVS2"
+#define SCENE_VERSION 3u
+#define SCENE_HAS_PVS 1u
+
+enum {
+	SCENE_LINES,
+	SCENE_NODES,
+	SCENE_NODE_LINES,
+	SCENE_PORTALS,
+	SCENE_ADJ_START,
+	SCENE_EDGES,
+	SCENE_OOB,
+	SCENE_PVS_START,
+	SCENE_PVS_INDEX,
+	SCENE_PVS,
+	SCENE_SECTIONS_C
+};
+
+typedef struct _sceneHeader {
+	unsigned int magic, version, flags;
+	unsigned int linesC, nodesC, portalsC, leafC, edgesC, pvsSize;
+	// crc32 of every section with its padding, and of the header up to this field
+	unsigned int crcs[SCENE_SECTIONS_C];
+	unsigned int headerCrc;
+} _sceneHeader;
+
+// the records are read straight from the file, so they must have the same layout everywhere
+typedef char _sceneCheckInt[sizeof(unsigned int) == 4 && sizeof(int) == 4 ? 1 : -1];
+typedef char _sceneCheckNode[sizeof(PVS2D_BakedNode) == 24 ? 1 : -1];
+typedef char _sceneCheckPortal[sizeof(PVS2D_ScenePortal) == 40 ? 1 : -1];
+typedef char _sceneCheckHeader[sizeof(_sceneHeader) % 8 == 0 ? 1 : -1];
+
+static inline size_t _align8(size_t size) {
+	return (size + 7) & ~(size_t)7;
+}
+
+// sizes of the sections in bytes, from the counts in the header
+static void _sceneSizes(const _sceneHeader* header, size_t* sizes) {
+	char hasPVS = (header->flags & SCENE_HAS_PVS) != 0;
+	sizes[SCENE_LINES] = header->linesC * sizeof(PVS2D_SceneLine);
+	sizes[SCENE_NODES] = header->nodesC * sizeof(PVS2D_BakedNode);
+	sizes[SCENE_NODE_LINES] = header->nodesC * sizeof(unsigned int);
+	sizes[SCENE_PORTALS] = header->portalsC * sizeof(PVS2D_ScenePortal);
+	sizes[SCENE_ADJ_START] = ((size_t)header->leafC + 1) * sizeof(unsigned int);
+	sizes[SCENE_EDGES] = header->edgesC * sizeof(PVS2D_SceneEdge);
+	sizes[SCENE_OOB] = header->leafC;
+	sizes[SCENE_PVS_START] = hasPVS ? ((size_t)header->leafC + 1) * sizeof(unsigned int) : 0;
+	sizes[SCENE_PVS_INDEX] = hasPVS ? (header->pvsSize + PVS_INDEX_STEP - 1) / PVS_INDEX_STEP * sizeof(unsigned short) : 0;
+	sizes[SCENE_PVS] = hasPVS ? header->pvsSize : 0;
+}
+
+// points the scene into the image, and returns the size of the image
+static size_t _sceneLayout(const _sceneHeader* header, unsigned char* image, PVS2D_Scene* scene) {
+	size_t sizes[SCENE_SECTIONS_C];
+	_sceneSizes(header, sizes);
+	unsigned char* sections[SCENE_SECTIONS_C];
+	size_t offset = sizeof(_sceneHeader);
+	for (unsigned int i = 0; i < SCENE_SECTIONS_C; i++) {
+		sections[i] = image + offset;
+		offset += _align8(sizes[i]);
+	}
+	if (scene) {
+		scene->linesC = header->linesC;
+		scene->portalsC = header->portalsC;
+		scene->leafC = header->leafC;
+		scene->edgesC = header->edgesC;
+		scene->lines = (PVS2D_SceneLine*)sections[SCENE_LINES];
+		scene->tree.nodes = (PVS2D_BakedNode*)sections[SCENE_NODES];
+		scene->tree.nodesC = header->nodesC;
+		scene->nodeLines = (unsigned int*)sections[SCENE_NODE_LINES];
+		scene->portals = (PVS2D_ScenePortal*)sections[SCENE_PORTALS];
+		scene->adjStart = (unsigned int*)sections[SCENE_ADJ_START];
+		scene->adjs = (PVS2D_SceneEdge*)sections[SCENE_EDGES];
+		scene->oob = sections[SCENE_OOB];
+		char hasPVS = (header->flags & SCENE_HAS_PVS) != 0;
+		scene->pvs.leafC = header->leafC;
+		scene->pvs.rowStart = hasPVS ? (unsigned int*)sections[SCENE_PVS_START] : 0;
+		scene->pvs.index = hasPVS ? (unsigned short*)sections[SCENE_PVS_INDEX] : 0;
+		scene->pvs.rows = hasPVS ? sections[SCENE_PVS] : 0;
+	}
+	return offset;
+}
+
+static unsigned int _crc32(const unsigned char* data, size_t size) {
+	static const unsigned int nibbles[16] = {
+		0x00000000u, 0x1DB71064u, 0x3B6E20C8u, 0x26D930ACu, 0x76DC4190u, 0x6B6B51F4u, 0x4DB26158u, 0x5005713Cu,
+		0xEDB88320u, 0xF00F9344u, 0xD6D6A3E8u, 0xCB61B38Cu, 0x9B64C2B0u, 0x86D3D2D4u, 0xA00AE278u, 0xBDBDF21Cu
+	};
+	unsigned int crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < size; i++) {
+		crc ^= data[i];
+		crc = (crc >> 4) ^ nibbles[crc & 15];
+		crc = (crc >> 4) ^ nibbles[crc & 15];
+	}
+	return ~crc;
+}
+
+static inline char _bigEndian(void) {
+	const unsigned int one = 1;
+	return *(const unsigned char*)&one == 0;
+}
+
+static void _swap16s(void* data, size_t count) {
+	unsigned short* words = (unsigned short*)data;
+	for (size_t i = 0; i < count; i++) {
+		words[i] = (unsigned short)((words[i] >> 8) | (words[i] << 8));
+	}
+}
+
+static void _swap32s(void* data, size_t count) {
+	unsigned int* words = (unsigned int*)data;
+	for (size_t i = 0; i < count; i++) {
+		unsigned int w = words[i];
+		words[i] = (w >> 24) | ((w >> 8) & 0xFF00u) | ((w << 8) & 0xFF0000u) | (w << 24);
+	}
+}
+
+static void _swap64s(void* data, size_t count) {
+	unsigned char* bytes = (unsigned char*)data;
+	for (size_t i = 0; i < count; i++, bytes += 8) {
+		for (unsigned int j = 0; j < 4; j++) {
+			unsigned char t = bytes[j];
+			bytes[j] = bytes[7 - j];
+			bytes[7 - j] = t;
+		}
+	}
+}
+
+// converts the image between little endian and the order of this machine, both ways.
+// the header must be in the order of this machine
+static void _sceneSwap(const _sceneHeader* header, unsigned char* image) {
+	if (!_bigEndian()) return;
+	PVS2D_Scene scene;
+	_sceneLayout(header, image, &scene);
+	_swap32s(scene.lines, (size_t)scene.linesC * 4);
+	_swap32s(scene.tree.nodes, (size_t)scene.tree.nodesC * 6);
+	_swap32s(scene.nodeLines, scene.tree.nodesC);
+	for (unsigned int i = 0; i < scene.portalsC; i++) {
+		_swap64s(&scene.portals[i].tStart, 2);
+		_swap32s(&scene.portals[i].line, 6);
+	}
+	_swap32s(scene.adjStart, (size_t)scene.leafC + 1);
+	_swap32s(scene.adjs, (size_t)scene.edgesC * 2);
+	if (scene.pvs.rowStart) {
+		_swap32s(scene.pvs.rowStart, (size_t)scene.leafC + 1);
+		_swap16s(scene.pvs.index, (header->pvsSize + PVS_INDEX_STEP - 1) / PVS_INDEX_STEP);
+	}
+}
+
+// pointer -> index, open addressing
+typedef struct _ptrIndex {
+	const void** keys;
+	unsigned int* vals;
+	unsigned int mask, count;
+} _ptrIndex;
+
+static void _ptrIndexFree(_ptrIndex* map) {
+	free(map->keys);
+	free(map->vals);
+}
+
+static int _ptrIndexInit(_ptrIndex* map, unsigned int maxCount) {
+	unsigned int cap = 16;
+	while (cap < 2 * maxCount) cap *= 2;
+	map->keys = (const void**)calloc(cap, sizeof(void*));
+	map->vals = (unsigned int*)malloc(cap * sizeof(unsigned int));
+	if (!map->keys || !map->vals) {
+		_ptrIndexFree(map);
+		return -1;
+	}
+	map->mask = cap - 1;
+	map->count = 0;
+	return 0;
+}
+
+// returns the index of the pointer, giving it the next one if it is new
+static unsigned int _ptrIndexGet(_ptrIndex* map, const void* key) {
+	size_t h = ((size_t)key >> 3) * 0x9E3779B97F4A7C15ULL;
+	unsigned int i = (unsigned int)(h >> 32) & map->mask;
+	while (map->keys[i] && map->keys[i] != key) i = (i + 1) & map->mask;
+	if (!map->keys[i]) {
+		map->keys[i] = key;
+		map->vals[i] = map->count++;
+	}
+	return map->vals[i];
+}
+
+static void _countScene(PVS2D_BSPTreeNode* node, unsigned int* nodesC, unsigned int* portalsC) {
+	(*nodesC)++;
+	for (PVS2D_PortalStack* prt = node->portals; prt; prt = prt->next) (*portalsC)++;
+	if (node->left) _countScene(node->left, nodesC, portalsC);
+	if (node->right) _countScene(node->right, nodesC, portalsC);
+}
+
+// fills the lines and portals of the subtree in preorder, the same as _bakeNode does with nodes
+static void _fillScene(PVS2D_BSPTreeNode* node, PVS2D_Scene* scene, _ptrIndex* lines, _ptrIndex* portals, unsigned int* nodeIdx) {
+	unsigned int line = _ptrIndexGet(lines, node->line);
+	if (line == lines->count - 1) {
+		PVS2D_SceneLine* dest = scene->lines + line;
+		dest->ax = node->line->ax;
+		dest->ay = node->line->ay;
+		dest->bx = node->line->bx;
+		dest->by = node->line->by;
+	}
+	scene->nodeLines[(*nodeIdx)++] = line;
+	for (PVS2D_PortalStack* prt = node->portals; prt; prt = prt->next) {
+		PVS2D_ScenePortal* dest = scene->portals + _ptrIndexGet(portals, prt->portal);
+		dest->tStart = prt->portal->seg.tStart;
+		dest->tEnd = prt->portal->seg.tEnd;
+		dest->line = line;
+		dest->leftLeaf = prt->portal->leftLeaf;
+		dest->rightLeaf = prt->portal->rightLeaf;
+		dest->opq = (unsigned int)prt->portal->seg.opq;
+		dest->door = prt->portal->seg.door;
+	}
+	if (node->left) _fillScene(node->left, scene, lines, portals, nodeIdx);
+	if (node->right) _fillScene(node->right, scene, lines, portals, nodeIdx);
+}
+
+int PVS2D_SaveScene(
+	PVS2D_BSPTreeNode* root, PVS2D_LeafGraphNode* graph, unsigned int leafC,
+	const PVS2D_BitsetWord* pvs, void** dataDest, size_t* sizeDest
+) {
+	DBG_ASSERT(root, -1, "'root' can't be nullptr");
+	DBG_ASSERT(graph, -1, "'graph' can't be nullptr");
+	DBG_ASSERT(dataDest && sizeDest, -1, "'dataDest' and 'sizeDest' can't be nullptr");
+	_sceneHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = SCENE_MAGIC;
+	header.version = SCENE_VERSION;
+	header.flags = pvs ? SCENE_HAS_PVS : 0;
+	header.leafC = leafC;
+	_countScene(root, &header.nodesC, &header.portalsC);
+	_countLeafGraph(graph, leafC, &header.edgesC);
+	size_t pvsSize = pvs ? _compressedPVSSize(pvs, leafC) : 0;
+	if (pvsSize == (size_t)-1) return -1;
+	header.pvsSize = (unsigned int)pvsSize;
+	// the lines are not known until they are deduplicated, but there are no more of them than nodes
+	header.linesC = header.nodesC;
+	size_t size = _sceneLayout(&header, 0, 0);
+	unsigned char* image = (unsigned char*)calloc(size, 1);
+	if (!image) return -1;
+
+	PVS2D_Scene scene;
+	_sceneLayout(&header, image, &scene);
+	_ptrIndex lines, portals;
+	if (_ptrIndexInit(&lines, header.nodesC)) {
+		free(image);
+		return -1;
+	}
+	if (_ptrIndexInit(&portals, header.portalsC)) {
+		_ptrIndexFree(&lines);
+		free(image);
+		return -1;
+	}
+	unsigned int nodeIdx = 0;
+	_fillScene(root, &scene, &lines, &portals, &nodeIdx);
+	int nextIndex = 0;
+	_bakeNode(root, scene.tree.nodes, &nextIndex);
+
+	unsigned int edgeIdx = 0;
+	for (unsigned int i = 0; i < leafC; i++) {
+		scene.adjStart[i] = edgeIdx;
+		scene.oob[i] = (unsigned char)graph[i].oob;
+		for (PVS2D_LGEdgeStack* edge = graph[i].adjs; edge; edge = edge->next, edgeIdx++) {
+			scene.adjs[edgeIdx].leaf = edge->node->leaf;
+			scene.adjs[edgeIdx].portal = _ptrIndexGet(&portals, edge->prt);
+		}
+	}
+	scene.adjStart[leafC] = edgeIdx;
+	unsigned int portalsC = portals.count;
+	_ptrIndexFree(&portals);
+	if (portalsC != header.portalsC) {
+		// the leaf graph has portals that are not in the tree
+		_ptrIndexFree(&lines);
+		free(image);
+		return -1;
+	}
+
+	if (pvs) {
+		_compressPVS(pvs, leafC, &scene.pvs);
+	}
+
+	// now the lines are known, so the sections after them are moved closer
+	unsigned int nodesLinesC = header.linesC;
+	header.linesC = lines.count;
+	_ptrIndexFree(&lines);
+	size_t sizes[SCENE_SECTIONS_C];
+	_sceneSizes(&header, sizes);
+	size_t from = sizeof(_sceneHeader) + _align8(nodesLinesC * sizeof(PVS2D_SceneLine));
+	size_t to = sizeof(_sceneHeader) + _align8(sizes[SCENE_LINES]);
+	memmove(image + to, image + from, size - from);
+	size -= from - to;
+
+	_sceneSwap(&header, image);
+	unsigned char* sections[SCENE_SECTIONS_C];
+	size_t offset = sizeof(_sceneHeader);
+	for (unsigned int i = 0; i < SCENE_SECTIONS_C; i++) {
+		sections[i] = image + offset;
+		header.crcs[i] = _crc32(sections[i], _align8(sizes[i]));
+		offset += _align8(sizes[i]);
+	}
+	if (_bigEndian()) {
+		_swap32s(&header, sizeof(header) / 4);
+	}
+	header.headerCrc = _crc32((unsigned char*)&header, offsetof(_sceneHeader, headerCrc));
+	if (_bigEndian()) {
+		_swap32s(&header.headerCrc, 1);
+	}
+	memcpy(image, &header, sizeof(header));
+	*dataDest = image;
+	*sizeDest = size;
+	return 0;
+}
+
+// reads and checks the header of the data, returns the size of the image or 0 if it is wrong
+static size_t _sceneReadHeader(const void* data, size_t size, _sceneHeader* header) {
+	if (size < sizeof(_sceneHeader)) return 0;
+	memcpy(header, data, sizeof(*header));
+	unsigned int headerCrc = _crc32((const unsigned char*)header, offsetof(_sceneHeader, headerCrc));
+	if (_bigEndian()) {
+		_swap32s(header, sizeof(*header) / 4);
+	}
+	// the data comes from outside, so these are checked in release too
+	if (header->magic != SCENE_MAGIC || header->version != SCENE_VERSION) return 0;
+	if (header->headerCrc != headerCrc) return 0;
+	size_t imageSize = _sceneLayout(header, 0, 0);
+	return size < imageSize ? 0 : imageSize;
+}
+
+static int _sceneCheckSections(const _sceneHeader* header, const unsigned char* image) {
+	size_t sizes[SCENE_SECTIONS_C];
+	_sceneSizes(header, sizes);
+	size_t offset = sizeof(_sceneHeader);
+	for (unsigned int i = 0; i < SCENE_SECTIONS_C; i++) {
+		if (_crc32(image + offset, _align8(sizes[i])) != header->crcs[i]) return -1;
+		offset += _align8(sizes[i]);
+	}
+	return 0;
+}
+
+// checks every index of the scene against the size of the array it points into, so a damaged
+// or crafted file can't make the queries read out of the image. the crc is optional for mapped files,
+// and only catches accidental damage anyway
+static int _sceneValidate(const _sceneHeader* header, const PVS2D_Scene* scene) {
+	unsigned int nodesC = header->nodesC, leafC = header->leafC;
+	// the search always starts from the root, and a tree has at least one node
+	if (!nodesC || !leafC) return -1;
+	for (unsigned int i = 0; i < nodesC; i++) {
+		const PVS2D_BakedNode* node = scene->tree.nodes + i;
+		int children[2] = { node->left, node->right };
+		for (unsigned int k = 0; k < 2; k++) {
+			int c = children[k];
+			// the nodes are in preorder, so a child is always after its parent and there are no cycles
+			if (c >= 0 ? ((unsigned int)c <= i || (unsigned int)c >= nodesC) : (unsigned int)~c >= leafC) return -1;
+		}
+		if (scene->nodeLines[i] >= header->linesC) return -1;
+	}
+	for (unsigned int i = 0; i < header->portalsC; i++) {
+		const PVS2D_ScenePortal* prt = scene->portals + i;
+		if (prt->line >= header->linesC || prt->leftLeaf >= leafC || prt->rightLeaf >= leafC) return -1;
+		// PVS2D_DOOR takes an int
+		if (prt->door != PVS2D_NO_DOOR && prt->door > 0x7FFFFFFFu) return -1;
+	}
+	if (scene->adjStart[0] != 0 || scene->adjStart[leafC] != header->edgesC) return -1;
+	for (unsigned int i = 0; i < leafC; i++) {
+		if (scene->adjStart[i + 1] < scene->adjStart[i]) return -1;
+	}
+	for (unsigned int e = 0; e < header->edgesC; e++) {
+		if (scene->adjs[e].leaf >= leafC || scene->adjs[e].portal >= header->portalsC) return -1;
+	}
+	if (scene->pvs.rowStart && _compressedPVSCheck(&scene->pvs, header->pvsSize)) return -1;
+	return 0;
+}
+
+int PVS2D_LoadScene(const void* data, size_t size, PVS2D_Scene* dest) {
+	DBG_ASSERT(data, -1, "'data' can't be nullptr");
+	DBG_ASSERT(dest, -1, "'dest' can't be nullptr");
+	_sceneHeader header;
+	size_t imageSize = _sceneReadHeader(data, size, &header);
+	if (!imageSize) return -1;
+
+	unsigned char* image = (unsigned char*)malloc(imageSize);
+	if (!image) return -1;
+	memcpy(image, data, imageSize);
+	if (_sceneCheckSections(&header, image)) {
+		free(image);
+		return -1;
+	}
+	_sceneSwap(&header, image);
+	PVS2D_Scene scene;
+	_sceneLayout(&header, image, &scene);
+	// a matching crc only means the file wasn't damaged, not that it was written by PVS2D_SaveScene
+	if (_sceneValidate(&header, &scene)) {
+		free(image);
+		return -1;
+	}
+	scene.data = image;
+	scene.mapSize = 0;
+	*dest = scene;
+	return 0;
+}
+
+int PVS2D_SaveSceneFile(
+	const char* path, PVS2D_BSPTreeNode* root, PVS2D_LeafGraphNode* graph, unsigned int leafC,
+	const PVS2D_BitsetWord* pvs
+) {
+	DBG_ASSERT(path, -1, "'path' can't be nullptr");
+	void* data;
+	size_t size;
+	if (PVS2D_SaveScene(root, graph, leafC, pvs, &data, &size)) return -1;
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		free(data);
+		return -1;
+	}
+	size_t written = fwrite(data, 1, size, file);
+	int closed = fclose(file);
+	free(data);
+	return written == size && !closed ? 0 : -1;
+}
+
+int PVS2D_LoadSceneFile(const char* path, PVS2D_Scene* dest) {
+	DBG_ASSERT(path, -1, "'path' can't be nullptr");
+	FILE* file = fopen(path, "rb");
+	if (!file) return -1;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	void* data = size > 0 ? malloc((size_t)size) : 0;
+	size_t read = data ? fread(data, 1, (size_t)size, file) : 0;
+	fclose(file);
+	if (!data || read != (size_t)size) {
+		free(data);
+		return -1;
+	}
+	int rez = PVS2D_LoadScene(data, (size_t)size, dest);
+	free(data);
+	return rez;
+}
+
+// maps the whole file read only, returns 0 on failure
+static void* _mapFile(const char* path, size_t* sizeDest) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE) return 0;
+	LARGE_INTEGER size;
+	void* view = 0;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && (unsigned long long)size.QuadPart <= (size_t)-1) {
+		// the view keeps the mapping alive, so both handles can be closed right away
+		HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+		if (mapping) {
+			view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+		*sizeDest = (size_t)size.QuadPart;
+	}
+	CloseHandle(file);
+	return view;
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0) return 0;
+	struct stat st;
+	void* view = 0;
+	if (!fstat(file, &st) && st.st_size > 0 && (unsigned long long)st.st_size <= (size_t)-1) {
+		view = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, file, 0);
+		if (view == MAP_FAILED) view = 0;
+		*sizeDest = (size_t)st.st_size;
+	}
+	close(file);
+	return view;
+#endif
+}
+
+static void _unmapFile(void* view, size_t size) {
+#ifdef _WIN32
+	(void)size;
+	UnmapViewOfFile(view);
+#else
+	munmap(view, size);
+#endif
+}
+
+int PVS2D_MapSceneFile(const char* path, char verify, PVS2D_Scene* dest) {
+	DBG_ASSERT(path, -1, "'path' can't be nullptr");
+	DBG_ASSERT(dest, -1, "'dest' can't be nullptr");
+	// the mapped image can't be swapped in place
+	if (_bigEndian()) return -1;
+	size_t size = 0;
+	unsigned char* view = (unsigned char*)_mapFile(path, &size);
+	if (!view) return -1;
+	_sceneHeader header;
+	if (!_sceneReadHeader(view, size, &header) || (verify && _sceneCheckSections(&header, view))) {
+		_unmapFile(view, size);
+		return -1;
+	}
+	PVS2D_Scene scene;
+	_sceneLayout(&header, view, &scene);
+	// the structure is checked even without verify, the crc doesn't protect from crafted files
+	if (_sceneValidate(&header, &scene)) {
+		_unmapFile(view, size);
+		return -1;
+	}
+	scene.data = view;
+	scene.mapSize = size;
+	*dest = scene;
+	return 0;
+}
+
+void PVS2D_FreeScene(PVS2D_Scene* scene) {
+	if (!scene) return;
+	if (scene->mapSize) _unmapFile(scene->data, scene->mapSize);
+	else free(scene->data);
+	memset(scene, 0, sizeof(*scene));
+}
+
+int PVS2D_FilterSceneByDoors(
+	const PVS2D_Scene* scene,
+	const PVS2D_BitsetWord* pvs, unsigned int leaf,
+	const PVS2D_BitsetWord* openDoors,
+	PVS2D_BitsetWord* out
+) {
+	DBG_ASSERT(scene, -1, "'scene' can't be nullptr");
+	DBG_ASSERT(pvs && out, -1, "'pvs' and 'out' can't be nullptr");
+	DBG_ASSERT(leaf < scene->leafC, -1, "Leaf index is out of range");
+	// the same traversal as PVS2D_FilterPVSByDoors
+	memset(out, 0, PVS2D_BITSET_WORDS(scene->leafC) * sizeof(PVS2D_BitsetWord));
+	unsigned int* stack = (unsigned int*)malloc(scene->leafC * sizeof(unsigned int));
+	if (!stack) return -1;
+	unsigned int top = 0;
+	PVS2D_BitsetSet(out, leaf);
+	stack[top++] = leaf;
+	while (top) {
+		unsigned int cur = stack[--top];
+		for (unsigned int e = scene->adjStart[cur]; e < scene->adjStart[cur + 1]; e++) {
+			unsigned int next = scene->adjs[e].leaf;
+			if (PVS2D_BitsetTest(out, next) || !PVS2D_BitsetTest(pvs, next)) continue;
+			unsigned int door = scene->portals[scene->adjs[e].portal].door;
+			if (door != PVS2D_NO_DOOR && !PVS2D_BitsetTest(openDoors, door)) continue;
+			PVS2D_BitsetSet(out, next);
+			stack[top++] = next;
+		}
+	}
+	free(stack);
+	return 0;
+}
+
+// --------------------------------------------------------
+//                    EDITABLE SCENES
+// --------------------------------------------------------
+
+// leaf index of the places that did not exist before the update
+#define EDIT_NEW_LEAF (~0u)
+// subtrees of fewer segments are rebuilt by one thread
+#define EDIT_PARALLEL_SEGS (BSP_MIN_TASK * BSP_TASKS_PER_THREAD)
+
+struct PVS2D_EditSceneState {
+	PVS2D_BSPParams params;
+	// lines and the original segments, only freed with the scene
+	PVS2D_Context* ctx;
+	_lineTable lines;
+	// original segment of every id, 0 for the removed ones
+	PVS2D_Seg** origins;
+	unsigned int originsC, originsCap, aliveC;
+	// leaf graph and its CSR form, made anew on every update
+	PVS2D_Context* graphCtx;
+	// an update failed halfway, and the scene can only be freed
+	char broken;
+};
+
+// state of one update
+typedef struct _editWalk {
+	struct PVS2D_EditSceneState* ed;
+	// only the bounds stack of it is used: the half-planes from the root to the current node
+	_bspState path;
+	// old leaves next to the portals that were dropped, their PVS may change
+	PVS2D_BitsetWord* dirty;
+} _editWalk;
+
+static inline void _editMarkLeaf(_editWalk* walk, unsigned int leaf) {
+	if (walk->dirty && leaf != EDIT_NEW_LEAF) PVS2D_BitsetSet(walk->dirty, leaf);
+}
+
+static inline unsigned long long _editRootSeed(const PVS2D_BSPParams* params) {
+	// same as the one of PVS2D_BuildBSPTreeEx
+	return 0x9E3779B97F4A7C15ULL ^ params->seed;
+}
+
+static void _editFreeSegs(PVS2D_SegStack* segs) {
+	while (segs) {
+		PVS2D_SegStack* next = segs->next;
+		free(segs->seg);
+		free(segs);
+		segs = next;
+	}
+}
+
+// frees the portals of the node, marking the leaves next to them
+static void _editDropPortals(_editWalk* walk, PVS2D_BSPTreeNode* node) {
+	for (PVS2D_PortalStack* prt = node->portals; prt;) {
+		PVS2D_PortalStack* next = prt->next;
+		_editMarkLeaf(walk, prt->portal->leftLeaf);
+		_editMarkLeaf(walk, prt->portal->rightLeaf);
+		free(prt->portal);
+		free(prt);
+		prt = next;
+	}
+	node->portals = 0;
+}
+
+// frees everything below the node (and the node itself if `freeNode`), moving the pieces
+// of segments that are still alive to `segs`
+static void _editFreeSubtree(_editWalk* walk, PVS2D_BSPTreeNode* node, PVS2D_SegStack** segs, unsigned int* segsC, int freeNode) {
+	_editDropPortals(walk, node);
+	if (node->left) _editFreeSubtree(walk, node->left, segs, segsC, 1);
+	else _editMarkLeaf(walk, node->leftLeaf);
+	if (node->right) _editFreeSubtree(walk, node->right, segs, segsC, 1);
+	else _editMarkLeaf(walk, node->rightLeaf);
+	node->left = 0;
+	node->right = 0;
+	for (PVS2D_SegStack* cur = node->segs; cur;) {
+		PVS2D_SegStack* next = cur->next;
+		if (walk->ed->origins[cur->seg->id]) {
+			cur->next = *segs;
+			*segs = cur;
+			(*segsC)++;
+		}
+		else {
+			free(cur->seg);
+			free(cur);
+		}
+		cur = next;
+	}
+	node->segs = 0;
+	if (freeNode) free(node);
+}
+
+static void _editNewLeaves(PVS2D_BSPTreeNode* node) {
+	if (node->left) _editNewLeaves(node->left);
+	else node->leftLeaf = EDIT_NEW_LEAF;
+	if (node->right) _editNewLeaves(node->right);
+	else node->rightLeaf = EDIT_NEW_LEAF;
+}
+
+// builds the subtree of the node at the end of the current path
+static int _editBuild(_editWalk* walk, PVS2D_BSPTreeNode* node, PVS2D_SegStack* segs, unsigned int segsC, unsigned long long seed) {
+	PVS2D_BSPParams params = walk->ed->params;
+	if (segsC < EDIT_PARALLEL_SEGS) params.threadsC = 1;
+	int rez = _buildSubtree(0, &params, seed, walk->path.bounds, walk->path.boundsC, node, segs, segsC);
+	if (rez) return rez;	// error encountered
+	_editNewLeaves(node);
+	return 0;
+}
+
+// builds the subtree of the node anew out of the pieces that are left in it.
+// if there are none, the node's line is set to 0, and the node should be removed
+static int _editRebuild(_editWalk* walk, PVS2D_BSPTreeNode* node, unsigned long long seed) {
+	PVS2D_SegStack* segs = 0;
+	unsigned int segsC = 0;
+	_editFreeSubtree(walk, node, &segs, &segsC, 0);
+	if (!segs) {
+		node->line = 0;
+		return 0;
+	}
+	return _editBuild(walk, node, segs, segsC, seed);
+}
+
+// removes the pieces of the probes' segments from the subtree of the node, and rebuilds the
+// subtrees of the nodes that are left without segments. the node itself is left for the
+// caller to rebuild. returns 1 if the nodes below were changed, 0 if not, -1 on error
+static int _editRemove(_editWalk* walk, PVS2D_BSPTreeNode* node, unsigned long long seed, PVS2D_SegStack* probes) {
+	PVS2D_SegStack* col = 0, * sides[2] = { 0, 0 };
+	unsigned int sidesC[2] = { 0, 0 };
+	if (_partitionSegs(0, node->line, probes, &col, sides + 1, sidesC + 1, sides, sidesC)) return -1;
+	char segsChanged = 0;
+	for (PVS2D_SegStack* probe = col; probe; probe = probe->next) {
+		for (PVS2D_SegStack** cur = &node->segs; *cur;) {
+			if ((*cur)->seg->id == probe->seg->id) {
+				PVS2D_SegStack* piece = *cur;
+				*cur = piece->next;
+				free(piece->seg);
+				free(piece);
+				segsChanged = 1;
+			}
+			else {
+				cur = &(*cur)->next;
+			}
+		}
+	}
+	_editFreeSegs(col);
+	if (!node->segs) {
+		// the whole subtree is going to be rebuilt anyway
+		_editFreeSegs(sides[0]);
+		_editFreeSegs(sides[1]);
+		return 1;
+	}
+	int changed = 0;
+	for (int left = 0; left < 2; left++) {
+		PVS2D_BSPTreeNode** child = left ? &node->left : &node->right;
+		if (!sides[left]) continue;
+		if (!*child) {
+			// can't happen, the pieces of the probes are somewhere below
+			_editFreeSegs(sides[left]);
+			continue;
+		}
+		if (_pushBound(&walk->path, node->line, left)) return -1;
+		unsigned long long childSeed = _childSeed(seed, left);
+		int rez = _editRemove(walk, *child, childSeed, sides[left]);
+		if (rez < 0) return rez;	// error encountered
+		if (!(*child)->segs) {
+			if (_editRebuild(walk, *child, childSeed)) return -1;
+			if (!(*child)->line) {
+				free(*child);
+				*child = 0;
+				if (left) node->leftLeaf = EDIT_NEW_LEAF;
+				else node->rightLeaf = EDIT_NEW_LEAF;
+			}
+		}
+		walk->path.boundsC--;
+		changed |= rez;
+	}
+	if (segsChanged || changed) _editDropPortals(walk, node);
+	return changed;
+}
+
+// adds the pieces of the new segments to the subtree of the node. the ones that get to a
+// place where there is no node yet are built into new subtrees there.
+// returns 1 if the nodes below were changed, 0 if not, -1 on error
+static int _editInsert(_editWalk* walk, PVS2D_BSPTreeNode* node, unsigned long long seed, PVS2D_SegStack* segs) {
+	PVS2D_SegStack* col = 0, * sides[2] = { 0, 0 };
+	unsigned int sidesC[2] = { 0, 0 };
+	if (_partitionSegs(0, node->line, segs, &col, sides + 1, sidesC + 1, sides, sidesC)) return -1;
+	char segsChanged = col != 0;
+	while (col) {
+		PVS2D_SegStack* next = col->next;
+		col->next = node->segs;
+		node->segs = col;
+		col = next;
+	}
+	int changed = 0;
+	for (int left = 0; left < 2; left++) {
+		PVS2D_BSPTreeNode** child = left ? &node->left : &node->right;
+		if (!sides[left]) continue;
+		if (_pushBound(&walk->path, node->line, left)) return -1;
+		unsigned long long childSeed = _childSeed(seed, left);
+		int rez;
+		if (*child) {
+			rez = _editInsert(walk, *child, childSeed, sides[left]);
+			if (rez < 0) return rez;	// error encountered
+		}
+		else {
+			// the leaf is split by the new subtree
+			_editMarkLeaf(walk, left ? node->leftLeaf : node->rightLeaf);
+			PVS2D_BSPTreeNode* newNode = (PVS2D_BSPTreeNode*)malloc(sizeof(PVS2D_BSPTreeNode));
+			DBG_ASSERT(newNode, -1, "Failed to allocate new BSP tree node");
+			if (!newNode) return -1;
+			if (_editBuild(walk, newNode, sides[left], sidesC[left], childSeed)) {
+				free(newNode);
+				return -1;
+			}
+			*child = newNode;
+			rez = 1;
+		}
+		walk->path.boundsC--;
+		changed |= rez;
+	}
+	if (segsChanged || changed) _editDropPortals(walk, node);
+	return changed;
+}
+
+// pushes the portal down the subtree of the node, splitting it at the lines it crosses, and
+// sets the leaves on the given side of the pieces to the leaves they end in
+static int _sinkPortal(PVS2D_BSPTreeNode* node, PVS2D_PortalStack* elem, int left) {
+	PVS2D_Param t;
+	char side = _split(node->line, &elem->portal->seg, &t);
+	PVS2D_PortalStack* toSide[2] = { 0, 0 };
+	switch (side) {
+	case SIDE_L_PARAL:
+	case SIDE_L_FL:
+	case SIDE_L_FR:
+		toSide[1] = elem;
+		break;
+	case SIDE_R_PARAL:
+	case SIDE_R_FL:
+	case SIDE_R_FR:
+		toSide[0] = elem;
+		break;
+	case SIDE_S_FL:
+	case SIDE_S_FR:;
+		// the new piece goes right after this one, so the order of the portals is kept
+		PVS2D_PortalStack* newElem = (PVS2D_PortalStack*)malloc(sizeof(PVS2D_PortalStack));
+		DBG_ASSERT(newElem, -1, "Failed to create new portal stack node");
+		if (!newElem) return -1;
+		*newElem = *elem;
+		newElem->portal = (PVS2D_Portal*)malloc(sizeof(PVS2D_Portal));
+		if (!newElem->portal) {
+			free(newElem);
+			return -1;
+		}
+		*newElem->portal = *elem->portal;
+		_setPortalParams(newElem->portal, t, elem->portal->seg.exactEnd);
+		_setPortalParams(elem->portal, elem->portal->seg.exactStart, t);
+		elem->next = newElem;
+		// same as with segments, the part after the split point goes left for S_FL
+		toSide[side == SIDE_S_FL] = newElem;
+		toSide[side != SIDE_S_FL] = elem;
+		break;
+	default:
+		DBG_ASSERT(0, -1, "Portal can't lie on the line of a descendant");
+		return -1;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (!toSide[i]) continue;
+		PVS2D_BSPTreeNode* child = i ? node->left : node->right;
+		if (child) {
+			int rez = _sinkPortal(child, toSide[i], left);
+			if (rez) return rez;	// error encountered
+		}
+		else {
+			unsigned int leaf = i ? node->leftLeaf : node->rightLeaf;
+			if (left) toSide[i]->portal->leftLeaf = leaf;
+			else toSide[i]->portal->rightLeaf = leaf;
+		}
+	}
+	return 0;
+}
+
+// makes the portals of one node without touching the others. they are the same as the ones
+// of _buildPortals: the node's own portals split by the lines of both subtrees
+static int _editNodePortals(PVS2D_BSPTreeNode* node) {
+	PVS2D_PortalStack* portals = _portalsOfNode(0, node);
+	DBG_ASSERT(portals, -1, "Failed to create node's portals");
+	node->portals = portals;
+	// the right leaves go first, the pieces split off then get the left ones on their own
+	for (int left = 0; left < 2; left++) {
+		PVS2D_BSPTreeNode* child = left ? node->left : node->right;
+		PVS2D_PortalStack* next;
+		for (PVS2D_PortalStack* prt = portals; prt; prt = next) {
+			next = prt->next;
+			prt->left = 1;
+			if (child) {
+				if (_sinkPortal(child, prt, left)) return -1;
+			}
+			else if (left) {
+				prt->portal->leftLeaf = node->leftLeaf;
+			}
+			else {
+				prt->portal->rightLeaf = node->rightLeaf;
+			}
+		}
+	}
+	return 0;
+}
+
+// numbers the leaves left to right like _numberLeaves, and tells the new index of every old leaf that is kept
+static void _editNumberLeaves(PVS2D_BSPTreeNode* node, unsigned int* leafIndex, unsigned int* oldToNew) {
+	if (node->left) _editNumberLeaves(node->left, leafIndex, oldToNew);
+	else {
+		if (node->leftLeaf != EDIT_NEW_LEAF) oldToNew[node->leftLeaf] = *leafIndex;
+		node->leftLeaf = (*leafIndex)++;
+	}
+	if (node->right) _editNumberLeaves(node->right, leafIndex, oldToNew);
+	else {
+		if (node->rightLeaf != EDIT_NEW_LEAF) oldToNew[node->rightLeaf] = *leafIndex;
+		node->rightLeaf = (*leafIndex)++;
+	}
+}
+
+// renumbers the leaves of the kept portals and makes the dropped ones anew
+static int _editPortals(PVS2D_BSPTreeNode* node, const unsigned int* oldToNew) {
+	if (node->portals) {
+		for (PVS2D_PortalStack* prt = node->portals; prt; prt = prt->next) {
+			prt->portal->leftLeaf = oldToNew[prt->portal->leftLeaf];
+			prt->portal->rightLeaf = oldToNew[prt->portal->rightLeaf];
+		}
+	}
+	else if (_editNodePortals(node)) return -1;
+	if (node->left && _editPortals(node->left, oldToNew)) return -1;
+	if (node->right && _editPortals(node->right, oldToNew)) return -1;
+	return 0;
+}
+
+typedef struct _editPVS {
+	_allPVS all;
+	const unsigned int* leaves;
+} _editPVS;
+
+static void _editPVSBody(void* data, unsigned int thread, unsigned int index) {
+	_editPVS* edit = (_editPVS*)data;
+	_allPVSBody(&edit->all, thread, edit->leaves[index]);
+}
+
+// remaps the old PVS row to the new numbering. fails if it can change
+static int _editRemapRow(const PVS2D_BitsetWord* oldRow, unsigned int oldWordsC, const PVS2D_BitsetWord* dirty, const unsigned int* oldToNew, PVS2D_BitsetWord* row) {
+	for (unsigned int w = 0; w < oldWordsC; w++) {
+		if (oldRow[w] & dirty[w]) return -1;
+	}
+	for (unsigned int w = 0; w < oldWordsC; w++) {
+		for (PVS2D_BitsetWord bits = oldRow[w]; bits; bits &= bits - 1) {
+			unsigned int leaf = oldToNew[w * 64 + _ctz(bits)];
+			if (leaf == EDIT_NEW_LEAF) return -1;
+			PVS2D_BitsetSet(row, leaf);
+		}
+	}
+	return 0;
+}
+
+// numbers the leaves, makes the dropped portals, the leaf graph and the PVS rows that can change
+static int _editFinish(PVS2D_EditScene* scene, _editWalk* walk) {
+	struct PVS2D_EditSceneState* ed = scene->state;
+	unsigned int oldLeafC = scene->pvs ? scene->leafC : 0;
+	unsigned int* oldToNew = (unsigned int*)malloc(((size_t)oldLeafC + 1) * sizeof(unsigned int));
+	unsigned char* oldOob = (unsigned char*)malloc((size_t)oldLeafC + 1);
+	DBG_ASSERT(oldToNew && oldOob, -1, "Failed to allocate leaf maps");
+	if (!oldToNew || !oldOob) {
+		free(oldToNew);
+		free(oldOob);
+		return -1;
+	}
+	for (unsigned int i = 0; i < oldLeafC; i++) {
+		oldToNew[i] = EDIT_NEW_LEAF;
+	}
+	if (oldLeafC) memcpy(oldOob, scene->csr.oob, oldLeafC);
+	unsigned int leafC = 0;
+	_editNumberLeaves(&scene->root, &leafC, oldToNew);
+	int rez = _editPortals(&scene->root, oldToNew);
+
+	// the graph is linear in the number of portals, it is cheaper to make it anew than to patch it
+	if (!rez) {
+		PVS2D_ResetContext(ed->graphCtx);
+		unsigned int graphC;
+		scene->graph = PVS2D_BuildLeafGraphEx(ed->graphCtx, &scene->root, &graphC);
+		rez = scene->graph ? PVS2D_BuildCSRLeafGraph(ed->graphCtx, scene->graph, leafC, &scene->csr) : -1;
+	}
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC), oldWordsC = PVS2D_BITSET_WORDS(oldLeafC);
+	PVS2D_BitsetWord* pvs = 0;
+	unsigned int* newToOld = 0;
+	if (!rez) {
+		pvs = (PVS2D_BitsetWord*)calloc((size_t)leafC * wordsC, sizeof(PVS2D_BitsetWord));
+		newToOld = (unsigned int*)malloc((size_t)leafC * sizeof(unsigned int));
+		if (!pvs || !newToOld) rez = -1;
+	}
+	if (!rez) {
+		for (unsigned int i = 0; i < leafC; i++) {
+			newToOld[i] = EDIT_NEW_LEAF;
+		}
+		for (unsigned int i = 0; i < oldLeafC; i++) {
+			if (oldToNew[i] != EDIT_NEW_LEAF) newToOld[oldToNew[i]] = i;
+		}
+		// a row is kept if the leaf sees no leaf next to a changed portal, since any path that
+		// crossed a changed portal would have to go through such leaf. the rest go to `newToOld`,
+		// which is not needed anymore
+		unsigned int dirtyC = 0;
+		for (unsigned int i = 0; i < leafC; i++) {
+			unsigned int old = newToOld[i];
+			if (old == EDIT_NEW_LEAF || oldOob[old] != scene->csr.oob[i] ||
+				_editRemapRow(scene->pvs + (size_t)old * oldWordsC, oldWordsC, walk->dirty, oldToNew, pvs + (size_t)i * wordsC)) {
+				newToOld[dirtyC++] = i;
+			}
+		}
+		scene->dirtyC = dirtyC;
+		if (dirtyC) {
+			unsigned int threadsC = ed->params.threadsC ? ed->params.threadsC : _cpuCount();
+			if (threadsC > dirtyC) threadsC = dirtyC;
+			_editPVS edit;
+			edit.all.graph = &scene->csr;
+			edit.all.wordsC = wordsC;
+			edit.all.out = pvs;
+			edit.all.visited = (PVS2D_BitsetWord*)calloc((size_t)threadsC * wordsC, sizeof(PVS2D_BitsetWord));
+			edit.all.stacks = (_pvsStack*)calloc(threadsC, sizeof(_pvsStack));
+			edit.leaves = newToOld;
+			rez = edit.all.visited && edit.all.stacks ? _parallelForRun(dirtyC, threadsC, _editPVSBody, &edit) : -1;
+			if (edit.all.stacks) {
+				for (unsigned int i = 0; i < threadsC; i++) {
+					_pvsStackFree(edit.all.stacks + i);
+				}
+			}
+			free(edit.all.stacks);
+			free(edit.all.visited);
+		}
+	}
+	if (!rez) {
+		free(scene->pvs);
+		scene->pvs = pvs;
+		scene->leafC = leafC;
+	}
+	else {
+		free(pvs);
+	}
+	free(newToOld);
+	free(oldToNew);
+	free(oldOob);
+	return rez;
+}
+
+// makes the original of the segment and the piece of it for the tree
+static int _editAddSeg(struct PVS2D_EditSceneState* ed, const int* seg, PVS2D_SegStack** pieces) {
+	if (ed->originsC == ed->originsCap) {
+		unsigned int cap = ed->originsCap ? ed->originsCap * 2 : 64;
+		PVS2D_Seg** origins = (PVS2D_Seg**)realloc(ed->origins, cap * sizeof(PVS2D_Seg*));
+		DBG_ASSERT(origins, -1, "Failed to grow the segment array");
+		if (!origins) return -1;
+		ed->origins = origins;
+		ed->originsCap = cap;
+	}
+	PVS2D_Seg* origin = (PVS2D_Seg*)_alloc(ed->ctx, sizeof(PVS2D_Seg));
+	DBG_ASSERT(origin, -1, "Failed to allocate new segment");
+	if (!origin) return -1;
+	if (_makeSeg(ed->ctx, &ed->lines, seg[0], seg[1], seg[2], seg[3], seg[4], origin)) return -1;
+	origin->id = ed->originsC;
+	PVS2D_SegStack* piece = (PVS2D_SegStack*)malloc(sizeof(PVS2D_SegStack));
+	DBG_ASSERT(piece, -1, "Failed to allocate new segment stack node");
+	if (!piece) return -1;
+	piece->seg = (PVS2D_Seg*)malloc(sizeof(PVS2D_Seg));
+	if (!piece->seg) {
+		free(piece);
+		return -1;
+	}
+	*piece->seg = *origin;
+	piece->next = *pieces;
+	*pieces = piece;
+	ed->origins[ed->originsC++] = origin;
+	ed->aliveC++;
+	return 0;
+}
+
+static inline char _editSegValid(const int* seg) {
+	for (int i = 0; i < 4; i++) {
+		if (seg[i] < -PVS2D_MAX_COORD || seg[i] > PVS2D_MAX_COORD) return 0;
+	}
+	return seg[0] != seg[2] || seg[1] != seg[3];
+}
+
+int PVS2D_BuildEditScene(int* segs, unsigned int segsC, const PVS2D_BSPParams* params, PVS2D_EditScene* dest) {
+	DBG_ASSERT(dest, -1, "'dest' can't be nullptr");
+	DBG_ASSERT(segs && segsC, -1, "Scene can't be empty");
+	DBG_ASSERT(!params || params->policy != PVS2D_SPLIT_SAMPLED || params->sampleC, -1, "sampleC can't be 0");
+	memset(dest, 0, sizeof(PVS2D_EditScene));
+	for (unsigned int i = 0; i < segsC; i++) {
+		char valid = _editSegValid(segs + 5 * i);
+		DBG_ASSERT(valid, -1, "Segment is degenerate or out of range");
+		if (!valid) return -1;
+	}
+	struct PVS2D_EditSceneState* ed = (struct PVS2D_EditSceneState*)calloc(1, sizeof(struct PVS2D_EditSceneState));
+	DBG_ASSERT(ed, -1, "Failed to allocate scene state");
+	if (!ed) return -1;
+	dest->state = ed;
+	if (params) {
+		ed->params = *params;
+	}
+	else {
+		PVS2D_DefaultBSPParams(&ed->params);
+	}
+	ed->ctx = PVS2D_CreateContext();
+	ed->graphCtx = PVS2D_CreateContext();
+	int rez = ed->ctx && ed->graphCtx ? _lineTableInit(&ed->lines, segsC) : -1;
+	PVS2D_SegStack* pieces = 0;
+	for (unsigned int i = 0; i < segsC && !rez; i++) {
+		rez = _editAddSeg(ed, segs + 5 * i, &pieces);
+	}
+	_editWalk walk;
+	memset(&walk, 0, sizeof(walk));
+	walk.ed = ed;
+	if (!rez) {
+		rez = _editBuild(&walk, &dest->root, pieces, segsC, _editRootSeed(&ed->params));
+		pieces = 0;
+	}
+	if (!rez) rez = _editFinish(dest, &walk);
+	free(walk.path.bounds);
+	_editFreeSegs(pieces);
+	if (rez) PVS2D_FreeEditScene(dest);
+	return rez;
+}
+
+int PVS2D_UpdateEditScene(
+	PVS2D_EditScene* scene,
+	int* addSegs, unsigned int addC,
+	const unsigned int* removeIds, unsigned int removeC,
+	unsigned int* addIdsDest
+) {
+	DBG_ASSERT(scene && scene->state, -1, "'scene' must be built with PVS2D_BuildEditScene");
+	DBG_ASSERT(addSegs || !addC, -1, "'addSegs' can't be nullptr");
+	DBG_ASSERT(removeIds || !removeC, -1, "'removeIds' can't be nullptr");
+	struct PVS2D_EditSceneState* ed = scene->state;
+	if (ed->broken) return -1;
+	// everything is checked and allocated before the scene is changed, so these failures leave it as it was
+	for (unsigned int i = 0; i < addC; i++) {
+		char valid = _editSegValid(addSegs + 5 * i);
+		DBG_ASSERT(valid, -1, "Segment is degenerate or out of range");
+		if (!valid) return -1;
+	}
+	for (unsigned int i = 0; i < removeC; i++) {
+		char exists = removeIds[i] < ed->originsC && ed->origins[removeIds[i]];
+		DBG_ASSERT(exists, -1, "No segment with such id");
+		if (!exists) return -1;
+	}
+	PVS2D_Seg** removed = (PVS2D_Seg**)malloc(((size_t)removeC + 1) * sizeof(PVS2D_Seg*));
+	DBG_ASSERT(removed, -1, "Failed to allocate removed segments");
+	if (!removed) return -1;
+	unsigned int removedC = 0;
+	for (unsigned int i = 0; i < removeC; i++) {
+		PVS2D_Seg* origin = ed->origins[removeIds[i]];
+		if (!origin) continue;	// removed twice
+		ed->origins[removeIds[i]] = 0;
+		removed[removedC++] = origin;
+	}
+	_editWalk walk;
+	memset(&walk, 0, sizeof(walk));
+	walk.ed = ed;
+	// the probes are copies of the removed segments, they are split along the way down
+	// the same as the pieces of them were
+	PVS2D_SegStack* probes = 0;
+	int rez = removedC == ed->aliveC && !addC ? -1 : 0;
+	for (unsigned int i = 0; i < removedC && !rez; i++) {
+		PVS2D_SegStack* probe = (PVS2D_SegStack*)malloc(sizeof(PVS2D_SegStack));
+		PVS2D_Seg* seg = (PVS2D_Seg*)malloc(sizeof(PVS2D_Seg));
+		if (!probe || !seg) {
+			free(probe);
+			free(seg);
+			rez = -1;
+			break;
+		}
+		*seg = *removed[i];
+		probe->seg = seg;
+		probe->next = probes;
+		probes = probe;
+	}
+	if (!rez) {
+		walk.dirty = (PVS2D_BitsetWord*)calloc(PVS2D_BITSET_WORDS(scene->leafC) + 1, sizeof(PVS2D_BitsetWord));
+		if (!walk.dirty) rez = -1;
+	}
+	if (rez) {
+		for (unsigned int i = 0; i < removedC; i++) {
+			ed->origins[removed[i]->id] = removed[i];
+		}
+		_editFreeSegs(probes);
+		free(removed);
+		return -1;
+	}
+
+	// from here on the scene is changed, and a failure can't be undone
+	ed->aliveC -= removedC;
+	for (unsigned int i = 0; i < removedC; i++) {
+		// the removed segments are not members of their lines anymore
+		for (PVS2D_SegStack** mem = &removed[i]->line->mems; *mem; mem = &(*mem)->next) {
+			if ((*mem)->seg == removed[i]) {
+				*mem = (*mem)->next;
+				break;
+			}
+		}
+	}
+	free(removed);
+	unsigned long long seed = _editRootSeed(&ed->params);
+	if (probes) {
+		rez = _editRemove(&walk, &scene->root, seed, probes) < 0 ? -1 : 0;
+		if (!rez && !scene->root.segs) rez = _editRebuild(&walk, &scene->root, seed);
+	}
+	PVS2D_SegStack* pieces = 0;
+	unsigned int firstId = ed->originsC;
+	for (unsigned int i = 0; i < addC && !rez; i++) {
+		rez = _editAddSeg(ed, addSegs + 5 * i, &pieces);
+	}
+	if (!rez && pieces) {
+		if (scene->root.line) {
+			rez = _editInsert(&walk, &scene->root, seed, pieces) < 0 ? -1 : 0;
+		}
+		else {
+			// everything was removed
+			rez = _editBuild(&walk, &scene->root, pieces, addC, seed);
+		}
+		pieces = 0;
+	}
+	if (!rez) rez = _editFinish(scene, &walk);
+	if (!rez && addIdsDest) {
+		for (unsigned int i = 0; i < addC; i++) {
+			addIdsDest[i] = firstId + i;
+		}
+	}
+	if (rez) ed->broken = 1;
+	_editFreeSegs(pieces);
+	free(walk.path.bounds);
+	free(walk.dirty);
+	return rez;
+}
+
+void PVS2D_FreeEditScene(PVS2D_EditScene* scene) {
+	struct PVS2D_EditSceneState* ed = scene->state;
+	if (!ed) return;
+	if (scene->root.line) {
+		_editWalk walk;
+		memset(&walk, 0, sizeof(walk));
+		walk.ed = ed;
+		PVS2D_SegStack* segs = 0;
+		unsigned int segsC = 0;
+		_editFreeSubtree(&walk, &scene->root, &segs, &segsC, 0);
+		_editFreeSegs(segs);
+	}
+	free(scene->pvs);
+	if (ed->ctx) PVS2D_FreeContext(ed->ctx);
+	if (ed->graphCtx) PVS2D_FreeContext(ed->graphCtx);
+	free(ed->lines.slots);
+	free(ed->origins);
+	free(ed);
+	memset(scene, 0, sizeof(PVS2D_EditScene));
 }
@@ -0,0 +1,98 @@
+// checks that PVS2D_BuildAllPVS and PVS2D_BuildAllPVSCSR give the same matrix for any number of threads,
+// and that every row of it is the PVS of the leaf computed on its own. the threads are shut down
+// after every run, so they are started again by the next one
+
+#include "maps.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAZE_N 14
+#define CELL 16
+
+static const unsigned int threadsCs[] = { 1, 2, 8 };
+
+// compares the matrix with the PVS of every leaf, the rows of the out of bounds leaves must be empty
+static int _checkRows(const PVS2D_LeafGraphNode* graph, unsigned int leafC, const PVS2D_BitsetWord* matrix, const PVS2D_BitsetWord* const* rows, const char* what) {
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC);
+	for (unsigned int i = 0; i < leafC; i++) {
+		const PVS2D_BitsetWord* row = matrix + (size_t)i * wordsC;
+		char same = 1;
+		for (unsigned int w = 0; w < wordsC; w++) {
+			if (row[w] != (graph[i].oob ? 0 : rows[i][w])) same = 0;
+		}
+		if (!same) {
+			printf("%s: row of leaf %u differs\n", what, i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(void) {
+	unsigned int segsC;
+	int* segs = _genMaze(MAZE_N, CELL, 1, &segsC, 0);
+	if (!segs) return 1;
+	PVS2D_BSPTreeNode root;
+	unsigned int leafC;
+	if (PVS2D_BuildBSPTree(segs, segsC, &root) || PVS2D_BuildPortals(&root)) {
+		printf("failed to build the tree\n");
+		return 1;
+	}
+	PVS2D_LeafGraphNode* graph = PVS2D_BuildLeafGraph(&root, &leafC);
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC);
+	PVS2D_BitsetWord** rows = (PVS2D_BitsetWord**)calloc(leafC, sizeof(PVS2D_BitsetWord*));
+	PVS2D_BitsetWord* matrix = (PVS2D_BitsetWord*)malloc((size_t)leafC * wordsC * sizeof(PVS2D_BitsetWord));
+	if (!graph || !rows || !matrix) return 1;
+	for (unsigned int i = 0; i < leafC; i++) {
+		if (graph[i].oob) continue;
+		rows[i] = PVS2D_GetLeafPVSBits(graph + i, leafC);
+		if (!rows[i]) return 1;
+	}
+
+	PVS2D_CSRLeafGraph csr;
+	PVS2D_BitsetWord** csrRows = (PVS2D_BitsetWord**)calloc(leafC, sizeof(PVS2D_BitsetWord*));
+	if (!csrRows || PVS2D_BuildCSRLeafGraph(0, graph, leafC, &csr)) return 1;
+	for (unsigned int i = 0; i < leafC; i++) {
+		if (graph[i].oob) continue;
+		csrRows[i] = PVS2D_GetLeafPVSBitsCSR(&csr, i);
+		if (!csrRows[i]) return 1;
+	}
+
+	int failed = 0;
+	char what[64];
+	for (unsigned int k = 0; k < sizeof(threadsCs) / sizeof(threadsCs[0]); k++) {
+		snprintf(what, sizeof(what), "PVS2D_BuildAllPVS, %u threads", threadsCs[k]);
+		// garbage in the matrix, so the rows must be written entirely
+		memset(matrix, 0xA5, (size_t)leafC * wordsC * sizeof(PVS2D_BitsetWord));
+		if (PVS2D_BuildAllPVS(graph, leafC, threadsCs[k], matrix)) {
+			printf("%s failed\n", what);
+			failed = 1;
+			continue;
+		}
+		failed |= _checkRows(graph, leafC, matrix, (const PVS2D_BitsetWord* const*)rows, what);
+
+		snprintf(what, sizeof(what), "PVS2D_BuildAllPVSCSR, %u threads", threadsCs[k]);
+		memset(matrix, 0xA5, (size_t)leafC * wordsC * sizeof(PVS2D_BitsetWord));
+		if (PVS2D_BuildAllPVSCSR(&csr, threadsCs[k], PVS2D_PVS_BRUTE, matrix)) {
+			printf("%s failed\n", what);
+			failed = 1;
+			continue;
+		}
+		failed |= _checkRows(graph, leafC, matrix, (const PVS2D_BitsetWord* const*)csrRows, what);
+		// the next run starts the workers again
+		PVS2D_ShutdownThreads();
+	}
+
+	for (unsigned int i = 0; i < leafC; i++) {
+		free(rows[i]);
+		free(csrRows[i]);
+	}
+	free(rows);
+	free(csrRows);
+	free(csr.x1);
+	free(matrix);
+	free(segs);
+	printf(failed ? "FAILED\n" : "OK\n");
+	return failed;
+}
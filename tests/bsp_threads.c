@@ -0,0 +1,73 @@
+// checks that the parallel build gives the same tree for any number of threads: the maze is built
+// with 1, 2 and 8 threads for both splitter policies, and the baked trees must be equal byte for byte.
+// the splitter scoring (SIMD or not) runs in the workers too, so it must not depend on the thread either
+
+#include "maps.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAZE_N 32
+#define CELL 16
+
+static const unsigned int threadsCs[] = { 1, 2, 8 };
+
+// builds and bakes the tree, the nodes are copied out of the context
+static PVS2D_BakedNode* _buildBaked(int* segs, unsigned int segsC, const PVS2D_BSPParams* params, unsigned int* nodesCDest) {
+	PVS2D_Context* ctx = PVS2D_CreateContext();
+	if (!ctx) return 0;
+	PVS2D_BSPTreeNode root;
+	PVS2D_BakedBSPTree baked;
+	PVS2D_BakedNode* nodes = 0;
+	if (!PVS2D_BuildBSPTreeEx(ctx, segs, segsC, params, &root) && !PVS2D_BakeBSPTree(ctx, &root, &baked)) {
+		nodes = (PVS2D_BakedNode*)malloc(baked.nodesC * sizeof(PVS2D_BakedNode));
+		if (nodes) {
+			memcpy(nodes, baked.nodes, baked.nodesC * sizeof(PVS2D_BakedNode));
+			*nodesCDest = baked.nodesC;
+		}
+	}
+	PVS2D_FreeContext(ctx);
+	return nodes;
+}
+
+int main(void) {
+	unsigned int segsC;
+	int* segs = _genMaze(MAZE_N, CELL, 1, &segsC, 0);
+	if (!segs) return 1;
+
+	int failed = 0;
+	for (unsigned int policy = PVS2D_SPLIT_EXHAUSTIVE; policy <= PVS2D_SPLIT_SAMPLED; policy++) {
+		PVS2D_BSPParams params;
+		PVS2D_DefaultBSPParams(&params);
+		params.policy = (PVS2D_SplitPolicy)policy;
+		params.seed = 7;
+		const char* name = policy == PVS2D_SPLIT_SAMPLED ? "PVS2D_SPLIT_SAMPLED" : "PVS2D_SPLIT_EXHAUSTIVE";
+		PVS2D_BakedNode* first = 0;
+		unsigned int firstC = 0;
+		for (unsigned int k = 0; k < sizeof(threadsCs) / sizeof(threadsCs[0]); k++) {
+			params.threadsC = threadsCs[k];
+			unsigned int nodesC = 0;
+			PVS2D_BakedNode* nodes = _buildBaked(segs, segsC, &params, &nodesC);
+			if (!nodes) {
+				printf("%s, %u threads: failed to build the tree\n", name, threadsCs[k]);
+				failed = 1;
+				continue;
+			}
+			if (!first) {
+				first = nodes;
+				firstC = nodesC;
+				continue;
+			}
+			if (nodesC != firstC || memcmp(nodes, first, nodesC * sizeof(PVS2D_BakedNode))) {
+				printf("%s, %u threads: the tree differs from the one of %u threads\n", name, threadsCs[k], threadsCs[0]);
+				failed = 1;
+			}
+			free(nodes);
+		}
+		free(first);
+	}
+
+	free(segs);
+	printf(failed ? "FAILED\n" : "OK\n");
+	return failed;
+}
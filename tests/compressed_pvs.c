@@ -0,0 +1,119 @@
+// compresses random matrices and checks that PVS2D_CompressedPVSTest, PVS2D_CompressedPVSList and
+// PVS2D_CompressedPVSRow give back the source for every pair. the matrices are sparse ones with
+// more than 2040 leaves, so an empty stretch of a row takes several zero runs of 255 bytes, dense
+// ones, and ones made of short zero runs, many of which straddle the 16 byte checkpoints of the index
+
+#include "maps.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	SPARSE,
+	DENSE,
+	SHORT_RUNS
+};
+
+// fills the matrix, the bits past the last leaf stay 0
+static void _fillMatrix(PVS2D_BitsetWord* matrix, unsigned int leafC, int kind) {
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC);
+	memset(matrix, 0, (size_t)leafC * wordsC * sizeof(PVS2D_BitsetWord));
+	for (unsigned int i = 0; i < leafC; i++) {
+		PVS2D_BitsetWord* row = matrix + (size_t)i * wordsC;
+		if (kind == SHORT_RUNS) {
+			// a random byte, or 1 to 3 zero bytes
+			for (unsigned int byte = 0; byte * 8 < leafC;) {
+				if (_rand(2)) {
+					byte += 1 + _rand(3);
+					continue;
+				}
+				for (unsigned int bit = byte * 8; bit < byte * 8 + 8 && bit < leafC; bit++) {
+					if (_rand(2)) PVS2D_BitsetSet(row, bit);
+				}
+				// at least one bit, so the byte doesn't extend the runs around it
+				PVS2D_BitsetSet(row, byte * 8 + _rand(byte * 8 + 8 <= leafC ? 8 : leafC - byte * 8));
+				byte++;
+			}
+			continue;
+		}
+		// a few rows are empty or full, the rest are random
+		unsigned int density = _rand(16) ? (kind == SPARSE ? 1 + _rand(3) : 50 + _rand(50)) : (_rand(2) ? 0 : 100);
+		for (unsigned int j = 0; j < leafC; j++) {
+			if (kind == SPARSE ? _rand(1000) < density : _rand(100) < density) PVS2D_BitsetSet(row, j);
+		}
+	}
+}
+
+// the zero runs of the compressed rows whose count is the first byte of a checkpoint
+static unsigned int _straddlingRuns(const PVS2D_CompressedPVS* cpvs) {
+	unsigned int c = 0;
+	for (unsigned int o = 0; o < cpvs->rowStart[cpvs->leafC];) {
+		if (cpvs->rows[o]) {
+			o++;
+			continue;
+		}
+		if ((o + 1) % 16 == 0) c++;
+		o += 2;
+	}
+	return c;
+}
+
+static int _check(unsigned int leafC, int kind, const char* what) {
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC);
+	PVS2D_BitsetWord* matrix = (PVS2D_BitsetWord*)malloc((size_t)leafC * wordsC * sizeof(PVS2D_BitsetWord));
+	PVS2D_BitsetWord* row = (PVS2D_BitsetWord*)malloc(wordsC * sizeof(PVS2D_BitsetWord));
+	unsigned int* list = (unsigned int*)malloc(leafC * sizeof(unsigned int));
+	if (!matrix || !row || !list) return 1;
+	_fillMatrix(matrix, leafC, kind);
+	PVS2D_CompressedPVS cpvs;
+	if (PVS2D_CompressPVS(0, matrix, leafC, &cpvs)) {
+		printf("%s: failed to compress\n", what);
+		return 1;
+	}
+
+	int failsC = 0;
+	for (unsigned int i = 0; i < leafC && failsC < 10; i++) {
+		const PVS2D_BitsetWord* src = matrix + (size_t)i * wordsC;
+		for (unsigned int j = 0; j < leafC; j++) {
+			if (PVS2D_CompressedPVSTest(&cpvs, i, j) != (PVS2D_BitsetTest(src, j) != 0)) {
+				if (failsC++ < 10) printf("%s: PVS2D_CompressedPVSTest of leaves %u, %u\n", what, i, j);
+			}
+		}
+		unsigned int listC = PVS2D_CompressedPVSList(&cpvs, i, list);
+		unsigned int k = 0;
+		for (unsigned int j = 0; j < leafC; j++) {
+			if (!PVS2D_BitsetTest(src, j)) continue;
+			if (k >= listC || list[k] != j) break;
+			k++;
+		}
+		if (k != listC || listC != PVS2D_BitsetCount(src, wordsC)) {
+			if (failsC++ < 10) printf("%s: PVS2D_CompressedPVSList of leaf %u\n", what, i);
+		}
+		memset(row, 0xA5, wordsC * sizeof(PVS2D_BitsetWord));
+		if (PVS2D_CompressedPVSRow(&cpvs, i, row) || memcmp(row, src, wordsC * sizeof(PVS2D_BitsetWord))) {
+			if (failsC++ < 10) printf("%s: PVS2D_CompressedPVSRow of leaf %u\n", what, i);
+		}
+	}
+	if (kind == SHORT_RUNS && !_straddlingRuns(&cpvs)) {
+		printf("%s: no zero run straddles a checkpoint\n", what);
+		failsC++;
+	}
+
+	free(cpvs.rowStart);
+	free(list);
+	free(row);
+	free(matrix);
+	return failsC != 0;
+}
+
+int main(void) {
+	int failed = 0;
+	failed |= _check(1, DENSE, "1 leaf");
+	failed |= _check(3001, SPARSE, "sparse, 3001 leaves");
+	failed |= _check(4096, SPARSE, "sparse, 4096 leaves");
+	failed |= _check(333, DENSE, "dense, 333 leaves");
+	failed |= _check(1000, SHORT_RUNS, "short zero runs, 1000 leaves");
+	failed |= _check(2045, SHORT_RUNS, "short zero runs, 2045 leaves");
+	printf(failed ? "FAILED\n" : "OK\n");
+	return failed;
+}
@@ -0,0 +1,201 @@
+// toggles doors and checks PVS2D_FilterPVSByDoors and PVS2D_FilterSceneByDoors on a loaded scene:
+// the filtered row must be a subset of the baked one, equal to it when all doors are open, and
+// closing more doors can only take leaves away. in two rooms joined only by a door, closing it
+// must drop every leaf of the other room
+
+#include "maps.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAZE_N 10
+#define CELL 16
+#define STATES_C 40
+
+typedef struct _scene {
+	PVS2D_BSPTreeNode root;
+	unsigned int leafC, wordsC;
+	PVS2D_LeafGraphNode* graph;
+	PVS2D_CSRLeafGraph csr;
+	PVS2D_BitsetWord* pvs;
+	PVS2D_Scene loaded;
+} _scene;
+
+static int _buildScene(int* segs, unsigned int segsC, _scene* scene) {
+	if (PVS2D_BuildBSPTree(segs, segsC, &scene->root) || PVS2D_BuildPortals(&scene->root)) return -1;
+	scene->graph = PVS2D_BuildLeafGraph(&scene->root, &scene->leafC);
+	if (!scene->graph || PVS2D_BuildCSRLeafGraph(0, scene->graph, scene->leafC, &scene->csr)) return -1;
+	scene->wordsC = PVS2D_BITSET_WORDS(scene->leafC);
+	scene->pvs = (PVS2D_BitsetWord*)malloc((size_t)scene->leafC * scene->wordsC * sizeof(PVS2D_BitsetWord));
+	if (!scene->pvs || PVS2D_BuildAllPVS(scene->graph, scene->leafC, 1, scene->pvs)) return -1;
+	void* data;
+	size_t size;
+	if (PVS2D_SaveScene(&scene->root, scene->graph, scene->leafC, scene->pvs, &data, &size)) return -1;
+	int rez = PVS2D_LoadScene(data, size, &scene->loaded);
+	free(data);
+	return rez;
+}
+
+static void _freeScene(_scene* scene) {
+	PVS2D_FreeScene(&scene->loaded);
+	free(scene->pvs);
+	free(scene->csr.x1);
+}
+
+// filters the row of the leaf both ways, the results must be the same
+static int _filter(_scene* scene, unsigned int leaf, const PVS2D_BitsetWord* openDoors, PVS2D_BitsetWord* out, PVS2D_BitsetWord* tmp) {
+	const PVS2D_BitsetWord* row = scene->pvs + (size_t)leaf * scene->wordsC;
+	if (PVS2D_FilterPVSByDoors(&scene->csr, row, leaf, openDoors, out)) {
+		printf("PVS2D_FilterPVSByDoors failed for leaf %u\n", leaf);
+		return 1;
+	}
+	if (PVS2D_CompressedPVSRow(&scene->loaded.pvs, leaf, tmp) || memcmp(tmp, row, scene->wordsC * sizeof(PVS2D_BitsetWord))) {
+		printf("the PVS of leaf %u in the loaded scene differs\n", leaf);
+		return 1;
+	}
+	if (PVS2D_FilterSceneByDoors(&scene->loaded, row, leaf, openDoors, tmp)) {
+		printf("PVS2D_FilterSceneByDoors failed for leaf %u\n", leaf);
+		return 1;
+	}
+	if (memcmp(tmp, out, scene->wordsC * sizeof(PVS2D_BitsetWord))) {
+		printf("leaf %u: PVS2D_FilterSceneByDoors differs from PVS2D_FilterPVSByDoors\n", leaf);
+		return 1;
+	}
+	return 0;
+}
+
+static char _isSubset(const PVS2D_BitsetWord* a, const PVS2D_BitsetWord* b, unsigned int wordsC) {
+	for (unsigned int w = 0; w < wordsC; w++) {
+		if (a[w] & ~b[w]) return 0;
+	}
+	return 1;
+}
+
+// two rooms, the only way between them is the door in the middle of the wall at x = 32
+static int _checkTwoRooms(void) {
+	static int segs[] = {
+		0, 0, 64, 0, 1,
+		64, 0, 64, 32, 1,
+		64, 32, 0, 32, 1,
+		0, 32, 0, 0, 1,
+		32, 0, 32, 12, 1,
+		32, 32, 32, 20, 1,
+		32, 12, 32, 20, PVS2D_DOOR(0),
+	};
+	_scene scene;
+	if (_buildScene(segs, sizeof(segs) / sizeof(segs[0]) / 5, &scene)) {
+		printf("two rooms: failed to build the scene\n");
+		return 1;
+	}
+	PVS2D_BitsetWord* out = (PVS2D_BitsetWord*)malloc(scene.wordsC * sizeof(PVS2D_BitsetWord));
+	PVS2D_BitsetWord* tmp = (PVS2D_BitsetWord*)malloc(scene.wordsC * sizeof(PVS2D_BitsetWord));
+	if (!out || !tmp) return 1;
+	int failed = 0;
+	for (unsigned int side = 0; side < 2 && !failed; side++) {
+		unsigned int leaf = PVS2D_FindLeafOfPoint(&scene.root, side ? 48.5 : 16.5, 16.5);
+		unsigned int other = PVS2D_FindLeafOfPoint(&scene.root, side ? 16.5 : 48.5, 16.5);
+		const PVS2D_BitsetWord* row = scene.pvs + (size_t)leaf * scene.wordsC;
+		if (!PVS2D_BitsetTest(row, other)) {
+			printf("two rooms: the other room isn't in the PVS\n");
+			failed = 1;
+			break;
+		}
+		for (PVS2D_BitsetWord open = 0; open < 2 && !failed; open++) {
+			failed |= _filter(&scene, leaf, &open, out, tmp);
+			if (failed) break;
+			if (!_isSubset(out, row, scene.wordsC)) {
+				printf("two rooms: the filtered row isn't a subset of the PVS\n");
+				failed = 1;
+			}
+			// the leaves of every point in the other room
+			for (int x = 1; x < 32 && !failed; x += 2) {
+				for (int y = 1; y < 32 && !failed; y += 2) {
+					double px = side ? x + 0.5 : x + 32.5, py = y + 0.5;
+					unsigned int seen = PVS2D_FindLeafOfPoint(&scene.root, px, py);
+					if (!open && PVS2D_BitsetTest(out, seen)) {
+						printf("two rooms: leaf %u of point (%g, %g) is seen through the closed door\n", seen, px, py);
+						failed = 1;
+					}
+				}
+			}
+			if (open && !PVS2D_BitsetTest(out, other)) {
+				printf("two rooms: the other room isn't seen through the open door\n");
+				failed = 1;
+			}
+			if (!PVS2D_BitsetTest(out, leaf)) {
+				printf("two rooms: leaf %u doesn't see itself\n", leaf);
+				failed = 1;
+			}
+		}
+	}
+	free(tmp);
+	free(out);
+	_freeScene(&scene);
+	return failed;
+}
+
+int main(void) {
+	int failed = _checkTwoRooms();
+
+	unsigned int segsC, doorsC;
+	int* segs = _genMaze(MAZE_N, CELL, 1, &segsC, &doorsC);
+	_scene scene;
+	if (!segs || _buildScene(segs, segsC, &scene)) {
+		printf("maze: failed to build the scene\n");
+		return 1;
+	}
+	unsigned int doorWordsC = PVS2D_BITSET_WORDS(doorsC);
+	PVS2D_BitsetWord* open = (PVS2D_BitsetWord*)malloc(doorWordsC * sizeof(PVS2D_BitsetWord));
+	PVS2D_BitsetWord* fewer = (PVS2D_BitsetWord*)malloc(doorWordsC * sizeof(PVS2D_BitsetWord));
+	PVS2D_BitsetWord* out = (PVS2D_BitsetWord*)malloc(scene.wordsC * sizeof(PVS2D_BitsetWord));
+	PVS2D_BitsetWord* outFewer = (PVS2D_BitsetWord*)malloc(scene.wordsC * sizeof(PVS2D_BitsetWord));
+	PVS2D_BitsetWord* tmp = (PVS2D_BitsetWord*)malloc(scene.wordsC * sizeof(PVS2D_BitsetWord));
+	if (!open || !fewer || !out || !outFewer || !tmp) return 1;
+	unsigned int droppedC = 0;
+	for (unsigned int s = 0; s < STATES_C && !failed; s++) {
+		// the first state has all doors open, the rest are random. then some of the open doors are closed
+		memset(open, 0, doorWordsC * sizeof(PVS2D_BitsetWord));
+		memset(fewer, 0, doorWordsC * sizeof(PVS2D_BitsetWord));
+		for (unsigned int d = 0; d < doorsC; d++) {
+			if (s && _rand(2)) continue;
+			PVS2D_BitsetSet(open, d);
+			if (_rand(4)) PVS2D_BitsetSet(fewer, d);
+		}
+		for (unsigned int leaf = 0; leaf < scene.leafC && !failed; leaf++) {
+			if (scene.csr.oob[leaf]) continue;
+			const PVS2D_BitsetWord* row = scene.pvs + (size_t)leaf * scene.wordsC;
+			failed |= _filter(&scene, leaf, open, out, tmp);
+			failed |= _filter(&scene, leaf, fewer, outFewer, tmp);
+			if (failed) break;
+			if (!_isSubset(out, row, scene.wordsC) || !PVS2D_BitsetTest(out, leaf)) {
+				printf("maze: the filtered row of leaf %u isn't a subset of the PVS\n", leaf);
+				failed = 1;
+			}
+			if (!s && memcmp(out, row, scene.wordsC * sizeof(PVS2D_BitsetWord))) {
+				printf("maze: with all doors open the filtered row of leaf %u differs from the PVS\n", leaf);
+				failed = 1;
+			}
+			if (!_isSubset(outFewer, out, scene.wordsC)) {
+				printf("maze: closing more doors adds leaves to the row of leaf %u\n", leaf);
+				failed = 1;
+			}
+			droppedC += PVS2D_BitsetCount(out, scene.wordsC) - PVS2D_BitsetCount(outFewer, scene.wordsC);
+		}
+	}
+	// the doors must matter at all
+	if (!failed && !droppedC) {
+		printf("maze: closing doors never drops a leaf\n");
+		failed = 1;
+	}
+	printf("%u doors, %u leaves dropped by closing them\n", doorsC, droppedC);
+
+	free(tmp);
+	free(outFewer);
+	free(out);
+	free(fewer);
+	free(open);
+	_freeScene(&scene);
+	free(segs);
+	printf(failed ? "FAILED\n" : "OK\n");
+	return failed;
+}
@@ -0,0 +1,241 @@
+// checks PVS2D_UpdateEditScene with random batches of added and removed segments.
+// an updated tree isn't rebalanced, so in general it differs from the one built from scratch, and so
+// do its leaves. so after every batch the scene is checked in three ways:
+// - its graph and PVS are the same as the ones built from scratch out of its own tree;
+// - adding a batch and removing it again gives back exactly the same leaves, graph and PVS. on the first
+//   batch that is the scene built by PVS2D_BuildEditScene out of the initial segments;
+// - the PVS contains every pair of points that see each other, as the one of PVS2D_BuildEditScene
+//   built from scratch out of the same segments, and both agree on which points are out of bounds.
+// also an update with an unknown segment id must fail and leave the scene as it was
+
+#include "maps.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAZE_N 6
+#define CELL 16
+#define BATCHES_C 40
+#define BATCH_MAX 4
+#define PAIRS_C 3000
+
+// copies of the arrays of a scene, to compare it with after updates
+typedef struct _snapshot {
+	PVS2D_CSRLeafGraph csr;
+	PVS2D_BitsetWord* pvs;
+	void* block;
+} _snapshot;
+
+static int _takeSnapshot(const PVS2D_CSRLeafGraph* csr, const PVS2D_BitsetWord* pvs, _snapshot* dest) {
+	unsigned int leafC = csr->leafC, edgesC = csr->adjStart[leafC];
+	size_t pvsSize = (size_t)leafC * PVS2D_BITSET_WORDS(leafC) * sizeof(PVS2D_BitsetWord);
+	size_t size = pvsSize + 4 * edgesC * sizeof(double) + (leafC + 1 + 2 * edgesC) * sizeof(unsigned int) + leafC;
+	unsigned char* block = (unsigned char*)malloc(size);
+	if (!block) return -1;
+	dest->block = block;
+	dest->pvs = (PVS2D_BitsetWord*)block;
+	memcpy(dest->pvs, pvs, pvsSize);
+	block += pvsSize;
+	double** coords[4] = { &dest->csr.x1, &dest->csr.y1, &dest->csr.x2, &dest->csr.y2 };
+	const double* srcCoords[4] = { csr->x1, csr->y1, csr->x2, csr->y2 };
+	for (unsigned int i = 0; i < 4; i++) {
+		*coords[i] = (double*)block;
+		memcpy(block, srcCoords[i], edgesC * sizeof(double));
+		block += edgesC * sizeof(double);
+	}
+	dest->csr.leafC = leafC;
+	dest->csr.adjStart = (unsigned int*)memcpy(block, csr->adjStart, (leafC + 1) * sizeof(unsigned int));
+	block += (leafC + 1) * sizeof(unsigned int);
+	dest->csr.leaf = (unsigned int*)memcpy(block, csr->leaf, edgesC * sizeof(unsigned int));
+	block += edgesC * sizeof(unsigned int);
+	dest->csr.door = (unsigned int*)memcpy(block, csr->door, edgesC * sizeof(unsigned int));
+	block += edgesC * sizeof(unsigned int);
+	dest->csr.oob = (unsigned char*)memcpy(block, csr->oob, leafC);
+	return 0;
+}
+
+// compares the leaf graphs edge by edge, and the PVS matrices
+static int _sameScenes(const PVS2D_CSRLeafGraph* a, const PVS2D_BitsetWord* pvsA, const PVS2D_CSRLeafGraph* b, const PVS2D_BitsetWord* pvsB) {
+	if (a->leafC != b->leafC) return 0;
+	unsigned int leafC = a->leafC, edgesC = a->adjStart[leafC];
+	if (memcmp(a->adjStart, b->adjStart, (leafC + 1) * sizeof(unsigned int))) return 0;
+	if (memcmp(a->oob, b->oob, leafC)) return 0;
+	if (memcmp(a->leaf, b->leaf, edgesC * sizeof(unsigned int)) || memcmp(a->door, b->door, edgesC * sizeof(unsigned int))) return 0;
+	if (memcmp(a->x1, b->x1, edgesC * sizeof(double)) || memcmp(a->y1, b->y1, edgesC * sizeof(double))) return 0;
+	if (memcmp(a->x2, b->x2, edgesC * sizeof(double)) || memcmp(a->y2, b->y2, edgesC * sizeof(double))) return 0;
+	return !memcmp(pvsA, pvsB, (size_t)leafC * PVS2D_BITSET_WORDS(leafC) * sizeof(PVS2D_BitsetWord));
+}
+
+// builds the graph and the PVS out of the tree of the scene from scratch, and compares them with the scene
+static int _checkOwnTree(PVS2D_EditScene* scene) {
+	PVS2D_Context* ctx = PVS2D_CreateContext();
+	if (!ctx) return 0;
+	unsigned int leafC;
+	PVS2D_CSRLeafGraph csr;
+	PVS2D_LeafGraphNode* graph = PVS2D_BuildLeafGraphEx(ctx, &scene->root, &leafC);
+	size_t pvsSize = (size_t)leafC * PVS2D_BITSET_WORDS(leafC) * sizeof(PVS2D_BitsetWord);
+	PVS2D_BitsetWord* pvs = (PVS2D_BitsetWord*)malloc(pvsSize);
+	int same = graph && pvs && leafC == scene->leafC &&
+		!PVS2D_BuildCSRLeafGraph(ctx, graph, leafC, &csr) &&
+		!PVS2D_BuildAllPVSCSR(&csr, 1, PVS2D_PVS_BRUTE, pvs) &&
+		_sameScenes(&csr, pvs, &scene->csr, scene->pvs);
+	free(pvs);
+	PVS2D_FreeContext(ctx);
+	return same;
+}
+
+static double _cross(double ax, double ay, double bx, double by, double cx, double cy) {
+	return (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+}
+
+// whether the segment between the points doesn't touch any opaque segment
+static int _seeEachOther(const int* segs, unsigned int segsC, double px, double py, double qx, double qy) {
+	for (unsigned int i = 0; i < segsC; i++) {
+		const int* s = segs + 5 * i;
+		if (s[4] <= 0) continue;
+		double d1 = _cross(px, py, qx, qy, s[0], s[1]), d2 = _cross(px, py, qx, qy, s[2], s[3]);
+		double d3 = _cross(s[0], s[1], s[2], s[3], px, py), d4 = _cross(s[0], s[1], s[2], s[3], qx, qy);
+		// the coordinates are multiples of 1/256 and small, so the products are exact
+		if ((d1 > 0) != (d2 > 0) || d1 == 0 || d2 == 0) {
+			if ((d3 > 0) != (d4 > 0) || d3 == 0 || d4 == 0) return 0;
+		}
+	}
+	return 1;
+}
+
+static int _checkPairs(PVS2D_EditScene* scene, PVS2D_EditScene* ref, const int* segs, unsigned int segsC) {
+	unsigned int wordsC = PVS2D_BITSET_WORDS(scene->leafC), refWordsC = PVS2D_BITSET_WORDS(ref->leafC);
+	for (unsigned int i = 0; i < PAIRS_C; i++) {
+		double px = _rand(MAZE_N * CELL * 256) / 256.0, py = _rand(MAZE_N * CELL * 256) / 256.0;
+		double qx = _rand(MAZE_N * CELL * 256) / 256.0, qy = _rand(MAZE_N * CELL * 256) / 256.0;
+		unsigned int p = PVS2D_FindLeafOfPoint(&scene->root, px, py), q = PVS2D_FindLeafOfPoint(&scene->root, qx, qy);
+		unsigned int refP = PVS2D_FindLeafOfPoint(&ref->root, px, py), refQ = PVS2D_FindLeafOfPoint(&ref->root, qx, qy);
+		if (scene->csr.oob[p] != ref->csr.oob[refP] || scene->csr.oob[q] != ref->csr.oob[refQ]) {
+			printf("(%g, %g) or (%g, %g) is out of bounds in only one of the scenes\n", px, py, qx, qy);
+			return 0;
+		}
+		if (scene->csr.oob[p] || scene->csr.oob[q] || !_seeEachOther(segs, segsC, px, py, qx, qy)) continue;
+		if (!PVS2D_BitsetTest(scene->pvs + (size_t)p * wordsC, q) || !PVS2D_BitsetTest(ref->pvs + (size_t)refP * refWordsC, refQ)) {
+			printf("(%g, %g) sees (%g, %g), but their leaves are not in the PVS\n", px, py, qx, qy);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// a random segment: a wall piece on the grid, so it is added to an existing node, or a slanted one
+static void _randomSegment(int* seg) {
+	int x = (int)_rand(MAZE_N * CELL), y = (int)_rand(MAZE_N * CELL);
+	if (_rand(2)) {
+		int len = 1 + (int)_rand(CELL);
+		if (_rand(2)) _setSegment(seg, x - x % CELL, y, x - x % CELL, y + len, 1);
+		else _setSegment(seg, x, y - y % CELL, x + len, y - y % CELL, 1);
+	}
+	else {
+		_setSegment(seg, x, y, x + 1 + (int)_rand(CELL / 2), y + (int)_rand(CELL) - CELL / 2, (int)_rand(2));
+	}
+}
+
+int main(void) {
+	unsigned int initC;
+	int* maze = _genMaze(MAZE_N, CELL, 1, &initC, 0);
+	// the segments by id, and the ids of the ones in the scene
+	unsigned int idsCap = initC + 2 * BATCHES_C * BATCH_MAX + 1;
+	int* byId = (int*)malloc((size_t)idsCap * 5 * sizeof(int));
+	int* alive = (int*)malloc((size_t)idsCap * 5 * sizeof(int));
+	unsigned int* aliveIds = (unsigned int*)malloc(idsCap * sizeof(unsigned int));
+	if (!maze || !byId || !alive || !aliveIds) return 1;
+	memcpy(byId, maze, (size_t)initC * 5 * sizeof(int));
+	unsigned int aliveC = 0, nextId = initC;
+	for (unsigned int i = 0; i < initC; i++) aliveIds[aliveC++] = i;
+
+	PVS2D_BSPParams params;
+	PVS2D_DefaultBSPParams(&params);
+	params.threadsC = 1;
+	PVS2D_EditScene scene;
+	if (PVS2D_BuildEditScene(maze, initC, &params, &scene)) {
+		printf("failed to build the scene\n");
+		return 1;
+	}
+	int failed = 0;
+	for (unsigned int b = 0; b < BATCHES_C && !failed; b++) {
+		// adding and removing a batch gives back the same scene
+		_snapshot before;
+		int add[5 * BATCH_MAX];
+		unsigned int addIds[BATCH_MAX], addC = 1 + _rand(BATCH_MAX);
+		for (unsigned int i = 0; i < addC; i++) _randomSegment(add + 5 * i);
+		if (_takeSnapshot(&scene.csr, scene.pvs, &before)) return 1;
+		if (PVS2D_UpdateEditScene(&scene, add, addC, 0, 0, addIds) || PVS2D_UpdateEditScene(&scene, 0, 0, addIds, addC, 0)) {
+			printf("batch %u: failed to add and remove segments\n", b);
+			failed = 1;
+		}
+		else if (!_sameScenes(&before.csr, before.pvs, &scene.csr, scene.pvs)) {
+			printf("batch %u: adding and removing segments changed the scene\n", b);
+			failed = 1;
+		}
+		nextId += addC;
+
+		// an unknown id is rejected, and changes nothing
+		unsigned int unknown[2] = { aliveIds[_rand(aliveC)], _rand(2) ? addIds[0] : nextId + 1 };
+		if (!PVS2D_UpdateEditScene(&scene, add, addC, unknown, 2, 0)) {
+			printf("batch %u: removing an unknown segment %u succeeded\n", b, unknown[1]);
+			failed = 1;
+		}
+		else if (!_sameScenes(&before.csr, before.pvs, &scene.csr, scene.pvs)) {
+			printf("batch %u: a rejected update changed the scene\n", b);
+			failed = 1;
+		}
+		free(before.block);
+
+		// a random batch
+		unsigned int removeIds[BATCH_MAX], removeC = _rand(BATCH_MAX + 1);
+		for (unsigned int i = 0; i < removeC; i++) {
+			unsigned int k = _rand(aliveC);
+			removeIds[i] = aliveIds[k];
+			aliveIds[k] = aliveIds[--aliveC];
+		}
+		addC = _rand(BATCH_MAX + 1);
+		for (unsigned int i = 0; i < addC; i++) _randomSegment(add + 5 * i);
+		if (PVS2D_UpdateEditScene(&scene, add, addC, removeIds, removeC, addIds)) {
+			printf("batch %u: update failed\n", b);
+			failed = 1;
+			break;
+		}
+		for (unsigned int i = 0; i < addC; i++) {
+			if (addIds[i] != nextId + i) {
+				printf("batch %u: added segment got id %u instead of %u\n", b, addIds[i], nextId + i);
+				failed = 1;
+			}
+			memcpy(byId + 5 * (size_t)addIds[i], add + 5 * i, 5 * sizeof(int));
+			aliveIds[aliveC++] = addIds[i];
+		}
+		nextId += addC;
+
+		if (!_checkOwnTree(&scene)) {
+			printf("batch %u: the graph or the PVS differ from the ones built from the tree\n", b);
+			failed = 1;
+		}
+		for (unsigned int i = 0; i < aliveC; i++) {
+			memcpy(alive + 5 * i, byId + 5 * (size_t)aliveIds[i], 5 * sizeof(int));
+		}
+		PVS2D_EditScene ref;
+		if (PVS2D_BuildEditScene(alive, aliveC, &params, &ref)) {
+			printf("batch %u: failed to build the scene from scratch\n", b);
+			failed = 1;
+			break;
+		}
+		if (!_checkPairs(&scene, &ref, alive, aliveC)) {
+			printf("batch %u: the scene doesn't match the one built from scratch\n", b);
+			failed = 1;
+		}
+		PVS2D_FreeEditScene(&ref);
+	}
+
+	PVS2D_FreeEditScene(&scene);
+	free(maze);
+	free(byId);
+	free(alive);
+	free(aliveIds);
+	printf(failed ? "FAILED\n" : "OK\n");
+	return failed;
+}
@@ -0,0 +1,124 @@
+// checks that PVS2D_FindLeafOfPointBaked finds the same leaf as PVS2D_FindLeafOfPoint on the tree
+// it was baked from, and that PVS2D_FindLeavesOfPoints finds the same leaves as both. both checks
+// are run for random points and for points exactly on the split lines, where the side is decided
+// by the sign convention. the test is built once per instruction set (see CMakeLists.txt), so the
+// scalar, SSE2 and AVX packet code are all compared with the point by point search
+
+#include "maps.h"
+
+#include <stdio.h>
+
+// the return code that makes ctest skip the test
+#define SKIP_CODE 77
+
+#define SEGS_C 300
+#define COORD_MAX 1000
+#define RANDOM_POINTS_C 20000
+
+// adds a few points on the line of every segment: its ends, points inside and points outside of it.
+// every segment lies on the line of some node, so these are all exactly on split lines
+static unsigned int _pointsOnLines(const int* segs, unsigned int segsC, double* xs, double* ys) {
+	static const double ts[] = { 0.0, 1.0, 0.5, 0.25, 0.75, -0.5, 1.5, -3.0 };
+	unsigned int c = 0;
+	for (unsigned int i = 0; i < segsC; i++) {
+		const int* seg = segs + 5 * i;
+		for (unsigned int k = 0; k < sizeof(ts) / sizeof(ts[0]); k++) {
+			// exact, since the coordinates are small integers and the parameters are dyadic
+			xs[c] = seg[0] + ts[k] * (seg[2] - seg[0]);
+			ys[c] = seg[1] + ts[k] * (seg[3] - seg[1]);
+			c++;
+		}
+	}
+	return c;
+}
+
+// the baked tree against the linked one, point by point
+static int _checkBaked(PVS2D_BSPTreeNode* root, const PVS2D_BakedBSPTree* baked, const double* xs, const double* ys, unsigned int n, const char* what) {
+	int failsC = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		unsigned int leaf = PVS2D_FindLeafOfPoint(root, xs[i], ys[i]);
+		unsigned int leafBaked = PVS2D_FindLeafOfPointBaked(baked, xs[i], ys[i]);
+		if (leaf != leafBaked) {
+			if (failsC < 10) {
+				printf("%s: point (%g, %g): FindLeafOfPointBaked %u, FindLeafOfPoint %u\n", what, xs[i], ys[i], leafBaked, leaf);
+			}
+			failsC++;
+		}
+	}
+	return failsC != 0;
+}
+
+// the packets against both point by point searches
+static int _check(PVS2D_BSPTreeNode* root, const PVS2D_BakedBSPTree* baked, const double* xs, const double* ys, unsigned int n, const char* what) {
+	unsigned int* out = (unsigned int*)malloc(n * sizeof(unsigned int));
+	if (!out) return 1;
+	int failsC = 0;
+	// batches of different sizes, so the packets are cut at different offsets and the tails of the SIMD loops are run
+	for (unsigned int part = 1; part <= 65 && part <= n; part += 16) {
+		for (unsigned int start = 0; start < n; start += part) {
+			unsigned int c = n - start < part ? n - start : part;
+			PVS2D_FindLeavesOfPoints(baked, xs + start, ys + start, c, out + start);
+		}
+		for (unsigned int i = 0; i < n; i++) {
+			unsigned int leaf = PVS2D_FindLeafOfPoint(root, xs[i], ys[i]);
+			unsigned int leafBaked = PVS2D_FindLeafOfPointBaked(baked, xs[i], ys[i]);
+			if (out[i] != leaf || out[i] != leafBaked) {
+				if (failsC < 10) {
+					printf("%s: point (%g, %g): %u, FindLeafOfPoint %u, FindLeafOfPointBaked %u\n", what, xs[i], ys[i], out[i], leaf, leafBaked);
+				}
+				failsC++;
+			}
+		}
+	}
+	free(out);
+	return failsC != 0;
+}
+
+int main(void) {
+#if defined(__AVX__) && (defined(__GNUC__) || defined(__clang__))
+	if (!__builtin_cpu_supports("avx")) {
+		printf("AVX is not supported by this CPU\n");
+		return SKIP_CODE;
+	}
+#endif
+	int* segs = (int*)malloc(5 * SEGS_C * sizeof(int));
+	double* xs = (double*)malloc((8 * SEGS_C + RANDOM_POINTS_C) * sizeof(double));
+	double* ys = (double*)malloc((8 * SEGS_C + RANDOM_POINTS_C) * sizeof(double));
+	if (!segs || !xs || !ys) return 1;
+	for (unsigned int i = 0; i < SEGS_C; i++) {
+		int* seg = segs + 5 * i;
+		do {
+			seg[0] = (int)_rand(COORD_MAX);
+			seg[1] = (int)_rand(COORD_MAX);
+			// most of them are axis aligned, as in most maps
+			seg[2] = _rand(4) ? seg[0] : (int)_rand(COORD_MAX);
+			seg[3] = _rand(4) ? seg[1] : (int)_rand(COORD_MAX);
+		} while (seg[0] == seg[2] && seg[1] == seg[3]);
+		seg[4] = 1;
+	}
+	PVS2D_BSPTreeNode root;
+	PVS2D_BakedBSPTree baked;
+	if (PVS2D_BuildBSPTree(segs, SEGS_C, &root) || PVS2D_BakeBSPTree(0, &root, &baked)) {
+		printf("failed to build the tree\n");
+		return 1;
+	}
+
+	int failed = 0;
+	for (unsigned int i = 0; i < RANDOM_POINTS_C; i++) {
+		// a quarter of them on the integer grid, where the segments are
+		xs[i] = _rand(4) ? _rand(COORD_MAX * 64) / 64.0 : (double)_rand(COORD_MAX);
+		ys[i] = _rand(4) ? _rand(COORD_MAX * 64) / 64.0 : (double)_rand(COORD_MAX);
+	}
+	failed |= _checkBaked(&root, &baked, xs, ys, RANDOM_POINTS_C, "random");
+	failed |= _check(&root, &baked, xs, ys, RANDOM_POINTS_C, "random");
+	unsigned int onLinesC = _pointsOnLines(segs, SEGS_C, xs, ys);
+	failed |= _checkBaked(&root, &baked, xs, ys, onLinesC, "on split lines");
+	failed |= _check(&root, &baked, xs, ys, onLinesC, "on split lines");
+
+	free(baked.nodes);
+	free(segs);
+	free(xs);
+	free(ys);
+	printf(failed ? "FAILED\n" : "OK\n");
+	return failed;
+}
@@ -0,0 +1,69 @@
+// maps and random numbers shared by the tests. the tests are built from single files, so everything here is static inline
+
+#ifndef PVS2D_TEST_MAPS_H
+#define PVS2D_TEST_MAPS_H
+
+#include "pvs2d.h"
+
+#include <stdlib.h>
+
+static unsigned long long rngState = 0x2545F4914F6CDD1DULL;
+
+static inline unsigned int _rand(unsigned int below) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 7;
+	rngState ^= rngState << 17;
+	return (unsigned int)(rngState % below);
+}
+
+static inline void _setSegment(int* seg, int ax, int ay, int bx, int by, int opq) {
+	seg[0] = ax;
+	seg[1] = ay;
+	seg[2] = bx;
+	seg[3] = by;
+	seg[4] = opq;
+}
+
+// a maze of `n` x `n` square rooms of size `cell`. every inner wall is solid, has a doorway in the
+// middle, is missing, or if `doors` is set, has a door in its doorway. some rooms also get a slanted
+// pillar, so not all lines are axis aligned. `cell` must be divisible by 4.
+// returns the segments for PVS2D_BuildBSPTree, and the amount of them and of doors
+static inline int* _genMaze(unsigned int n, int cell, char doors, unsigned int* segsCDest, unsigned int* doorsCDest) {
+	// at most 3 segments for each of 2 * n * (n + 1) walls, and a pillar in every room
+	int* segs = (int*)malloc((6 * (size_t)n * (n + 1) + (size_t)n * n) * 5 * sizeof(int));
+	if (!segs) return 0;
+	unsigned int c = 0, doorsC = 0;
+	for (unsigned int i = 0; i <= n; i++) {
+		for (unsigned int j = 0; j < n; j++) {
+			for (unsigned int vertical = 0; vertical < 2; vertical++) {
+				// the wall from (x0, y0) to (x0 + dx, y0 + dy)
+				int x0 = vertical ? (int)i * cell : (int)j * cell, y0 = vertical ? (int)j * cell : (int)i * cell;
+				int dx = vertical ? 0 : cell, dy = vertical ? cell : 0;
+				unsigned int kind = (i == 0 || i == n) ? 0 : _rand(doors ? 4 : 3);
+				if (kind == 0) {
+					_setSegment(segs + 5 * c++, x0, y0, x0 + dx, y0 + dy, 1);
+				}
+				else if (kind != 2) {
+					_setSegment(segs + 5 * c++, x0, y0, x0 + dx / 4, y0 + dy / 4, 1);
+					_setSegment(segs + 5 * c++, x0 + dx, y0 + dy, x0 + dx * 3 / 4, y0 + dy * 3 / 4, 1);
+					if (kind == 3) {
+						_setSegment(segs + 5 * c++, x0 + dx / 4, y0 + dy / 4, x0 + dx * 3 / 4, y0 + dy * 3 / 4, PVS2D_DOOR(doorsC));
+						doorsC++;
+					}
+				}
+			}
+		}
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		for (unsigned int j = 0; j < n; j++) {
+			if (_rand(4)) continue;
+			int x = (int)i * cell + cell / 4, y = (int)j * cell + cell / 4;
+			_setSegment(segs + 5 * c++, x, y, x + cell / 2, y + (int)_rand(cell / 2), 1);
+		}
+	}
+	*segsCDest = c;
+	if (doorsCDest) *doorsCDest = doorsC;
+	return segs;
+}
+
+#endif
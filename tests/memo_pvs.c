@@ -0,0 +1,133 @@
+// checks PVS2D_PVS_MEMO and PVS2D_PVS_VERIFY against PVS2D_PVS_BRUTE on a maze: the memoized matrix
+// must be symmetric and the same for any number of threads, and VERIFY must return the number of
+// pairs in which it differs from the row of the leaf that goes first, counted here on its own
+
+#include "maps.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAZE_N 14
+#define CELL 16
+
+static const unsigned int threadsCs[] = { 1, 2, 8 };
+
+// the order in which PVS2D_PVS_MEMO processes the leaves: breadth first from every leaf that
+// isn't reached yet, the neighbours in the order of the graph. returns the rank of every leaf
+static unsigned int* _memoRanks(const PVS2D_CSRLeafGraph* csr) {
+	unsigned int leafC = csr->leafC;
+	unsigned int* order = (unsigned int*)malloc(leafC * sizeof(unsigned int));
+	unsigned int* rank = (unsigned int*)malloc(leafC * sizeof(unsigned int));
+	if (!order || !rank) {
+		free(order);
+		free(rank);
+		return 0;
+	}
+	for (unsigned int i = 0; i < leafC; i++) {
+		rank[i] = leafC;
+	}
+	unsigned int orderC = 0;
+	for (unsigned int start = 0; start < leafC; start++) {
+		if (csr->oob[start] || rank[start] != leafC) continue;
+		rank[start] = orderC;
+		order[orderC++] = start;
+		for (unsigned int head = orderC - 1; head < orderC; head++) {
+			unsigned int node = order[head];
+			for (unsigned int e = csr->adjStart[node]; e < csr->adjStart[node + 1]; e++) {
+				unsigned int leaf = csr->leaf[e];
+				if (csr->oob[leaf] || rank[leaf] != leafC) continue;
+				rank[leaf] = orderC;
+				order[orderC++] = leaf;
+			}
+		}
+	}
+	free(order);
+	return rank;
+}
+
+int main(void) {
+	unsigned int segsC;
+	int* segs = _genMaze(MAZE_N, CELL, 1, &segsC, 0);
+	if (!segs) return 1;
+	PVS2D_BSPTreeNode root;
+	unsigned int leafC;
+	if (PVS2D_BuildBSPTree(segs, segsC, &root) || PVS2D_BuildPortals(&root)) {
+		printf("failed to build the tree\n");
+		return 1;
+	}
+	PVS2D_LeafGraphNode* graph = PVS2D_BuildLeafGraph(&root, &leafC);
+	PVS2D_CSRLeafGraph csr;
+	if (!graph || PVS2D_BuildCSRLeafGraph(0, graph, leafC, &csr)) return 1;
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC);
+	size_t matrixSize = (size_t)leafC * wordsC * sizeof(PVS2D_BitsetWord);
+	PVS2D_BitsetWord* brute = (PVS2D_BitsetWord*)malloc(matrixSize);
+	PVS2D_BitsetWord* memo = (PVS2D_BitsetWord*)malloc(matrixSize);
+	PVS2D_BitsetWord* matrix = (PVS2D_BitsetWord*)malloc(matrixSize);
+	unsigned int* rank = _memoRanks(&csr);
+	if (!brute || !memo || !matrix || !rank) return 1;
+	if (PVS2D_BuildAllPVSCSR(&csr, 1, PVS2D_PVS_BRUTE, brute) || PVS2D_BuildAllPVSCSR(&csr, 1, PVS2D_PVS_MEMO, memo)) {
+		printf("failed to build the matrices\n");
+		return 1;
+	}
+
+	int failed = 0;
+	// every pair of leaves in the playable zone, the one that goes first decides it
+	unsigned int expected = 0, asymmetric = 0;
+	for (unsigned int i = 0; i < leafC; i++) {
+		if (csr.oob[i]) continue;
+		for (unsigned int j = 0; j < leafC; j++) {
+			if (csr.oob[j]) continue;
+			char seen = PVS2D_BitsetTest(memo + (size_t)i * wordsC, j) != 0;
+			if (seen != (PVS2D_BitsetTest(memo + (size_t)j * wordsC, i) != 0)) asymmetric++;
+			if (rank[j] < rank[i]) continue;
+			expected += seen != (PVS2D_BitsetTest(brute + (size_t)i * wordsC, j) != 0);
+		}
+	}
+	if (asymmetric) {
+		printf("PVS2D_PVS_MEMO: %u pairs aren't symmetric\n", asymmetric);
+		failed = 1;
+	}
+
+	char what[64];
+	for (unsigned int k = 0; k < sizeof(threadsCs) / sizeof(threadsCs[0]); k++) {
+		snprintf(what, sizeof(what), "PVS2D_PVS_MEMO, %u threads", threadsCs[k]);
+		memset(matrix, 0xA5, matrixSize);
+		if (PVS2D_BuildAllPVSCSR(&csr, threadsCs[k], PVS2D_PVS_MEMO, matrix)) {
+			printf("%s failed\n", what);
+			failed = 1;
+		}
+		else if (memcmp(matrix, memo, matrixSize)) {
+			printf("%s: the matrix differs from the one of 1 thread\n", what);
+			failed = 1;
+		}
+
+		snprintf(what, sizeof(what), "PVS2D_PVS_VERIFY, %u threads", threadsCs[k]);
+		memset(matrix, 0xA5, matrixSize);
+		int diffC = PVS2D_BuildAllPVSCSR(&csr, threadsCs[k], PVS2D_PVS_VERIFY, matrix);
+		if (diffC < 0) {
+			printf("%s failed\n", what);
+			failed = 1;
+			continue;
+		}
+		if ((unsigned int)diffC != expected) {
+			printf("%s: %d pairs differ, expected %u\n", what, diffC, expected);
+			failed = 1;
+		}
+		// the matrix itself is the memoized one
+		if (memcmp(matrix, memo, matrixSize)) {
+			printf("%s: the matrix differs from PVS2D_PVS_MEMO\n", what);
+			failed = 1;
+		}
+		PVS2D_ShutdownThreads();
+	}
+	printf("%u pairs differ from PVS2D_PVS_BRUTE\n", expected);
+
+	free(rank);
+	free(matrix);
+	free(memo);
+	free(brute);
+	free(csr.x1);
+	free(segs);
+	printf(failed ? "FAILED\n" : "OK\n");
+	return failed;
+}
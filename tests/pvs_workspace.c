@@ -0,0 +1,100 @@
+// checks PVS2D_GetLeafPVSInto with one workspace and one output array for a long run of queries
+// from random leaves: every query must give exactly PVS2D_GetLeafPVSBitsCSR of its leaf, so nothing
+// may be left behind by the previous ones. a query from an out of bounds leaf must fail and clear the output
+
+#include "maps.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAZE_N 14
+#define CELL 16
+#define QUERIES_C 3000
+
+int main(void) {
+	unsigned int segsC;
+	int* segs = _genMaze(MAZE_N, CELL, 1, &segsC, 0);
+	if (!segs) return 1;
+	PVS2D_BSPTreeNode root;
+	unsigned int leafC;
+	if (PVS2D_BuildBSPTree(segs, segsC, &root) || PVS2D_BuildPortals(&root)) {
+		printf("failed to build the tree\n");
+		return 1;
+	}
+	PVS2D_LeafGraphNode* graph = PVS2D_BuildLeafGraph(&root, &leafC);
+	PVS2D_CSRLeafGraph csr;
+	if (!graph || PVS2D_BuildCSRLeafGraph(0, graph, leafC, &csr)) return 1;
+	PVS2D_BitsetWord** rows = (PVS2D_BitsetWord**)calloc(leafC, sizeof(PVS2D_BitsetWord*));
+	char* out = (char*)calloc(leafC, 1);
+	if (!rows || !out) return 1;
+	unsigned int oobC = 0;
+	for (unsigned int i = 0; i < leafC; i++) {
+		if (csr.oob[i]) {
+			oobC++;
+			continue;
+		}
+		rows[i] = PVS2D_GetLeafPVSBitsCSR(&csr, i);
+		if (!rows[i]) return 1;
+	}
+	// a bigger workspace than needed is fine as well
+	PVS2D_PVSWorkspace ws;
+	if (PVS2D_InitPVSWorkspace(leafC + 100, &ws)) return 1;
+
+	int failsC = 0;
+	unsigned int prev = 0;
+	for (unsigned int q = 0; q < QUERIES_C && failsC < 10; q++) {
+		// sometimes the same leaf again, and sometimes an out of bounds one
+		unsigned int leaf = _rand(8) ? _rand(leafC) : prev;
+		if (csr.oob[leaf] && oobC < leafC && _rand(4)) continue;
+		prev = leaf;
+		int rez = PVS2D_GetLeafPVSInto(&csr, leaf, &ws, out);
+		if (csr.oob[leaf]) {
+			char empty = ws.leavesC == 0;
+			for (unsigned int j = 0; j < leafC; j++) {
+				if (out[j]) empty = 0;
+			}
+			if (!rez || !empty) {
+				printf("query %u from out of bounds leaf %u: %d, the output isn't cleared\n", q, leaf, rez);
+				failsC++;
+			}
+			continue;
+		}
+		if (rez) {
+			printf("query %u from leaf %u failed\n", q, leaf);
+			failsC++;
+			continue;
+		}
+		unsigned int count = 0;
+		char same = 1;
+		for (unsigned int j = 0; j < leafC; j++) {
+			char seen = PVS2D_BitsetTest(rows[leaf], j) != 0;
+			if (out[j] != seen) same = 0;
+			count += seen;
+		}
+		// the list has every leaf of the row once
+		if (ws.leavesC != count) same = 0;
+		for (unsigned int k = 0; k < ws.leavesC && same; k++) {
+			if (ws.leaves[k] >= leafC || !out[ws.leaves[k]]) same = 0;
+			else out[ws.leaves[k]] = 2;
+		}
+		for (unsigned int k = 0; k < ws.leavesC; k++) {
+			if (ws.leaves[k] < leafC && out[ws.leaves[k]] == 2) out[ws.leaves[k]] = 1;
+			else same = 0;
+		}
+		if (!same) {
+			printf("query %u from leaf %u differs from PVS2D_GetLeafPVSBitsCSR\n", q, leaf);
+			failsC++;
+		}
+	}
+
+	PVS2D_FreePVSWorkspace(&ws);
+	for (unsigned int i = 0; i < leafC; i++) {
+		free(rows[i]);
+	}
+	free(rows);
+	free(out);
+	free(csr.x1);
+	free(segs);
+	printf(failsC ? "FAILED\n" : "OK\n");
+	return failsC != 0;
+}
@@ -0,0 +1,113 @@
+// checks PVS2D_FindLeafsOfSegmentList on a maze, for random segments and for segments lying on
+// the split lines: the leaves must be the same as the ones of PVS2D_FindLeafsOfSegmentBits, each once,
+// and must go from the start of the segment to its end. every point inside the segment must be in one
+// of them, and a list cut by `outCap` must be the start of the full one, with the full count returned
+
+#include "maps.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAZE_N 14
+#define CELL 16
+#define SEGMENTS_C 4000
+// points checked along every segment
+#define SAMPLES_C 256
+
+// a coordinate around the maze, not on the integer grid of its lines
+static double _randomCoord(void) {
+	return (double)_rand((MAZE_N * CELL + 16) * 1024) / 1024.0 - 8 + 1.0 / 4096;
+}
+
+static int _checkSegment(
+	PVS2D_BSPTreeNode* root, unsigned int leafC, double ax, double ay, double bx, double by, char onLine,
+	unsigned int* list, unsigned int* cut, PVS2D_BitsetWord* bits, unsigned int* order
+) {
+	unsigned int wordsC = PVS2D_BITSET_WORDS(leafC);
+	unsigned int listC = PVS2D_FindLeafsOfSegmentList(root, ax, ay, bx, by, list, leafC);
+	if (listC == 0 || listC > leafC) {
+		printf("segment (%g, %g) - (%g, %g): %u leaves\n", ax, ay, bx, by, listC);
+		return 1;
+	}
+	// the same set as the recursive search, every leaf once
+	memset(bits, 0, wordsC * sizeof(PVS2D_BitsetWord));
+	PVS2D_FindLeafsOfSegmentBits(root, ax, ay, bx, by, bits);
+	char same = PVS2D_BitsetCount(bits, wordsC) == listC;
+	for (unsigned int i = 0; i < leafC; i++) {
+		order[i] = leafC;
+	}
+	for (unsigned int k = 0; k < listC && same; k++) {
+		if (list[k] >= leafC || order[list[k]] != leafC || !PVS2D_BitsetTest(bits, list[k])) same = 0;
+		else order[list[k]] = k;
+	}
+	if (!same) {
+		printf("segment (%g, %g) - (%g, %g): the list differs from PVS2D_FindLeafsOfSegmentBits\n", ax, ay, bx, by);
+		return 1;
+	}
+	// the points go through the leaves in the order of the list. a segment on a split line is in
+	// the leaves of both sides, and the ones of each side are only ordered among themselves.
+	// the ends are left out: an end that only touches a line doesn't make the segment go to its other side
+	unsigned int prev = 0;
+	for (unsigned int k = 1; k < SAMPLES_C; k++) {
+		double t = (double)k / SAMPLES_C;
+		unsigned int leaf = PVS2D_FindLeafOfPoint(root, ax + t * (bx - ax), ay + t * (by - ay));
+		if (order[leaf] == leafC || (!onLine && order[leaf] < prev)) {
+			printf("segment (%g, %g) - (%g, %g): the point at %g is in leaf %u, %s\n", ax, ay, bx, by, t, leaf,
+				order[leaf] == leafC ? "which isn't in the list" : "which is out of order");
+			return 1;
+		}
+		prev = order[leaf];
+	}
+	// a cut list is the start of the full one, and nothing past `outCap` is written
+	unsigned int cap = listC / 2;
+	cut[cap] = ~0u;
+	unsigned int cutC = PVS2D_FindLeafsOfSegmentList(root, ax, ay, bx, by, cut, cap);
+	if (cutC != listC || memcmp(cut, list, cap * sizeof(unsigned int)) || cut[cap] != ~0u) {
+		printf("segment (%g, %g) - (%g, %g): list cut to %u leaves returned %u instead of %u\n", ax, ay, bx, by, cap, cutC, listC);
+		return 1;
+	}
+	return 0;
+}
+
+int main(void) {
+	unsigned int segsC;
+	int* segs = _genMaze(MAZE_N, CELL, 1, &segsC, 0);
+	if (!segs) return 1;
+	PVS2D_BSPTreeNode root;
+	if (PVS2D_BuildBSPTree(segs, segsC, &root) || PVS2D_BuildPortals(&root)) {
+		printf("failed to build the tree\n");
+		return 1;
+	}
+	unsigned int leafC;
+	PVS2D_LeafGraphNode* graph = PVS2D_BuildLeafGraph(&root, &leafC);
+	unsigned int* list = (unsigned int*)malloc(leafC * sizeof(unsigned int));
+	unsigned int* cut = (unsigned int*)malloc(leafC * sizeof(unsigned int));
+	unsigned int* order = (unsigned int*)malloc(leafC * sizeof(unsigned int));
+	PVS2D_BitsetWord* bits = (PVS2D_BitsetWord*)malloc(PVS2D_BITSET_WORDS(leafC) * sizeof(PVS2D_BitsetWord));
+	if (!graph || !list || !cut || !order || !bits) return 1;
+
+	int failsC = 0;
+	for (unsigned int i = 0; i < SEGMENTS_C && failsC < 10; i++) {
+		double ax = _randomCoord(), ay = _randomCoord(), bx = _randomCoord(), by = _randomCoord();
+		failsC += _checkSegment(&root, leafC, ax, ay, bx, by, 0, list, cut, bits, order);
+	}
+	// parts of the lines of the walls, inside and past their ends. the coordinates are exact,
+	// so these lie exactly on the split lines
+	static const double ts[] = { -1.5, -0.5, 0.0, 0.25, 0.5, 1.0, 2.0 };
+	for (unsigned int i = 0; i < segsC && failsC < 10; i++) {
+		const int* seg = segs + 5 * i;
+		unsigned int ta = _rand(sizeof(ts) / sizeof(ts[0])), tb = _rand(sizeof(ts) / sizeof(ts[0]));
+		if (ta == tb) continue;
+		double ax = seg[0] + ts[ta] * (seg[2] - seg[0]), ay = seg[1] + ts[ta] * (seg[3] - seg[1]);
+		double bx = seg[0] + ts[tb] * (seg[2] - seg[0]), by = seg[1] + ts[tb] * (seg[3] - seg[1]);
+		failsC += _checkSegment(&root, leafC, ax, ay, bx, by, 1, list, cut, bits, order);
+	}
+
+	free(bits);
+	free(order);
+	free(cut);
+	free(list);
+	free(segs);
+	printf(failsC ? "FAILED\n" : "OK\n");
+	return failsC != 0;
+}
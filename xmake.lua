@@ -5,6 +5,9 @@ target("pvs2d")
     add_files("src/pvs2d.c")
     add_includedirs("include", {public = true})
     add_headerfiles("include/pvs2d.h")
+    if not is_plat("windows", "mingw") then
+        add_syslinks("pthread", {public = true})
+    end
     if is_mode("debug") then
         add_defines("DEBUG")
     end